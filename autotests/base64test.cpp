@@ -0,0 +1,114 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "base64_p.h"
+
+#include <QRandomGenerator>
+#include <QTest>
+
+#include <KMime/Content>
+
+using namespace Akonadi::NoteUtils;
+class Base64Test : public QObject
+{
+    Q_OBJECT
+private:
+    static QByteArray randomData(qsizetype size, quint32 seed)
+    {
+        QRandomGenerator random(seed);
+        QByteArray data(size, Qt::Uninitialized);
+        for (char &c : data) {
+            c = char(random.bounded(256));
+        }
+        return data;
+    }
+
+    static void addSimdRows()
+    {
+        QTest::addColumn<int>("simd");
+        QTest::newRow("none") << int(Base64::Simd::None);
+        QTest::newRow("ssse3") << int(Base64::Simd::Ssse3);
+        QTest::newRow("avx2") << int(Base64::Simd::Avx2);
+    }
+
+private Q_SLOTS:
+    void testEncode_data()
+    {
+        addSimdRows();
+    }
+
+    // The lines must be the same as the ones KMime writes
+    void testEncode()
+    {
+        QFETCH(int, simd);
+        const auto level = Base64::Simd(simd);
+        QCOMPARE(Base64::encode(QByteArray(), level), QByteArray());
+        for (qsizetype size : {1, 2, 3, 11, 12, 15, 16, 17, 56, 57, 58, 114, 1000, 4096, 100000}) {
+            const QByteArray data = randomData(size, size);
+            KMime::Content content;
+            content.setBody(data);
+            content.contentTransferEncoding()->setEncoding(KMime::Headers::CEbase64);
+            QCOMPARE(Base64::encode(data, level), content.encodedBody());
+        }
+    }
+
+    void testDecode_data()
+    {
+        addSimdRows();
+    }
+
+    // The result must be the same as the one of QByteArray::fromBase64()
+    void testDecode()
+    {
+        QFETCH(int, simd);
+        const auto level = Base64::Simd(simd);
+        QRandomGenerator random(7);
+        for (qsizetype size : {0, 1, 2, 3, 12, 16, 24, 32, 57, 100, 1000, 100000}) {
+            const QByteArray data = randomData(size, size);
+            QByteArray encoded = Base64::encode(data);
+            QCOMPARE(Base64::decode(encoded, level), data);
+            encoded.replace('\n', "\r\n");
+            QCOMPARE(Base64::decode(encoded, level), data);
+            QCOMPARE(Base64::decode(data.toBase64(), level), data);
+
+            // Characters outside the alphabet are skipped wherever they are
+            for (int i = 0; i < 20 && !encoded.isEmpty(); ++i) {
+                encoded.insert(random.bounded(encoded.size()), "= *\x80\xff"[random.bounded(5)]);
+            }
+            QCOMPARE(Base64::decode(encoded, level), QByteArray::fromBase64(encoded));
+        }
+        const QByteArray truncated = Base64::encode(randomData(100, 1)).chopped(3);
+        QCOMPARE(Base64::decode(truncated, level), QByteArray::fromBase64(truncated));
+    }
+
+    void testIncrementalDecode_data()
+    {
+        addSimdRows();
+    }
+
+    void testIncrementalDecode()
+    {
+        QFETCH(int, simd);
+        const auto level = Base64::Simd(simd);
+        const QByteArray data = randomData(10000, 3);
+        const QByteArray encoded = Base64::encode(data);
+        for (qsizetype pieceSize : {1, 3, 5, 17, 77, 4096}) {
+            Base64::Decoder decoder(level);
+            QByteArray decoded;
+            for (qsizetype pos = 0; pos < encoded.size(); pos += pieceSize) {
+                const QByteArrayView piece = QByteArrayView(encoded).sliced(pos, std::min(pieceSize, encoded.size() - pos));
+                QByteArray out(Base64::Decoder::maxDecodedSize(piece.size()), Qt::Uninitialized);
+                out.truncate(decoder.decode(piece, out.data()));
+                decoded += out;
+            }
+            QCOMPARE(decoded, data);
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(Base64Test)
+
+#include "base64test.moc"
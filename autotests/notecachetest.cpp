@@ -0,0 +1,192 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notecache.h"
+#include "noteutils.h"
+
+#include <QTest>
+#include <QThreadPool>
+
+#include <KMime/Message>
+#include <QDateTime>
+#include <QTimeZone>
+
+using namespace Akonadi::NoteUtils;
+class NoteCacheTest : public QObject
+{
+    Q_OBJECT
+private:
+    static KMime::MessagePtr createMessage(const QString &uid, int attachmentSize = 0, int minute = 4)
+    {
+        NoteMessageWrapper note;
+        note.setUid(uid);
+        note.setTitle(QStringLiteral("title of ") + uid);
+        note.setText(QStringLiteral("text"));
+        note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, minute, 4), QTimeZone::utc()));
+        note.custom().insert(QStringLiteral("key"), QStringLiteral("value"));
+        if (attachmentSize > 0) {
+            note.attachments() << Attachment(QByteArray(attachmentSize, 'a'), QStringLiteral("application/octet-stream"));
+        }
+        return note.message();
+    }
+
+private Q_SLOTS:
+    void testRawMessage()
+    {
+        NoteCache cache;
+        const QByteArray raw = createMessage(QStringLiteral("uid"))->encodedContent();
+        const auto note = cache.note(raw);
+        QVERIFY(note);
+        QCOMPARE(note->uid(), QStringLiteral("uid"));
+        QCOMPARE(note->custom().value(QStringLiteral("key")), QStringLiteral("value"));
+        QCOMPARE(cache.note(raw), note);
+        QCOMPARE(cache.count(), 1);
+        QVERIFY(cache.totalCost() > 0);
+
+        QVERIFY(cache.note(raw + "changed") != note);
+        QVERIFY(!cache.note(QByteArray()));
+
+        const NoteCache::Statistics statistics = cache.statistics();
+        QCOMPARE(statistics.hits, 1);
+        QCOMPARE(statistics.misses, 2);
+        QCOMPARE(statistics.evictions, 0);
+        cache.resetStatistics();
+        QCOMPARE(cache.statistics().misses, 0);
+    }
+
+    void testMessage()
+    {
+        NoteCache cache;
+        const KMime::MessagePtr msg = createMessage(QStringLiteral("uid"));
+        const auto note = cache.note(msg);
+        QCOMPARE(note->title(), QStringLiteral("title of uid"));
+
+        // Another message of the same revision
+        auto copy = KMime::MessagePtr(new KMime::Message);
+        copy->setContent(msg->encodedContent());
+        copy->parse();
+        QCOMPARE(cache.note(copy), note);
+        QCOMPARE(cache.find(note->uid(), note->lastModifiedDate()), note);
+
+        // A newer revision
+        const auto newer = cache.note(createMessage(QStringLiteral("uid"), 0, 5));
+        QVERIFY(newer != note);
+        QCOMPARE(cache.count(), 2);
+
+        // Messages without uid are parsed, but not cached
+        auto anonymous = KMime::MessagePtr(new KMime::Message);
+        anonymous->subject(true)->fromUnicodeString(QStringLiteral("anonymous"));
+        anonymous->assemble();
+        QCOMPARE(cache.note(anonymous)->title(), QStringLiteral("anonymous"));
+        QCOMPARE(cache.count(), 2);
+        QVERIFY(!cache.note(KMime::MessagePtr()));
+
+        cache.clear();
+        QCOMPARE(cache.count(), 0);
+        QVERIFY(!cache.find(note->uid(), note->lastModifiedDate()));
+    }
+
+    void testInsert()
+    {
+        NoteCache cache;
+        auto note = QSharedPointer<NoteMessageWrapper>::create(createMessage(QStringLiteral("uid")));
+        cache.insert(note);
+        QCOMPARE(cache.find(QStringLiteral("uid"), note->lastModifiedDate()), note);
+        QVERIFY(!cache.find(QStringLiteral("uid"), note->lastModifiedDate().addSecs(1)));
+
+        cache.insert(QSharedPointer<NoteMessageWrapper>::create());
+        QCOMPARE(cache.count(), 1);
+
+        // A lazily parsed note is decoded completely, it no longer holds its message
+        const KMime::MessagePtr msg = createMessage(QStringLiteral("lazy"), 1000);
+        auto lazy = QSharedPointer<NoteMessageWrapper>::create(msg, NoteMessageWrapper::LazyParsing);
+        QVERIFY(lazy->estimatedMemoryUsage().message > 1000);
+        cache.insert(lazy);
+        QCOMPARE(cache.count(), 2);
+        QVERIFY(lazy->estimatedMemoryUsage().message < 1000);
+        QCOMPARE(cache.find(QStringLiteral("lazy"), lazy->lastModifiedDate())->custom().value(QStringLiteral("key")), QStringLiteral("value"));
+    }
+
+    void testCostOfDecodedAttachments()
+    {
+        NoteCache cache;
+        const auto note = cache.note(createMessage(QStringLiteral("uid"), 100 * 1024)->encodedContent());
+        const qint64 cost = cache.totalCost();
+        QVERIFY(cost > 100 * 1024 + 100 * 1024 * 4 / 3);
+
+        // Reading the attachment does not make the note outgrow its cost
+        QCOMPARE(note->attachments().first().data().size(), 100 * 1024);
+        QCOMPARE(note->estimatedMemoryUsage().total(), cost);
+    }
+
+    void testEviction()
+    {
+        NoteCache cache;
+        const auto first = cache.note(createMessage(QStringLiteral("first"), 100 * 1024));
+        const auto second = cache.note(createMessage(QStringLiteral("second"), 100 * 1024));
+        QCOMPARE(cache.count(), 2);
+        const qint64 cost = first->estimatedMemoryUsage().total();
+        QVERIFY(cost > 100 * 1024);
+        QCOMPARE(cache.totalCost(), cost + second->estimatedMemoryUsage().total());
+        cache.setMaxCost(cost * 5 / 2);
+        QCOMPARE(cache.count(), 2);
+
+        // The least recently used note goes first
+        QCOMPARE(cache.find(QStringLiteral("first"), first->lastModifiedDate()), first);
+        const auto third = cache.note(createMessage(QStringLiteral("third"), 100 * 1024));
+        QCOMPARE(cache.count(), 2);
+        QVERIFY(cache.totalCost() <= cache.maxCost());
+        QCOMPARE(cache.statistics().evictions, 1);
+        QVERIFY(cache.find(QStringLiteral("first"), first->lastModifiedDate()));
+        QVERIFY(!cache.find(QStringLiteral("second"), second->lastModifiedDate()));
+
+        // Evicted notes stay valid
+        QCOMPARE(second->attachments().first().data().size(), 100 * 1024);
+
+        cache.setMaxCost(cost * 3 / 2);
+        QCOMPARE(cache.count(), 1);
+        QCOMPARE(cache.statistics().evictions, 2);
+
+        // Notes larger than the budget are not cached
+        const auto large = cache.note(createMessage(QStringLiteral("large"), 200 * 1024));
+        QVERIFY(large);
+        QCOMPARE(cache.count(), 1);
+    }
+
+    void testConcurrentReaders()
+    {
+        NoteCache cache(1024 * 1024);
+        QList<QByteArray> raw;
+        for (int i = 0; i < 8; ++i) {
+            raw << createMessage(QString::number(i), 1000)->encodedContent();
+        }
+
+        QThreadPool pool;
+        pool.setMaxThreadCount(4);
+        QAtomicInt failures;
+        for (int thread = 0; thread < 4; ++thread) {
+            pool.start([&] {
+                for (int round = 0; round < 50; ++round) {
+                    const QByteArray &message = raw.at(round % raw.size());
+                    const auto note = cache.note(message);
+                    const QString expected = QStringLiteral("title of %1").arg(round % raw.size());
+                    if (note->title() != expected || note->message()->subject(false)->asUnicodeString() != expected) {
+                        failures.ref();
+                    }
+                }
+            });
+        }
+        pool.waitForDone();
+        QCOMPARE(failures.loadRelaxed(), 0);
+        QCOMPARE(cache.count(), raw.size());
+        const NoteCache::Statistics statistics = cache.statistics();
+        QCOMPARE(statistics.hits + statistics.misses, 4 * 50);
+    }
+};
+
+QTEST_MAIN(NoteCacheTest)
+
+#include "notecachetest.moc"
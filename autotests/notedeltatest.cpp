@@ -0,0 +1,330 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notedelta.h"
+#include "notefixture.h"
+#include "noteutils.h"
+
+#include <QTest>
+
+#include <KMime/Message>
+#include <QDateTime>
+#include <QTimeZone>
+#include <QUrl>
+
+#include <map>
+
+using namespace Akonadi::NoteUtils;
+using namespace NoteFixture;
+
+// Stands in for the other end of a sync, which only gets deltas after the first revision
+class Peer
+{
+public:
+    void store(NoteMessageWrapper &&note)
+    {
+        const QString uid = note.uid();
+        mNotes.insert_or_assign(uid, std::move(note));
+    }
+
+    NoteDeltaStatus receive(const QByteArray &delta)
+    {
+        const std::optional<NoteDeltaBase> base = scanNoteDelta(delta);
+        if (!base) {
+            return NoteDeltaStatus::InvalidDelta;
+        }
+        const auto it = mNotes.find(base->uid);
+        if (it == mNotes.end()) {
+            return NoteDeltaStatus::BaseMismatch;
+        }
+        const NoteDeltaStatus status = applyNoteDelta(delta, it->second);
+        if (status == NoteDeltaStatus::Applied && it->second.uid() != base->uid) {
+            NoteMessageWrapper note = std::move(it->second);
+            mNotes.erase(it);
+            store(std::move(note));
+        }
+        return status;
+    }
+
+    const NoteMessageWrapper *note(const QString &uid) const
+    {
+        const auto it = mNotes.find(uid);
+        return it == mNotes.end() ? nullptr : &it->second;
+    }
+
+private:
+    std::map<QString, NoteMessageWrapper> mNotes;
+};
+
+class NoteDeltaTest : public QObject
+{
+    Q_OBJECT
+private:
+    static void verifySame(const NoteMessageWrapper &note, const NoteMessageWrapper &revision)
+    {
+        QCOMPARE(note.fingerprint(), revision.fingerprint());
+        QCOMPARE(note.uid(), revision.uid());
+        QCOMPARE(note.title(), revision.title());
+        QCOMPARE(note.text(), revision.text());
+        QCOMPARE(note.textFormat(), revision.textFormat());
+        QCOMPARE(note.from(), revision.from());
+        QCOMPARE(note.classification(), revision.classification());
+        QCOMPARE(note.creationDate(), revision.creationDate());
+        QCOMPARE(note.lastModifiedDate(), revision.lastModifiedDate());
+        QCOMPARE(note.lastModifiedDate().offsetFromUtc(), revision.lastModifiedDate().offsetFromUtc());
+        QCOMPARE(note.custom(), revision.custom());
+        QCOMPARE(note.attachments(), revision.attachments());
+    }
+
+private Q_SLOTS:
+    void testSmallEdit()
+    {
+        const NoteMessageWrapper base = createBase();
+        NoteMessageWrapper revision = createBase();
+        revision.setText(QStringLiteral("first line\nthe second line"));
+
+        const QByteArray delta = encodeNoteDelta(base, revision);
+        QVERIFY(delta.size() < 100);
+
+        NoteMessageWrapper note = createBase();
+        QCOMPARE(applyNoteDelta(delta, note), NoteDeltaStatus::Applied);
+        verifySame(note, revision);
+    }
+
+    void testFields()
+    {
+        const NoteMessageWrapper base = createBase();
+        NoteMessageWrapper revision = createBase();
+        revision.setUid(QStringLiteral("new uid"));
+        revision.setTitle(QStringLiteral("new title"));
+        revision.setText(QStringLiteral("<b>rich</b> text \U0001F600"), Qt::RichText);
+        revision.setFrom(QString());
+        revision.setClassification(NoteMessageWrapper::Confidential);
+        revision.setCreationDate(QDateTime());
+        revision.setLastModifiedDate(QDateTime(QDate(1960, 5, 5), QTime(5, 5, 5), QTimeZone::fromSecondsAheadOfUtc(-7 * 3600)));
+        revision.custom().remove(QStringLiteral("a"));
+        revision.custom().insert(QStringLiteral("b"), QStringLiteral("changed"));
+        revision.custom().insert(QStringLiteral("c"), QStringLiteral("new"));
+
+        const QByteArray delta = encodeNoteDelta(base, revision);
+        NoteMessageWrapper note = createBase();
+        QCOMPARE(applyNoteDelta(delta, note), NoteDeltaStatus::Applied);
+        verifySame(note, revision);
+
+        // Nothing changed
+        const QByteArray empty = encodeNoteDelta(base, createBase());
+        NoteMessageWrapper unchanged = createBase();
+        QCOMPARE(applyNoteDelta(empty, unchanged), NoteDeltaStatus::Applied);
+        verifySame(unchanged, base);
+    }
+
+    void testDistantEdits()
+    {
+        QStringList lines;
+        for (int i = 0; i < 2000; ++i) {
+            lines.append(QStringLiteral("line number %1 of a long note").arg(i));
+        }
+        NoteMessageWrapper base = createBase();
+        base.setText(lines.join(u'\n'));
+
+        // Edits at both ends of the text are stored as two ranges, not the text between them
+        QStringList edited = lines;
+        edited[3] = QStringLiteral("line number three of a long note");
+        edited.insert(1990, QStringLiteral("an inserted line"));
+        NoteMessageWrapper revision = createBase();
+        revision.setText(edited.join(u'\n'));
+        const QByteArray delta = encodeNoteDelta(base, revision);
+        QVERIFY(delta.size() < 200);
+        NoteMessageWrapper note = createBase();
+        note.setText(base.text());
+        QCOMPARE(applyNoteDelta(delta, note), NoteDeltaStatus::Applied);
+        QCOMPARE(note.text(), revision.text());
+
+        // Beyond the limit of changed lines the text is stored as a single range
+        QStringList rewritten = lines;
+        for (int i = 0; i < rewritten.size(); i += 2) {
+            rewritten[i].append(u'!');
+        }
+        NoteMessageWrapper rewrite = createBase();
+        rewrite.setText(rewritten.join(u'\n'));
+        NoteMessageWrapper rewrittenNote = createBase();
+        rewrittenNote.setText(base.text());
+        QCOMPARE(applyNoteDelta(encodeNoteDelta(base, rewrite), rewrittenNote), NoteDeltaStatus::Applied);
+        QCOMPARE(rewrittenNote.text(), rewrite.text());
+    }
+
+    void testSurrogatePairs()
+    {
+        NoteMessageWrapper base = createBase();
+        base.setText(QStringLiteral("a\U0001F600b"));
+        NoteMessageWrapper revision = createBase();
+        revision.setText(QStringLiteral("a\U0001F601b"));
+
+        NoteMessageWrapper note = createBase();
+        note.setText(base.text());
+        QCOMPARE(applyNoteDelta(encodeNoteDelta(base, revision), note), NoteDeltaStatus::Applied);
+        QCOMPARE(note.text(), revision.text());
+    }
+
+    void testParsedBase()
+    {
+        // The base of the sender has trailing whitespace, which the parsed base of the receiver lost
+        NoteMessageWrapper base = createBase();
+        base.setText(QStringLiteral("first line\nsecond line \n\n"));
+        NoteMessageWrapper revision = createBase();
+        revision.setText(QStringLiteral("first line\nsecond line \n\nthird line"));
+
+        NoteMessageWrapper parsed(base.message());
+        QVERIFY(parsed.text() != base.text());
+        QCOMPARE(parsed.fingerprint(), base.fingerprint());
+        QCOMPARE(applyNoteDelta(encodeNoteDelta(base, revision), parsed), NoteDeltaStatus::Applied);
+        verifySame(parsed, revision);
+
+        // Removed trailing whitespace is no change to apply
+        NoteMessageWrapper trimmed = createBase();
+        trimmed.setText(QStringLiteral("first line\nsecond line"));
+        NoteMessageWrapper parsedAgain(base.message());
+        QCOMPARE(applyNoteDelta(encodeNoteDelta(base, trimmed), parsedAgain), NoteDeltaStatus::Applied);
+        QCOMPARE(parsedAgain.text(), trimmed.text());
+    }
+
+    void testAttachments()
+    {
+        const NoteMessageWrapper base = createBase();
+
+        // Relabeled data of the base is referred to by digest
+        NoteMessageWrapper relabeled = createBase();
+        relabeled.attachments()[0].setLabel(QStringLiteral("label"));
+        const QByteArray relabelDelta = encodeNoteDelta(base, relabeled);
+        QVERIFY(relabelDelta.size() < 300);
+        NoteMessageWrapper note = createBase();
+        QCOMPARE(applyNoteDelta(relabelDelta, note), NoteDeltaStatus::Applied);
+        verifySame(note, relabeled);
+
+        // New data is included
+        NoteMessageWrapper revision = createBase();
+        revision.attachments().removeAt(1);
+        revision.attachments().append(createAttachment('z', QStringLiteral("z")));
+        revision.attachments().append(Attachment(QUrl(QStringLiteral("https://kde.org")), QStringLiteral("text/html")));
+        Attachment encoded(QByteArray("encoded").toBase64(), QStringLiteral("text/plain"));
+        encoded.setDataBase64Encoded(true);
+        encoded.setContentID(QStringLiteral("cid"));
+        revision.attachments().append(encoded);
+        const QByteArray delta = encodeNoteDelta(base, revision);
+        QVERIFY(delta.size() > 10000);
+        QVERIFY(delta.size() < 11000);
+        NoteMessageWrapper added = createBase();
+        QCOMPARE(applyNoteDelta(delta, added), NoteDeltaStatus::Applied);
+        verifySame(added, revision);
+
+        // Reordered attachments reuse the data of the base
+        NoteMessageWrapper reordered = createBase();
+        reordered.attachments().swapItemsAt(0, 2);
+        const QByteArray reorderDelta = encodeNoteDelta(base, reordered);
+        QVERIFY(reorderDelta.size() < 1000);
+        NoteMessageWrapper reorderedNote = createBase();
+        QCOMPARE(applyNoteDelta(reorderDelta, reorderedNote), NoteDeltaStatus::Applied);
+        verifySame(reorderedNote, reordered);
+    }
+
+    void testBaseMismatch()
+    {
+        const NoteMessageWrapper base = createBase();
+        NoteMessageWrapper revision = createBase();
+        revision.setTitle(QStringLiteral("new title"));
+        const QByteArray delta = encodeNoteDelta(base, revision);
+
+        NoteMessageWrapper other = createBase();
+        other.setText(QStringLiteral("changed elsewhere"));
+        QCOMPARE(applyNoteDelta(delta, other), NoteDeltaStatus::BaseMismatch);
+        QCOMPARE(other.title(), base.title());
+
+        NoteMessageWrapper otherUid = createBase();
+        otherUid.setUid(QStringLiteral("other"));
+        QCOMPARE(applyNoteDelta(delta, otherUid), NoteDeltaStatus::BaseMismatch);
+    }
+
+    void testInvalidDelta()
+    {
+        const NoteMessageWrapper base = createBase();
+        NoteMessageWrapper revision = createBase();
+        revision.setText(QStringLiteral("new text"));
+        revision.custom().insert(QStringLiteral("c"), QStringLiteral("3"));
+        revision.attachments()[1].setLabel(QStringLiteral("label"));
+        const QByteArray delta = encodeNoteDelta(base, revision);
+
+        const std::optional<NoteDeltaBase> scanned = scanNoteDelta(delta);
+        QVERIFY(scanned);
+        QCOMPARE(scanned->uid, base.uid());
+        QCOMPARE(scanned->fingerprint, base.fingerprint());
+        QVERIFY(!scanNoteDelta(QByteArrayView("AKNS")));
+        QVERIFY(!scanNoteDelta(QByteArrayView()));
+
+        NoteMessageWrapper note = createBase();
+        for (qsizetype size = 0; size < delta.size(); ++size) {
+            QCOMPARE(applyNoteDelta(QByteArrayView(delta).first(size), note), NoteDeltaStatus::InvalidDelta);
+        }
+        QCOMPARE(applyNoteDelta(delta + 'x', note), NoteDeltaStatus::InvalidDelta);
+
+        QByteArray version = delta;
+        version[4] = 3;
+        QCOMPARE(applyNoteDelta(version, note), NoteDeltaStatus::InvalidDelta);
+
+        // A changed character of the new text gives another result
+        QByteArray corrupt = delta;
+        corrupt[corrupt.indexOf("new text")] = 'N';
+        QCOMPARE(applyNoteDelta(corrupt, note), NoteDeltaStatus::ResultMismatch);
+        verifySame(note, base);
+    }
+
+    void testPeer()
+    {
+        Peer peer;
+        NoteMessageWrapper local = createBase();
+        peer.store(createBase());
+
+        QList<QByteArray> deltas;
+        auto edit = [&](auto change) {
+            NoteMessageWrapper revision;
+            revision.setUid(local.uid());
+            revision.setTitle(local.title());
+            revision.setText(local.text(), local.textFormat());
+            revision.setFrom(local.from());
+            revision.setClassification(local.classification());
+            revision.setCreationDate(local.creationDate());
+            revision.setLastModifiedDate(local.lastModifiedDate());
+            revision.custom() = local.custom();
+            revision.attachments() = local.attachments();
+            change(revision);
+            revision.setLastModifiedDate(revision.lastModifiedDate().addSecs(60));
+            deltas.append(encodeNoteDelta(local, revision));
+            local = std::move(revision);
+        };
+        edit([](NoteMessageWrapper &n) {
+            n.setText(n.text() + QStringLiteral("\nthird line"));
+        });
+        edit([](NoteMessageWrapper &n) {
+            n.attachments().removeFirst();
+        });
+        edit([](NoteMessageWrapper &n) {
+            n.setUid(QStringLiteral("renamed"));
+        });
+
+        // Out of order deltas do not apply
+        QCOMPARE(peer.receive(deltas.at(1)), NoteDeltaStatus::BaseMismatch);
+        for (const QByteArray &delta : std::as_const(deltas)) {
+            QCOMPARE(peer.receive(delta), NoteDeltaStatus::Applied);
+        }
+        QVERIFY(!peer.note(QStringLiteral("uid")));
+        const NoteMessageWrapper *synced = peer.note(QStringLiteral("renamed"));
+        QVERIFY(synced);
+        verifySame(*synced, local);
+    }
+};
+
+QTEST_GUILESS_MAIN(NoteDeltaTest)
+
+#include "notedeltatest.moc"
@@ -0,0 +1,200 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notediff.h"
+#include "notefixture.h"
+#include "noteutils.h"
+
+#include <QCryptographicHash>
+#include <QTest>
+
+#include <KMime/Message>
+
+using namespace Akonadi::NoteUtils;
+using namespace NoteFixture;
+
+class NoteDiffTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testDigest()
+    {
+        const Attachment a = createAttachment('x');
+        QCOMPARE(a.digest(), QCryptographicHash::hash(a.data(), QCryptographicHash::Blake2b_256));
+        const Attachment copy = a;
+        QCOMPARE(copy.digest(), a.digest());
+
+        Attachment encoded(QByteArray(10000, 'x').toBase64(), QStringLiteral("application/octet-stream"));
+        const QByteArray beforeFlag = encoded.digest();
+        encoded.setDataBase64Encoded(true);
+        QCOMPARE(encoded.digest(), a.digest());
+        QVERIFY(beforeFlag != a.digest());
+
+        QVERIFY(Attachment(QUrl(QStringLiteral("file://url")), QStringLiteral("text/plain")).digest().isEmpty());
+    }
+
+    void testDiff()
+    {
+        const NoteMessageWrapper base = createBase();
+        QVERIFY(NoteDiff::between(base, createBase()).isEmpty());
+        QVERIFY(NoteDiff::between(base, base).isEmpty());
+
+        NoteMessageWrapper revision = createBase();
+        revision.setTitle(QStringLiteral("new title"));
+        revision.setText(revision.text(), Qt::RichText);
+        revision.custom().insert(QStringLiteral("a"), QStringLiteral("changed"));
+        revision.custom().remove(QStringLiteral("b"));
+        revision.custom().insert(QStringLiteral("d"), QStringLiteral("4"));
+        revision.attachments().removeAt(1);
+        revision.attachments().append(createAttachment('z'));
+
+        const NoteDiff diff = NoteDiff::between(base, revision);
+        QVERIFY(!diff.isEmpty());
+        QCOMPARE(diff.changedFields(), NoteDiff::TitleField | NoteDiff::TextField | NoteDiff::CustomField | NoteDiff::AttachmentsField);
+        QCOMPARE(diff.title(), QStringLiteral("new title"));
+        QCOMPARE(diff.textFormat(), Qt::RichText);
+        QCOMPARE(diff.text(), base.text());
+        QCOMPARE(diff.changedCustomValues(),
+                 (QMap<QString, QString>{{QStringLiteral("a"), QStringLiteral("changed")}, {QStringLiteral("d"), QStringLiteral("4")}}));
+        QCOMPARE(diff.removedCustomKeys(), QStringList(QStringLiteral("b")));
+        QCOMPARE(diff.removedAttachments(), QList<Attachment>{createAttachment('y')});
+        QCOMPARE(diff.addedAttachments(), QList<Attachment>{createAttachment('z')});
+
+        NoteMessageWrapper applied = createBase();
+        diff.apply(applied);
+        QCOMPARE(applied.fingerprint(), revision.fingerprint());
+        QCOMPARE(applied.attachments(), revision.attachments());
+        QVERIFY(NoteDiff::between(applied, revision).isEmpty());
+
+        // A changed label removes and adds the attachment
+        NoteMessageWrapper relabeled = createBase();
+        relabeled.attachments()[0].setLabel(QStringLiteral("label"));
+        const NoteDiff labelDiff = NoteDiff::between(base, relabeled);
+        QCOMPARE(labelDiff.changedFields(), NoteDiff::Fields(NoteDiff::AttachmentsField));
+        QCOMPARE(labelDiff.removedAttachments().size(), 1);
+        QCOMPARE(labelDiff.addedAttachments().size(), 1);
+        NoteMessageWrapper appliedLabel = createBase();
+        labelDiff.apply(appliedLabel);
+        QCOMPARE(appliedLabel.fingerprint(), relabeled.fingerprint());
+    }
+
+    void testReorderedAttachments()
+    {
+        const NoteMessageWrapper base = createBase();
+        NoteMessageWrapper revision = createBase();
+        revision.attachments().swapItemsAt(0, 2);
+        const NoteDiff diff = NoteDiff::between(base, revision);
+        QCOMPARE(diff.removedAttachments().size(), 3);
+        QCOMPARE(diff.addedAttachments().size(), 3);
+        NoteMessageWrapper applied = createBase();
+        diff.apply(applied);
+        QCOMPARE(applied.attachments(), revision.attachments());
+    }
+
+    void testParsedRevisions()
+    {
+        const NoteMessageWrapper base = createBase();
+        const NoteMessageWrapper parsed(base.message(), NoteMessageWrapper::LazyParsing);
+        QVERIFY(NoteDiff::between(base, parsed).isEmpty());
+    }
+
+    void testMerge()
+    {
+        const NoteMessageWrapper base = createBase();
+        NoteMessageWrapper local = createBase();
+        local.setTitle(QStringLiteral("local title"));
+        local.setLastModifiedDate(base.lastModifiedDate().addSecs(10));
+        local.custom().insert(QStringLiteral("a"), QStringLiteral("local"));
+        local.custom().insert(QStringLiteral("d"), QStringLiteral("same"));
+        local.attachments().append(createAttachment('z'));
+
+        NoteMessageWrapper remote = createBase();
+        remote.setText(QStringLiteral("remote text"), Qt::RichText);
+        remote.setLastModifiedDate(base.lastModifiedDate().addSecs(20));
+        remote.custom().remove(QStringLiteral("c"));
+        remote.custom().insert(QStringLiteral("d"), QStringLiteral("same"));
+        remote.attachments().removeFirst();
+        remote.attachments().append(createAttachment('z'));
+        remote.attachments().append(createAttachment('w'));
+
+        QCOMPARE(NoteDiff::merge(base, local, remote), NoteDiff::Fields());
+        QCOMPARE(local.title(), QStringLiteral("local title"));
+        QCOMPARE(local.text(), QStringLiteral("remote text"));
+        QCOMPARE(local.textFormat(), Qt::RichText);
+        QCOMPARE(local.lastModifiedDate(), remote.lastModifiedDate());
+        QCOMPARE(local.custom(),
+                 (QMap<QString, QString>{{QStringLiteral("a"), QStringLiteral("local")},
+                                         {QStringLiteral("b"), QStringLiteral("2")},
+                                         {QStringLiteral("d"), QStringLiteral("same")}}));
+        QCOMPARE(local.attachments(), (QList<Attachment>{base.attachments().at(1), base.attachments().at(2), createAttachment('z'), createAttachment('w')}));
+    }
+
+    void testMergeAttachments()
+    {
+        const Attachment a = createAttachment('a');
+        const Attachment b = createAttachment('b');
+        const Attachment c = createAttachment('c');
+        NoteMessageWrapper base;
+        base.attachments() << a << b << c;
+        auto revision = [](const QList<Attachment> &attachments) {
+            NoteMessageWrapper note;
+            note.attachments() = attachments;
+            return note;
+        };
+
+        // A removal is not undone by a reorder on the other side
+        NoteMessageWrapper local = revision({b, c});
+        QCOMPARE(NoteDiff::merge(base, local, revision({c, b, a})), NoteDiff::Fields());
+        QCOMPARE(local.attachments(), (QList<Attachment>{c, b}));
+        local = revision({c, b, a});
+        QCOMPARE(NoteDiff::merge(base, local, revision({b, c})), NoteDiff::Fields());
+        QCOMPARE(local.attachments(), (QList<Attachment>{c, b}));
+
+        // Attachments reordered differently on both sides keep the local order
+        local = revision({c, b, a});
+        QCOMPARE(NoteDiff::merge(base, local, revision({b, a, c})), NoteDiff::AttachmentsField);
+        QCOMPARE(local.attachments(), (QList<Attachment>{c, b, a}));
+
+        // Each side removing one of two equal attachments removes it once
+        NoteMessageWrapper duplicates;
+        duplicates.attachments() << a << a << b;
+        local = revision({a, b});
+        QCOMPARE(NoteDiff::merge(duplicates, local, revision({a, b, c})), NoteDiff::Fields());
+        QCOMPARE(local.attachments(), (QList<Attachment>{a, b, c}));
+        local = revision({a, b});
+        QCOMPARE(NoteDiff::merge(duplicates, local, revision({a, b})), NoteDiff::Fields());
+        QCOMPARE(local.attachments(), (QList<Attachment>{a, b}));
+    }
+
+    void testMergeConflicts()
+    {
+        const NoteMessageWrapper base = createBase();
+        NoteMessageWrapper local = createBase();
+        local.setTitle(QStringLiteral("local title"));
+        local.setLastModifiedDate(base.lastModifiedDate().addSecs(20));
+        local.custom().insert(QStringLiteral("a"), QStringLiteral("local"));
+        local.custom().remove(QStringLiteral("b"));
+
+        NoteMessageWrapper remote = createBase();
+        remote.setTitle(QStringLiteral("remote title"));
+        remote.setText(QStringLiteral("remote text"));
+        remote.setLastModifiedDate(base.lastModifiedDate().addSecs(10));
+        remote.custom().insert(QStringLiteral("a"), QStringLiteral("remote"));
+        remote.custom().insert(QStringLiteral("b"), QStringLiteral("remote"));
+        remote.custom().insert(QStringLiteral("c"), QStringLiteral("remote"));
+
+        QCOMPARE(NoteDiff::merge(base, local, remote), NoteDiff::TitleField | NoteDiff::CustomField);
+        QCOMPARE(local.title(), QStringLiteral("local title"));
+        QCOMPARE(local.text(), QStringLiteral("remote text"));
+        QCOMPARE(local.lastModifiedDate(), base.lastModifiedDate().addSecs(20));
+        QCOMPARE(local.custom(),
+                 (QMap<QString, QString>{{QStringLiteral("a"), QStringLiteral("local")}, {QStringLiteral("c"), QStringLiteral("remote")}}));
+    }
+};
+
+QTEST_GUILESS_MAIN(NoteDiffTest)
+
+#include "notedifftest.moc"
@@ -0,0 +1,41 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include "noteutils.h"
+
+#include <QDateTime>
+#include <QTimeZone>
+#include <QUrl>
+
+// The base revision the diff and delta tests derive their revisions from
+namespace NoteFixture
+{
+inline Akonadi::NoteUtils::Attachment createAttachment(char fill, const QString &label = QString())
+{
+    Akonadi::NoteUtils::Attachment a(QByteArray(10000, fill), QStringLiteral("application/octet-stream"));
+    a.setLabel(label);
+    return a;
+}
+
+inline Akonadi::NoteUtils::NoteMessageWrapper createBase()
+{
+    Akonadi::NoteUtils::NoteMessageWrapper note;
+    note.setUid(QStringLiteral("uid"));
+    note.setTitle(QStringLiteral("title"));
+    note.setText(QStringLiteral("first line\nsecond line"));
+    note.setFrom(QStringLiteral("from@kde.org"));
+    note.setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(3, 3, 3), QTimeZone::utc()));
+    note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()));
+    note.custom().insert(QStringLiteral("a"), QStringLiteral("1"));
+    note.custom().insert(QStringLiteral("b"), QStringLiteral("2"));
+    note.custom().insert(QStringLiteral("c"), QStringLiteral("3"));
+    note.attachments() << createAttachment('x') << createAttachment('y')
+                       << Akonadi::NoteUtils::Attachment(QUrl(QStringLiteral("file://url")), QStringLiteral("text/plain"));
+    return note;
+}
+}
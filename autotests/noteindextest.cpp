@@ -0,0 +1,187 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "noteindex.h"
+#include "noteutils.h"
+
+#include <QBuffer>
+#include <QTest>
+
+#include <KMime/Message>
+#include <QDateTime>
+#include <QTimeZone>
+
+using namespace Akonadi::NoteUtils;
+class NoteIndexTest : public QObject
+{
+    Q_OBJECT
+private:
+    static NoteMessageWrapper createNote(const QString &uid, const QString &title, const QString &text, int minute = 4)
+    {
+        NoteMessageWrapper note;
+        note.setUid(uid);
+        note.setTitle(title);
+        note.setText(text);
+        note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, minute, 4), QTimeZone::utc()));
+        return note;
+    }
+
+    static void fillIndex(NoteIndex &index)
+    {
+        index.addNote(createNote(QStringLiteral("a"), QStringLiteral("Shopping list"), QStringLiteral("Milk, bread and Butter")));
+        index.addNote(createNote(QStringLiteral("b"), QStringLiteral("Meeting"), QStringLiteral("Discuss the shopping budget")));
+        NoteMessageWrapper rich = createNote(QStringLiteral("c"), QStringLiteral("Recipe"), QString());
+        rich.setText(QStringLiteral("<html><body><p>Mix <b>butter</b> and sugar</p></body></html>"), Qt::RichText);
+        rich.custom().insert(QStringLiteral("tag"), QStringLiteral("dessert"));
+        index.addNote(rich);
+    }
+
+private Q_SLOTS:
+    void testTokenize()
+    {
+        QCOMPARE(NoteIndex::tokenize(u"Hello, World! e-mail x2 ÄÖÜ"),
+                 QStringList({QStringLiteral("hello"),
+                              QStringLiteral("world"),
+                              QStringLiteral("e"),
+                              QStringLiteral("mail"),
+                              QStringLiteral("x2"),
+                              QStringLiteral("äöü")}));
+        QCOMPARE(NoteIndex::tokenize(QString(65, QLatin1Char('a')) + QStringLiteral(" b")), QStringList(QStringLiteral("b")));
+        QVERIFY(NoteIndex::tokenize(u" ,.;").isEmpty());
+    }
+
+    void testSearch()
+    {
+        NoteIndex index;
+        fillIndex(index);
+        QCOMPARE(index.count(), 3);
+        QCOMPARE(index.uids(), QStringList({QStringLiteral("a"), QStringLiteral("b"), QStringLiteral("c")}));
+
+        QCOMPARE(index.find(QStringLiteral("shopping")), QStringList({QStringLiteral("a"), QStringLiteral("b")}));
+        QCOMPARE(index.find(QStringLiteral("BUTTER")), QStringList({QStringLiteral("a"), QStringLiteral("c")}));
+        QCOMPARE(index.find(QStringLiteral("dessert")), QStringList(QStringLiteral("c")));
+        // Markup is not indexed
+        QVERIFY(index.find(QStringLiteral("body")).isEmpty());
+        QVERIFY(index.find(QStringLiteral("shop")).isEmpty());
+
+        QCOMPARE(index.findPrefix(QStringLiteral("Shop")), QStringList({QStringLiteral("a"), QStringLiteral("b")}));
+        QCOMPARE(index.findPrefix(QStringLiteral("bu")), QStringList({QStringLiteral("a"), QStringLiteral("b"), QStringLiteral("c")}));
+        QVERIFY(index.findPrefix(QString()).isEmpty());
+
+        QCOMPARE(index.search(QStringLiteral("shopping butter")), QStringList(QStringLiteral("a")));
+        QCOMPARE(index.search(QStringLiteral("bud* shop*")), QStringList(QStringLiteral("b")));
+        QCOMPARE(index.search(QStringLiteral("sugar, butter")), QStringList(QStringLiteral("c")));
+        QVERIFY(index.search(QStringLiteral("shopping sugar")).isEmpty());
+        QVERIFY(index.search(QStringLiteral("  *")).isEmpty());
+        // A word too long to be indexed matches no note
+        QVERIFY(index.search(QString(65, QLatin1Char('a')) + QStringLiteral(" butter")).isEmpty());
+    }
+
+    void testIncrementalUpdate()
+    {
+        NoteIndex index;
+        fillIndex(index);
+        const qsizetype terms = index.termCount();
+
+        // The same revision is not indexed again
+        const NoteMessageWrapper same = createNote(QStringLiteral("a"), QStringLiteral("Other"), QStringLiteral("words"));
+        QVERIFY(!index.needsUpdate(QStringLiteral("a"), same.lastModifiedDate()));
+        QVERIFY(!index.addNote(same));
+        QVERIFY(index.find(QStringLiteral("other")).isEmpty());
+
+        // A new revision replaces the words of the old one
+        const NoteMessageWrapper changed = createNote(QStringLiteral("a"), QStringLiteral("Shopping list"), QStringLiteral("Eggs"), 5);
+        QVERIFY(index.needsUpdate(QStringLiteral("a"), changed.lastModifiedDate()));
+        QVERIFY(index.addNote(changed));
+        QCOMPARE(index.count(), 3);
+        QCOMPARE(index.lastModifiedDate(QStringLiteral("a")), changed.lastModifiedDate());
+        QCOMPARE(index.find(QStringLiteral("eggs")), QStringList(QStringLiteral("a")));
+        QCOMPARE(index.find(QStringLiteral("butter")), QStringList(QStringLiteral("c")));
+        QVERIFY(index.find(QStringLiteral("milk")).isEmpty());
+        // "milk" and "bread" are gone, "eggs" is new
+        QCOMPARE(index.termCount(), terms - 1);
+
+        QVERIFY(index.removeNote(QStringLiteral("c")));
+        QVERIFY(!index.removeNote(QStringLiteral("c")));
+        QVERIFY(!index.contains(QStringLiteral("c")));
+        QVERIFY(index.find(QStringLiteral("butter")).isEmpty());
+        QVERIFY(index.find(QStringLiteral("dessert")).isEmpty());
+
+        // The id of the removed note is reused
+        QVERIFY(index.addNote(createNote(QStringLiteral("d"), QStringLiteral("Shopping"), QString())));
+        QCOMPARE(index.find(QStringLiteral("shopping")), QStringList({QStringLiteral("a"), QStringLiteral("b"), QStringLiteral("d")}));
+
+        QVERIFY(!index.addNote(createNote(QString(), QStringLiteral("no uid"), QString())));
+
+        // A note without a date is indexed again each time
+        NoteMessageWrapper undated = createNote(QStringLiteral("e"), QStringLiteral("Undated"), QStringLiteral("first"));
+        undated.setLastModifiedDate(QDateTime());
+        QVERIFY(index.addNote(undated));
+        undated.setText(QStringLiteral("second"));
+        QVERIFY(index.needsUpdate(QStringLiteral("e"), QDateTime()));
+        QVERIFY(index.addNote(undated));
+        QVERIFY(index.find(QStringLiteral("first")).isEmpty());
+        QCOMPARE(index.find(QStringLiteral("second")), QStringList(QStringLiteral("e")));
+        index.clear();
+        QCOMPARE(index.count(), 0);
+        QCOMPARE(index.termCount(), 0);
+    }
+
+    void testMessage()
+    {
+        NoteIndex index;
+        const KMime::MessagePtr msg = createNote(QStringLiteral("a"), QStringLiteral("Title"), QStringLiteral("Body text")).message();
+        QVERIFY(index.addNote(msg));
+        QCOMPARE(index.find(QStringLiteral("body")), QStringList(QStringLiteral("a")));
+        QVERIFY(!index.addNote(msg));
+        QVERIFY(!index.addNote(KMime::MessagePtr()));
+    }
+
+    void testSerialization()
+    {
+        NoteIndex index;
+        fillIndex(index);
+        // A free id must not show up in the saved index
+        index.removeNote(QStringLiteral("b"));
+        index.addNote(createNote(QStringLiteral("long"), QString(), QString(300, QLatin1Char('x')) + QStringLiteral(" shopping ünïcode")));
+
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(index.writeTo(&buffer));
+        buffer.close();
+
+        NoteIndex loaded;
+        buffer.open(QIODevice::ReadOnly);
+        QVERIFY(loaded.readFrom(&buffer));
+        QCOMPARE(loaded.uids(), index.uids());
+        QCOMPARE(loaded.termCount(), index.termCount());
+        for (const QString &term : {QStringLiteral("shopping"), QStringLiteral("butter"), QStringLiteral("dessert"), QStringLiteral("ünïcode")}) {
+            QCOMPARE(loaded.find(term), index.find(term));
+        }
+        QCOMPARE(loaded.findPrefix(QStringLiteral("b")), index.findPrefix(QStringLiteral("b")));
+        QCOMPARE(loaded.lastModifiedDate(QStringLiteral("a")), index.lastModifiedDate(QStringLiteral("a")));
+        QVERIFY(!loaded.needsUpdate(QStringLiteral("a"), index.lastModifiedDate(QStringLiteral("a"))));
+
+        // Updates work on a loaded index
+        QVERIFY(loaded.addNote(createNote(QStringLiteral("a"), QStringLiteral("Renamed"), QString(), 6)));
+        QCOMPARE(loaded.find(QStringLiteral("shopping")), QStringList(QStringLiteral("long")));
+        QCOMPARE(loaded.find(QStringLiteral("renamed")), QStringList(QStringLiteral("a")));
+
+        // Broken data leaves the index empty
+        const QByteArray data = buffer.data();
+        for (const QByteArray &broken : {QByteArray("AKNI"), data.chopped(1), data + 'x', QByteArray(data).replace(0, 1, "X")}) {
+            QBuffer brokenBuffer;
+            brokenBuffer.setData(broken);
+            brokenBuffer.open(QIODevice::ReadOnly);
+            QVERIFY(!loaded.readFrom(&brokenBuffer));
+            QCOMPARE(loaded.count(), 0);
+        }
+    }
+};
+
+QTEST_MAIN(NoteIndexTest)
+
+#include "noteindextest.moc"
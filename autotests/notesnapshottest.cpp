@@ -0,0 +1,241 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notesnapshot.h"
+#include "noteutils.h"
+
+#include <QBuffer>
+#include <QTemporaryFile>
+#include <QTest>
+
+#include <KMime/Message>
+#include <QDateTime>
+#include <QTimeZone>
+#include <QUrl>
+
+using namespace Akonadi::NoteUtils;
+class NoteSnapshotTest : public QObject
+{
+    Q_OBJECT
+private:
+    static std::vector<NoteMessageWrapper> createNotes()
+    {
+        std::vector<NoteMessageWrapper> notes(3);
+        notes[0].setUid(QStringLiteral("c"));
+        notes[0].setTitle(QStringLiteral("Shopping list"));
+        notes[0].setText(QStringLiteral("<html><body>Milk and <b>bread</b></body></html>"), Qt::RichText);
+        notes[0].setFrom(QStringLiteral("test@kde.org"));
+        notes[0].setClassification(NoteMessageWrapper::Confidential);
+        notes[0].setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(3, 3, 3), QTimeZone::fromSecondsAheadOfUtc(3600)));
+        notes[0].setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()));
+        notes[0].custom().insert(QStringLiteral("key"), QStringLiteral("välue"));
+        notes[0].custom().insert(QStringLiteral("empty"), QString());
+
+        Attachment inlineAttachment(QByteArray("inline data \0 with a null", 25), QStringLiteral("application/octet-stream"));
+        inlineAttachment.setLabel(QStringLiteral("label"));
+        inlineAttachment.setContentID(QStringLiteral("cid"));
+        notes[0].attachments().append(inlineAttachment);
+        Attachment encodedAttachment(QByteArray("ZW5jb2RlZA=="), QStringLiteral("text/plain"));
+        encodedAttachment.setDataBase64Encoded(true);
+        notes[0].attachments().append(encodedAttachment);
+        notes[0].attachments().append(Attachment(QUrl(QStringLiteral("https://kde.org")), QStringLiteral("text/html")));
+
+        notes[1].setUid(QStringLiteral("a"));
+        notes[1].setTitle(QStringLiteral("Empty"));
+        notes[1].setText(QString());
+        notes[1].setCreationDate(QDateTime());
+        notes[1].setLastModifiedDate(QDateTime());
+
+        notes[2].setUid(QStringLiteral("b"));
+        notes[2].setTitle(QStringLiteral("Odd length ü"));
+        notes[2].setText(QStringLiteral("text"));
+        return notes;
+    }
+
+    static QList<const NoteMessageWrapper *> pointers(const std::vector<NoteMessageWrapper> &notes)
+    {
+        QList<const NoteMessageWrapper *> result;
+        for (const NoteMessageWrapper &note : notes) {
+            result.append(&note);
+        }
+        return result;
+    }
+
+    static QByteArray writeSnapshot(const std::vector<NoteMessageWrapper> &notes, NoteSnapshot::AttachmentDataMode mode = NoteSnapshot::WithAttachmentData)
+    {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        if (!NoteSnapshot::write(&buffer, pointers(notes), mode)) {
+            return {};
+        }
+        return buffer.data();
+    }
+
+    static void compareNotes(const NoteMessageWrapper &actual, const NoteMessageWrapper &expected)
+    {
+        QCOMPARE(actual.uid(), expected.uid());
+        QCOMPARE(actual.title(), expected.title());
+        QCOMPARE(actual.text(), expected.text());
+        QCOMPARE(actual.textFormat(), expected.textFormat());
+        QCOMPARE(actual.from(), expected.from());
+        QCOMPARE(actual.classification(), expected.classification());
+        QCOMPARE(actual.creationDate(), expected.creationDate());
+        QCOMPARE(actual.lastModifiedDate(), expected.lastModifiedDate());
+        QCOMPARE(actual.custom(), expected.custom());
+        QCOMPARE(actual.attachments().size(), expected.attachments().size());
+        for (qsizetype i = 0; i < expected.attachments().size(); ++i) {
+            QCOMPARE(actual.attachments().at(i), expected.attachments().at(i));
+            QCOMPARE(actual.attachments().at(i).label(), expected.attachments().at(i).label());
+        }
+    }
+
+private Q_SLOTS:
+    void testRoundTrip()
+    {
+        const std::vector<NoteMessageWrapper> notes = createNotes();
+        const QByteArray data = writeSnapshot(notes);
+        QVERIFY(!data.isEmpty());
+
+        NoteSnapshot snapshot;
+        QVERIFY(!snapshot.isValid());
+        QVERIFY2(snapshot.load(data), qPrintable(snapshot.errorString()));
+        QVERIFY(snapshot.isValid());
+        QCOMPARE(snapshot.count(), 3);
+
+        // Sorted by uid
+        QCOMPARE(snapshot.uid(0).toString(), QStringLiteral("a"));
+        QCOMPARE(snapshot.uid(1).toString(), QStringLiteral("b"));
+        QCOMPARE(snapshot.uid(2).toString(), QStringLiteral("c"));
+        QCOMPARE(snapshot.indexOf(u"c"), 2);
+        QCOMPARE(snapshot.indexOf(u"a"), 0);
+        QCOMPARE(snapshot.indexOf(u"bb"), -1);
+        QCOMPARE(snapshot.indexOf(QStringView()), -1);
+
+        // The strings are read from the snapshot
+        const QStringView title = snapshot.title(2);
+        QCOMPARE(title.toString(), QStringLiteral("Shopping list"));
+        QVERIFY(reinterpret_cast<const char *>(title.utf16()) >= data.constData());
+        QVERIFY(reinterpret_cast<const char *>(title.utf16()) < data.constData() + data.size());
+
+        QCOMPARE(snapshot.textFormat(2), Qt::RichText);
+        QCOMPARE(snapshot.classification(2), NoteMessageWrapper::Confidential);
+        QCOMPARE(snapshot.creationDate(2), notes[0].creationDate());
+        QCOMPARE(snapshot.creationDate(2).offsetFromUtc(), 3600);
+        QVERIFY(!snapshot.creationDate(0).isValid());
+        QCOMPARE(snapshot.attachmentCount(2), 3);
+        QVERIFY(snapshot.hasAttachmentData(2));
+
+        // So is the attachment data
+        const QByteArrayView attachmentData = snapshot.attachmentData(2, 0);
+        QCOMPARE(attachmentData.toByteArray(), QByteArray("inline data \0 with a null", 25));
+        QVERIFY(attachmentData.constData() >= data.constData());
+        QVERIFY(attachmentData.constData() + attachmentData.size() <= data.constData() + data.size());
+        QCOMPARE(snapshot.attachmentData(2, 1).toByteArray(), QByteArray("ZW5jb2RlZA=="));
+        QVERIFY(snapshot.attachmentData(2, 2).isEmpty());
+
+        compareNotes(snapshot.note(0), notes[1]);
+        compareNotes(snapshot.note(1), notes[2]);
+        compareNotes(snapshot.note(2), notes[0]);
+        const NoteMessageWrapper loaded = snapshot.note(2);
+        QVERIFY(loaded.attachments().at(1).dataBase64Encoded());
+        QCOMPARE(loaded.attachments().at(1).data(), QByteArray("ZW5jb2RlZA=="));
+        QCOMPARE(loaded.attachments().at(2).url(), QUrl(QStringLiteral("https://kde.org")));
+    }
+
+    void testWithoutAttachmentData()
+    {
+        const std::vector<NoteMessageWrapper> notes = createNotes();
+        const QByteArray data = writeSnapshot(notes, NoteSnapshot::WithoutAttachmentData);
+        QVERIFY(data.size() < writeSnapshot(notes).size());
+
+        NoteSnapshot snapshot;
+        QVERIFY(snapshot.load(data));
+        QVERIFY(!snapshot.hasAttachmentData(2));
+        QVERIFY(snapshot.hasAttachmentData(0));
+        QVERIFY(snapshot.attachmentData(2, 0).isEmpty());
+        const NoteMessageWrapper note = snapshot.note(2);
+        QCOMPARE(note.attachments().size(), 3);
+        QVERIFY(note.attachments().at(0).data().isEmpty());
+        QCOMPARE(note.attachments().at(0).contentID(), QStringLiteral("cid"));
+        QCOMPARE(note.attachments().at(2).url(), QUrl(QStringLiteral("https://kde.org")));
+    }
+
+    void testFile()
+    {
+        const std::vector<NoteMessageWrapper> notes = createNotes();
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        QVERIFY(NoteSnapshot::write(&file, pointers(notes)));
+        file.close();
+
+        NoteSnapshot snapshot;
+        QVERIFY2(snapshot.load(file.fileName()), qPrintable(snapshot.errorString()));
+        QCOMPARE(snapshot.count(), 3);
+        compareNotes(snapshot.note(2), notes[0]);
+
+        QVERIFY(!snapshot.load(file.fileName() + QStringLiteral(".missing")));
+        QVERIFY(!snapshot.isValid());
+        QCOMPARE(snapshot.count(), 0);
+        QVERIFY(!snapshot.errorString().isEmpty());
+    }
+
+    void testEmpty()
+    {
+        const QByteArray data = writeSnapshot({});
+        NoteSnapshot snapshot;
+        QVERIFY(snapshot.load(data));
+        QCOMPARE(snapshot.count(), 0);
+        QCOMPARE(snapshot.indexOf(u"a"), -1);
+    }
+
+    void testBrokenData()
+    {
+        const QByteArray data = writeSnapshot(createNotes());
+        NoteSnapshot snapshot;
+        QVERIFY(snapshot.load(data));
+
+        auto patched = [&data](qsizetype offset, quint64 value, qsizetype size) {
+            QByteArray result = data;
+            memcpy(result.data() + offset, &value, size);
+            return result;
+        };
+        // Header: magic, version, file size, note count, notes offset
+        // First note record: uid offset and length at 32, classification at 32 + 120
+        const QList<QByteArray> broken = {
+            QByteArray(),
+            data.left(31),
+            data.chopped(1),
+            data + QByteArray(8, 0),
+            QByteArray(data).replace(0, 1, "X"),
+            patched(4, 2, 4),
+            patched(16, 1000, 4),
+            patched(24, 33, 8),
+            patched(32, data.size() - 1, 8),
+            patched(32, 1, 8),
+            patched(40, 0xffffffff, 4),
+            patched(32 + 120, 3, 1),
+            patched(32 + 121, 200, 1),
+        };
+        for (const QByteArray &b : broken) {
+            QVERIFY(!snapshot.load(b));
+            QVERIFY(!snapshot.isValid());
+            QCOMPARE(snapshot.count(), 0);
+            QVERIFY(!snapshot.errorString().isEmpty());
+        }
+
+        // Notes that are not sorted are rejected, indexOf() relies on the order
+        NoteSnapshot valid;
+        QVERIFY(valid.load(data));
+        QByteArray swapped = data;
+        memcpy(swapped.data() + 32, data.constData() + 32 + 128, 16);
+        memcpy(swapped.data() + 32 + 128, data.constData() + 32, 16);
+        QVERIFY(!snapshot.load(swapped));
+    }
+};
+
+QTEST_GUILESS_MAIN(NoteSnapshotTest)
+
+#include "notesnapshottest.moc"
@@ -4,17 +4,64 @@
     SPDX-License-Identifier: LGPL-2.0-or-later
 */
 
+#include "htmltoplaintext_p.h"
 #include "noteutils.h"
 
+#include <QBuffer>
 #include <QDebug>
+#include <QDir>
 #include <QHash>
+#include <QLocale>
+#include <QScopeGuard>
+#include <QSemaphore>
+#include <QSet>
+#include <QTemporaryDir>
 #include <QTest>
+#include <QThreadPool>
 
 #include <KMime/Message>
 #include <QDateTime>
 #include <QTimeZone>
 
+#include <functional>
+#include <memory>
+#include <vector>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
 using namespace Akonadi::NoteUtils;
+
+// A buffer that fails the write call with the given index, counting from 0
+class FailingBuffer : public QBuffer
+{
+public:
+    explicit FailingBuffer(int failingWrite)
+        : mFailingWrite(failingWrite)
+    {
+    }
+
+    int writes() const
+    {
+        return mWrites;
+    }
+
+protected:
+    qint64 writeData(const char *data, qint64 size) override
+    {
+        if (mWrites++ == mFailingWrite) {
+            return -1;
+        }
+        return QBuffer::writeData(data, size);
+    }
+
+private:
+    const int mFailingWrite;
+    int mWrites = 0;
+};
+
 class NotesTest : public QObject
 {
     Q_OBJECT
@@ -57,6 +104,1105 @@ private Q_SLOTS:
         //       qWarning() << result.message()->encodedContent();
     }
 
+    void testLazyParsing()
+    {
+        NoteMessageWrapper note;
+        note.setTitle(QStringLiteral("title"));
+        note.setText(QStringLiteral("<html><body><p>text</p></body></html>"), Qt::RichText);
+        note.setUid(QStringLiteral("uid"));
+        note.setClassification(NoteMessageWrapper::Confidential);
+        note.setFrom(QStringLiteral("from@kde.org"));
+        note.setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(3, 3, 3), QTimeZone::utc()));
+        note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()));
+        note.attachments() << Attachment(QUrl(QStringLiteral("file://url/to/file")), QStringLiteral("mimetype/mime"))
+                           << Attachment("testfile", QStringLiteral("mimetype/mime2"));
+        note.custom().insert(QStringLiteral("key1"), QStringLiteral("value1"));
+
+        KMime::MessagePtr msg = note.message();
+        NoteMessageWrapper eager(msg);
+        NoteMessageWrapper lazy(msg, NoteMessageWrapper::LazyParsing);
+
+        QCOMPARE(lazy.uid(), eager.uid());
+        QCOMPARE(lazy.title(), eager.title());
+        QCOMPARE(lazy.lastModifiedDate(), eager.lastModifiedDate());
+        QCOMPARE(lazy.text(), eager.text());
+        QCOMPARE(lazy.textFormat(), eager.textFormat());
+        QCOMPARE(lazy.toPlainText(), eager.toPlainText());
+        QCOMPARE(lazy.classification(), eager.classification());
+        QCOMPARE(lazy.from(), eager.from());
+        QCOMPARE(lazy.creationDate(), eager.creationDate());
+        QCOMPARE(lazy.custom(), eager.custom());
+        QCOMPARE(lazy.attachments(), eager.attachments());
+
+        // Values set before the first access win over the pending message
+        NoteMessageWrapper changed(msg, NoteMessageWrapper::LazyParsing);
+        changed.setTitle(QStringLiteral("other title"));
+        changed.custom().insert(QStringLiteral("key2"), QStringLiteral("value2"));
+        NoteMessageWrapper result(changed.message());
+        QCOMPARE(result.title(), QStringLiteral("other title"));
+        QCOMPARE(result.uid(), eager.uid());
+        QCOMPARE(result.custom().size(), 2);
+        QCOMPARE(result.attachments(), eager.attachments());
+    }
+
+    void testScanNoteHeaders_data()
+    {
+        QTest::addColumn<QString>("title");
+        QTest::addColumn<bool>("crlf");
+
+        QTest::newRow("ascii") << QStringLiteral("title") << false;
+        QTest::newRow("encoded") << QStringLiteral("Ünïcödé títle with € and a long tail to force the header to be folded by the encoder") << false;
+        QTest::newRow("crlf") << QStringLiteral("Ünïcödé títle") << true;
+    }
+
+    void testScanNoteHeaders()
+    {
+        QFETCH(QString, title);
+        QFETCH(bool, crlf);
+
+        NoteMessageWrapper note;
+        note.setTitle(title);
+        note.setText(QStringLiteral("X-Akonotes-UID: not a header"));
+        note.setClassification(NoteMessageWrapper::Private);
+        note.setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(3, 3, 3), QTimeZone::utc()));
+        note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::fromSecondsAheadOfUtc(3600)));
+        note.attachments() << Attachment("testfile", QStringLiteral("mimetype/mime2"));
+
+        const KMime::MessagePtr msg = note.message();
+        const QByteArray raw = msg->encodedContent(crlf);
+        const NoteHeaderSummary summary = scanNoteHeaders(raw);
+
+        auto parsed = KMime::MessagePtr(new KMime::Message);
+        parsed->setContent(raw);
+        parsed->parse();
+        NoteMessageWrapper result(parsed);
+
+        QCOMPARE(summary.title, result.title());
+        QCOMPARE(summary.title, title);
+        QCOMPARE(summary.uid, result.uid());
+        QCOMPARE(summary.classification, result.classification());
+        QCOMPARE(summary.creationDate, result.creationDate());
+        QCOMPARE(summary.lastModifiedDate, result.lastModifiedDate());
+        QCOMPARE(summary.lastModifiedDate.offsetFromUtc(), result.lastModifiedDate().offsetFromUtc());
+    }
+
+    void testScanNoteHeadersStopsAtBody()
+    {
+        const QByteArray raw =
+            "Subject: =?utf-8?q?t=C3=AFtle?=\n"
+            "X-Akonotes-Classification: Confidential\n"
+            "\n"
+            "X-Akonotes-UID: body\n";
+        const NoteHeaderSummary summary = scanNoteHeaders(raw);
+        QCOMPARE(summary.title, QStringLiteral("t\u00eftle"));
+        QCOMPARE(summary.classification, NoteMessageWrapper::Confidential);
+        QVERIFY(summary.uid.isEmpty());
+        QVERIFY(!summary.creationDate.isValid());
+        QVERIFY(!summary.lastModifiedDate.isValid());
+    }
+
+    void testCustomValues()
+    {
+        NoteMessageWrapper note;
+        note.custom().insert(QStringLiteral("key1"), QStringLiteral("välue & <markup> € 漢字"));
+        note.custom().insert(QStringLiteral("key2"), QString());
+        note.custom().insert(QStringLiteral("key3"), QStringLiteral("  spaced  "));
+
+        NoteMessageWrapper result(note.message());
+        QCOMPARE(result.custom(), note.custom());
+    }
+
+    void testLegacyCustomPart()
+    {
+        // As written by the QDom based serializer
+        const QByteArray legacy =
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<custom version=\"1.0\">\n"
+            " <key1>value1</key1>\n"
+            " <key2>value &amp; 2</key2>\n"
+            " <key3/>\n"
+            "</custom>\n";
+
+        NoteMessageWrapper note;
+        note.custom().insert(QStringLiteral("placeholder"), QStringLiteral("value"));
+        KMime::MessagePtr msg = note.message();
+        const auto contents = msg->contents();
+        for (KMime::Content *c : contents) {
+            if (KMime::Headers::Base *type = c->headerByType("X-Akonotes-Type"); type && type->asUnicodeString() == QLatin1StringView("custom")) {
+                c->setBody(legacy);
+            }
+        }
+
+        NoteMessageWrapper result(msg);
+        QMap<QString, QString> expected;
+        expected.insert(QStringLiteral("key1"), QStringLiteral("value1"));
+        expected.insert(QStringLiteral("key2"), QStringLiteral("value & 2"));
+        expected.insert(QStringLiteral("key3"), QString());
+        QCOMPARE(result.custom(), expected);
+    }
+
+    void testTrailingCustomContent_data()
+    {
+        QTest::addColumn<QByteArray>("trailer");
+        QTest::addColumn<bool>("valid");
+
+        QTest::newRow("whitespace") << QByteArray("\n  \n") << true;
+        QTest::newRow("comment") << QByteArray("<!-- comment -->\n") << true;
+        QTest::newRow("element") << QByteArray("<other/>") << false;
+        QTest::newRow("text") << QByteArray("junk") << false;
+    }
+
+    void testTrailingCustomContent()
+    {
+        QFETCH(QByteArray, trailer);
+        QFETCH(bool, valid);
+
+        NoteMessageWrapper note;
+        note.custom().insert(QStringLiteral("placeholder"), QStringLiteral("value"));
+        KMime::MessagePtr msg = note.message();
+        const auto contents = msg->contents();
+        for (KMime::Content *c : contents) {
+            if (KMime::Headers::Base *type = c->headerByType("X-Akonotes-Type"); type && type->asUnicodeString() == QLatin1StringView("custom")) {
+                c->setBody("<custom version=\"1.0\"><key>value</key></custom>\n" + trailer);
+            }
+        }
+
+        NoteMessageWrapper result(msg);
+        QCOMPARE(result.errorString().isEmpty(), valid);
+        QCOMPARE(result.custom().value(QStringLiteral("key")), valid ? QStringLiteral("value") : QString());
+    }
+
+    void testToPlainText_data()
+    {
+        QTest::addColumn<QString>("html");
+        QTest::addColumn<QString>("plainText");
+
+        QTest::newRow("qt richtext") << QStringLiteral(
+            "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0//EN\" \"http://www.w3.org/TR/REC-html40/strict.dtd\">\n"
+            "<html><head><meta name=\"qrichtext\" content=\"1\" /><style type=\"text/css\">\np, li { white-space: pre-wrap; }\n</style></head>"
+            "<body style=\" font-family:'Sans Serif'; font-size:9pt;\">\n<p>first <b>line</b></p>\n<p>second line</p></body></html>")
+                                         << QStringLiteral("first line\nsecond line");
+        QTest::newRow("entities") << QStringLiteral("<BODY>a &lt;b&gt; &amp;&amp; &quot;c&quot; &#233;&#x20AC;&#128512; &nbsp;x&unknown; & y</BODY>")
+                                  << QStringLiteral("a <b> && \"c\" \u00e9\u20ac\U0001F600 \u00a0x&unknown; & y");
+        QTest::newRow("html4 entities") << QStringLiteral("<body>&eacute;t&eacute; &uuml;ber &euro;5 &mdash; &Omega;&thetasym;&zwj;&szlig; &Eacute;&notanentity;</body>")
+                                        << QStringLiteral("\u00e9t\u00e9 \u00fcber \u20ac5 \u2014 \u03a9\u03d1\u200d\u00df \u00c9&notanentity;");
+        QTest::newRow("leading entities") << QStringLiteral("<body>\n<p>&nbsp;&#32;&amp; text</p></body>") << QStringLiteral("& text");
+        QTest::newRow("no body") << QStringLiteral("<p>just a paragraph</p>") << QStringLiteral("just a paragraph");
+        QTest::newRow("unterminated tag") << QStringLiteral("<body>text <b unterminated</body>") << QStringLiteral("text <b unterminated");
+        QTest::newRow("empty") << QString() << QString();
+    }
+
+    void testToPlainText()
+    {
+        QFETCH(QString, html);
+        QFETCH(QString, plainText);
+
+        NoteMessageWrapper note;
+        note.setText(html, Qt::RichText);
+        QCOMPARE(note.toPlainText(), plainText);
+
+        note.setText(html, Qt::PlainText);
+        QCOMPARE(note.toPlainText(), html);
+    }
+
+    void testPreview_data()
+    {
+        QTest::addColumn<QString>("text");
+        QTest::addColumn<int>("format");
+
+        QString html = QStringLiteral("<html><head><style>p { white-space: pre-wrap; }</style></head><body style=\"font-size:9pt;\">\n");
+        QString plain = QStringLiteral("   \n");
+        for (int i = 0; i < 2000; ++i) {
+            html += QStringLiteral("<p><span style=\"color:#123456;\">line %1 &amp; \u00e9t\u00e9 \U0001F600</span></p>\n").arg(i);
+            plain += QStringLiteral("line %1 & \u00e9t\u00e9 \U0001F600\n").arg(i);
+        }
+        html += QStringLiteral("</body></html>");
+
+        QTest::newRow("rich") << html << int(Qt::RichText);
+        QTest::newRow("plain") << plain << int(Qt::PlainText);
+        QTest::newRow("short") << QStringLiteral("<body> short </body>") << int(Qt::RichText);
+        QTest::newRow("empty") << QString() << int(Qt::PlainText);
+    }
+
+    void testPreview()
+    {
+        QFETCH(QString, text);
+        QFETCH(int, format);
+
+        NoteMessageWrapper note;
+        note.setText(text, Qt::TextFormat(format));
+        const KMime::MessagePtr msg = note.message();
+
+        for (int maxChars : {0, 1, 17, 200, 5000}) {
+            // A surrogate pair is never split, so the expected preview can be one character shorter
+            const QString fullText = note.toPlainText();
+            QStringView plainText = fullText;
+            while (!plainText.isEmpty() && plainText.front().isSpace()) {
+                plainText = plainText.sliced(1);
+            }
+            QString expected = plainText.left(maxChars).toString();
+            if (expected.size() == maxChars && maxChars > 0 && expected.back().isHighSurrogate()) {
+                expected.chop(1);
+            }
+            expected = expected.trimmed();
+
+            QCOMPARE(note.preview(maxChars), expected);
+            NoteMessageWrapper eager(msg);
+            QCOMPARE(eager.preview(maxChars), expected);
+            NoteMessageWrapper lazy(msg, NoteMessageWrapper::LazyParsing);
+            QCOMPARE(lazy.preview(maxChars), expected);
+        }
+    }
+
+    void testPreviewOfFragmentStopsEarly()
+    {
+        QString fragment;
+        for (int i = 0; i < 20000; ++i) {
+            fragment += QStringLiteral("<p>line %1</p>\n").arg(i);
+        }
+
+        // A prefix of a fragment is enough, no <body> tag is waited for
+        QString result;
+        QVERIFY(htmlToPlainTextPrefix(QStringView(fragment).first(4096), 200, false, result));
+        QCOMPARE(result, htmlToPlainText(fragment).left(200).trimmed());
+
+        // A document waits for its body, but only for a bounded prefix
+        const QString document = QStringLiteral("<!DOCTYPE HTML><html><head>") + fragment;
+        QVERIFY(!htmlToPlainTextPrefix(QStringView(document).first(4096), 200, false, result));
+        QVERIFY(htmlToPlainTextPrefix(QStringView(document).first(64 * 1024), 200, false, result));
+        QVERIFY(!htmlToPlainTextPrefix(u"  <!DOC", 200, false, result));
+
+        // A complete text is only searched for a <body> tag within the same window
+        QVERIFY(htmlToPlainTextPrefix(fragment, 200, true, result));
+        QCOMPARE(result, htmlToPlainText(fragment).left(200).trimmed());
+        const QString lateBody = QString(64 * 1024, QLatin1Char('x')) + QStringLiteral("<body>y</body>");
+        QCOMPARE(htmlToPlainText(lateBody), QString(64 * 1024, QLatin1Char('x')) + QLatin1Char('y'));
+
+        NoteMessageWrapper note;
+        note.setText(fragment, Qt::RichText);
+        NoteMessageWrapper lazy(note.message(), NoteMessageWrapper::LazyParsing);
+        QCOMPARE(lazy.preview(200), htmlToPlainText(fragment).left(200).trimmed());
+    }
+
+    void testParseNotes()
+    {
+        QList<KMime::MessagePtr> messages;
+        QList<QByteArray> rawMessages;
+        for (int i = 0; i < 50; ++i) {
+            NoteMessageWrapper note;
+            note.setUid(QString::number(i));
+            note.setTitle(QStringLiteral("title %1").arg(i));
+            note.attachments() << Attachment(QByteArray(i, 'a'), QStringLiteral("mimetype/mime"));
+            messages << note.message();
+            rawMessages << messages.last()->encodedContent();
+        }
+        messages.insert(10, KMime::MessagePtr());
+        rawMessages.insert(10, QByteArray());
+
+        QThreadPool pool;
+        pool.setMaxThreadCount(4);
+        const QList<NoteParseResult> results = parseNotes(messages, &pool);
+        const QList<NoteParseResult> rawResults = parseNotes(rawMessages);
+        QCOMPARE(results.size(), messages.size());
+        QCOMPARE(rawResults.size(), rawMessages.size());
+
+        for (int i = 0; i < results.size(); ++i) {
+            if (i == 10) {
+                QVERIFY(!results.at(i).note);
+                QVERIFY(!results.at(i).errorString.isEmpty());
+                QVERIFY(!rawResults.at(i).note);
+                QVERIFY(!rawResults.at(i).errorString.isEmpty());
+                continue;
+            }
+            const int n = i < 10 ? i : i - 1;
+            for (const NoteParseResult &result : {results.at(i), rawResults.at(i)}) {
+                QVERIFY(result.note);
+                QVERIFY(result.errorString.isEmpty());
+                QCOMPARE(result.note->uid(), QString::number(n));
+                QCOMPARE(result.note->title(), QStringLiteral("title %1").arg(n));
+                QCOMPARE(result.note->attachments().first().data(), QByteArray(n, 'a'));
+            }
+        }
+    }
+
+    void testErrorString()
+    {
+        NoteMessageWrapper note;
+        note.setUid(QStringLiteral("uid"));
+        KMime::MessagePtr msg = note.message();
+        QVERIFY(NoteMessageWrapper(msg).errorString().isEmpty());
+
+        msg->headerByType("X-Akonotes-LastModified")->from7BitString("not a date");
+        QVERIFY(!NoteMessageWrapper(msg).errorString().isEmpty());
+        QVERIFY(!NoteMessageWrapper(KMime::MessagePtr()).errorString().isEmpty());
+    }
+
+    void testAsync()
+    {
+        NoteMessageWrapper note;
+        note.setTitle(QStringLiteral("title"));
+        note.setText(QStringLiteral("text"));
+        note.setUid(QStringLiteral("uid"));
+        note.setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(3, 3, 3), QTimeZone::utc()));
+        note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()));
+        note.attachments() << Attachment(QByteArray(1024 * 1024, 'x'), QStringLiteral("mimetype/mime"));
+        note.custom().insert(QStringLiteral("key"), QStringLiteral("value"));
+
+        QFuture<KMime::MessagePtr> serialized = note.serializeAsync();
+        // Changes after the call do not affect the result
+        note.setTitle(QStringLiteral("changed"));
+        const KMime::MessagePtr msg = serialized.result();
+        QVERIFY(msg);
+
+        QFuture<QSharedPointer<NoteMessageWrapper>> parsed = NoteMessageWrapper::parseAsync(msg);
+        const QSharedPointer<NoteMessageWrapper> result = parsed.result();
+        QVERIFY(result);
+        // The attachment data was decoded on the pool, next to its encoded form
+        QVERIFY(result->estimatedMemoryUsage().attachments > 1024 * 1024 + 1024 * 1024 * 4 / 3);
+        QCOMPARE(result->title(), QStringLiteral("title"));
+        QCOMPARE(result->text(), note.text());
+        QCOMPARE(result->uid(), note.uid());
+        QCOMPARE(result->lastModifiedDate(), note.lastModifiedDate());
+        QCOMPARE(result->custom(), note.custom());
+        QCOMPARE(result->attachments(), note.attachments());
+    }
+
+    void testAsyncCancel()
+    {
+        NoteMessageWrapper note;
+        note.setTitle(QStringLiteral("title"));
+
+        // Keep the only thread of the pool busy until both jobs are cancelled
+        QThreadPool pool;
+        pool.setMaxThreadCount(1);
+        QSemaphore blocker;
+        pool.start([&blocker] {
+            blocker.acquire();
+        });
+
+        QFuture<KMime::MessagePtr> serialized = note.serializeAsync(&pool);
+        QFuture<QSharedPointer<NoteMessageWrapper>> parsed = NoteMessageWrapper::parseAsync(note.message(), &pool);
+        serialized.cancel();
+        parsed.cancel();
+        blocker.release();
+        pool.waitForDone();
+
+        QVERIFY(serialized.isCanceled());
+        QCOMPARE(serialized.resultCount(), 0);
+        QVERIFY(parsed.isCanceled());
+        QCOMPARE(parsed.resultCount(), 0);
+    }
+
+    void testWriteTo_data()
+    {
+        QTest::addColumn<bool>("withParts");
+        QTest::newRow("single part") << false;
+        QTest::newRow("multipart") << true;
+    }
+
+    void testWriteTo()
+    {
+        QFETCH(bool, withParts);
+
+        NoteMessageWrapper note;
+        note.setTitle(QStringLiteral("Ünïcödé title"));
+        note.setText(QStringLiteral("<html><body>text with ümlauts\nand lines</body></html>"), Qt::RichText);
+        note.setUid(QStringLiteral("uid"));
+        note.setClassification(NoteMessageWrapper::Confidential);
+        note.setFrom(QStringLiteral("from@kde.org"));
+        note.setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(3, 3, 3), QTimeZone::utc()));
+        note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()));
+        if (withParts) {
+            QByteArray payload(100000, Qt::Uninitialized);
+            for (qsizetype i = 0; i < payload.size(); ++i) {
+                payload[i] = char(i * 7);
+            }
+            Attachment a(payload, QStringLiteral("application/octet-stream"));
+            a.setLabel(QStringLiteral("läbel"));
+            a.setContentID(QStringLiteral("part1@kde.org"));
+            note.attachments() << a << Attachment(QUrl(QStringLiteral("file://url/to/file")), QStringLiteral("mimetype/mime"))
+                               << Attachment(QByteArray(), QStringLiteral("mimetype/empty"));
+            note.custom().insert(QStringLiteral("key1"), QStringLiteral("välue1"));
+        }
+
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(note.writeTo(&buffer));
+
+        auto msg = KMime::MessagePtr(new KMime::Message);
+        msg->setContent(buffer.data());
+        msg->parse();
+        NoteMessageWrapper result(msg);
+
+        QCOMPARE(result.title(), note.title());
+        QCOMPARE(result.text(), note.text());
+        QCOMPARE(result.textFormat(), note.textFormat());
+        QCOMPARE(result.uid(), note.uid());
+        QCOMPARE(result.classification(), note.classification());
+        QCOMPARE(result.from(), note.from());
+        QCOMPARE(result.creationDate(), note.creationDate());
+        QCOMPARE(result.lastModifiedDate(), note.lastModifiedDate());
+        QCOMPARE(result.custom(), note.custom());
+        QCOMPARE(result.attachments(), note.attachments());
+        QVERIFY(result.errorString().isEmpty());
+
+        const NoteHeaderSummary summary = scanNoteHeaders(buffer.data());
+        QCOMPARE(summary.uid, note.uid());
+        QCOMPARE(summary.title, note.title());
+    }
+
+    void testWriteToFailure()
+    {
+        NoteMessageWrapper note;
+        note.setTitle(QStringLiteral("title"));
+        note.setText(QStringLiteral("text"));
+        note.custom().insert(QStringLiteral("key1"), QStringLiteral("value1"));
+        note.custom().insert(QStringLiteral("key2"), QStringLiteral("value2"));
+
+        FailingBuffer counter(-1);
+        counter.open(QIODevice::WriteOnly);
+        QVERIFY(note.writeTo(&counter));
+        QVERIFY(counter.writes() > 0);
+
+        // Also a failure while the custom values are written is reported
+        for (int i = 0; i < counter.writes(); ++i) {
+            FailingBuffer buffer(i);
+            buffer.open(QIODevice::WriteOnly);
+            QVERIFY2(!note.writeTo(&buffer), qPrintable(QString::number(i)));
+        }
+    }
+
+    void testAttachmentSharing()
+    {
+        QByteArray payload(4096, 'p');
+        const char *const payloadData = payload.constData();
+        Attachment a(std::move(payload), QStringLiteral("mimetype/mime"));
+        QVERIFY(a.data().constData() == payloadData);
+
+        Attachment copy(a);
+        QVERIFY(copy.data().constData() == payloadData);
+        copy.setLabel(QStringLiteral("label"));
+        QVERIFY(a.label().isEmpty());
+        QVERIFY(!(copy == a));
+
+        Attachment moved(std::move(copy));
+        QCOMPARE(moved.label(), QStringLiteral("label"));
+        copy = a;
+        QCOMPARE(copy, a);
+        copy.swap(moved);
+        QCOMPARE(copy.label(), QStringLiteral("label"));
+        QCOMPARE(moved, a);
+
+        // Inline attachments compare their data
+        QVERIFY(!(Attachment("data1", QStringLiteral("mimetype/mime")) == Attachment("data2", QStringLiteral("mimetype/mime"))));
+        QCOMPARE(Attachment("data1", QStringLiteral("mimetype/mime")), Attachment("data1", QStringLiteral("mimetype/mime")));
+
+        Attachment encoded("ZGF0YQ==", QStringLiteral("mimetype/mime"));
+        encoded.setDataBase64Encoded(true);
+        QVERIFY(encoded.dataBase64Encoded());
+        encoded.setDataBase64Encoded(false);
+        QVERIFY(!encoded.dataBase64Encoded());
+    }
+
+    void testMoveNote()
+    {
+        auto makeNote = [](QString text) {
+            NoteMessageWrapper note;
+            note.setTitle(QStringLiteral("title"));
+            note.setText(std::move(text), Qt::RichText);
+            return note;
+        };
+
+        QString text(100000, QLatin1Char('t'));
+        const QChar *const textData = text.constData();
+        NoteMessageWrapper note = makeNote(std::move(text));
+        QCOMPARE(note.title(), QStringLiteral("title"));
+        QCOMPARE(note.textFormat(), Qt::RichText);
+
+        std::vector<NoteMessageWrapper> notes;
+        notes.push_back(std::move(note));
+        notes.emplace_back(notes.front().message());
+        QCOMPARE(notes.back().title(), QStringLiteral("title"));
+
+        note = std::move(notes.front());
+        const QString taken = note.takeText();
+        QVERIFY(taken.constData() == textData);
+        QVERIFY(note.text().isEmpty());
+
+        QString uid = QStringLiteral("uid");
+        note.setUid(std::move(uid));
+        QCOMPARE(note.uid(), QStringLiteral("uid"));
+    }
+
+    void testIncrementalMessage()
+    {
+        auto attachmentBodies = [](const KMime::MessagePtr &msg) {
+            QList<QByteArray> bodies;
+            const auto contents = msg->contents();
+            for (KMime::Content *c : contents) {
+                if (c->contentDisposition(false)) {
+                    bodies << c->encodedBody();
+                }
+            }
+            return bodies;
+        };
+
+        NoteMessageWrapper note;
+        QVERIFY(note.reuseEncodedParts());
+        note.setTitle(QStringLiteral("title"));
+        note.attachments() << Attachment(QByteArray(5000, 'a'), QStringLiteral("application/octet-stream"))
+                           << Attachment(QUrl(QStringLiteral("file://url/to/file")), QStringLiteral("text/plain"));
+        note.custom().insert(QStringLiteral("key"), QStringLiteral("value"));
+        const KMime::MessagePtr first = note.message();
+        QVERIFY(note.estimatedMemoryUsage().message > 5000 * 4 / 3);
+
+        note.setTitle(QStringLiteral("other title"));
+        const KMime::MessagePtr second = note.message();
+        QCOMPARE(attachmentBodies(second), attachmentBodies(first));
+        NoteMessageWrapper result(second);
+        QCOMPARE(result.title(), QStringLiteral("other title"));
+        QCOMPARE(result.attachments(), note.attachments());
+        QCOMPARE(result.custom(), note.custom());
+
+        // Changes made through the references must not be hidden by the encoded parts
+        note.attachments()[0].setLabel(QStringLiteral("label"));
+        note.attachments() << Attachment(QByteArray(100, 'b'), QStringLiteral("application/octet-stream"));
+        note.custom()[QStringLiteral("key")] = QStringLiteral("other value");
+        NoteMessageWrapper changed(note.message());
+        QCOMPARE(changed.attachments(), note.attachments());
+        QCOMPARE(changed.custom(), note.custom());
+
+        note.attachments()[0] = Attachment(QByteArray(5000, 'c'), QStringLiteral("application/octet-stream"));
+        NoteMessageWrapper replaced(note.message());
+        QCOMPARE(replaced.attachments().at(0).data(), QByteArray(5000, 'c'));
+
+        // A parsed note reuses the parts of its message
+        result.setTitle(QStringLiteral("title"));
+        NoteMessageWrapper reparsed(result.message());
+        QCOMPARE(reparsed.attachments(), result.attachments());
+        QCOMPARE(reparsed.custom(), result.custom());
+
+        // The kept bodies are dropped with the option
+        note.setReuseEncodedParts(false);
+        QVERIFY(note.estimatedMemoryUsage().message < 5000);
+        NoteMessageWrapper unshared(note.message());
+        QCOMPARE(unshared.attachments(), note.attachments());
+        QVERIFY(note.estimatedMemoryUsage().message < 5000);
+
+        // Only a bounded amount of bodies is kept
+        note.setReuseEncodedParts(true);
+        note.attachments() << Attachment(QByteArray(3 * 1024 * 1024, 'd'), QStringLiteral("application/octet-stream"))
+                           << Attachment(QByteArray(3 * 1024 * 1024, 'e'), QStringLiteral("application/octet-stream"));
+        NoteMessageWrapper large(note.message());
+        QCOMPARE(large.attachments(), note.attachments());
+        const qsizetype kept = note.estimatedMemoryUsage().message;
+        QVERIFY(kept > 3 * 1024 * 1024 * 4 / 3);
+        QVERIFY(kept < 5 * 1024 * 1024);
+    }
+
+    void testPatchNoteHeaders_data()
+    {
+        QTest::addColumn<bool>("crlf");
+        QTest::newRow("lf") << false;
+        QTest::newRow("crlf") << true;
+    }
+
+    void testPatchNoteHeaders()
+    {
+        QFETCH(bool, crlf);
+        NoteMessageWrapper note;
+        note.setTitle(QStringLiteral("title"));
+        note.setText(QStringLiteral("text"));
+        note.setUid(QStringLiteral("uid"));
+        note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()));
+        note.attachments() << Attachment(QByteArray(1000, 'a'), QStringLiteral("application/octet-stream"));
+        note.custom().insert(QStringLiteral("key"), QStringLiteral("value"));
+        QByteArray raw = note.message()->encodedContent();
+        if (crlf) {
+            raw.replace('\n', "\r\n");
+        }
+        const QByteArray separator = crlf ? "\r\n\r\n" : "\n\n";
+
+        NoteHeaderChanges changes;
+        changes.title = QStringLiteral("Grüße");
+        changes.lastModifiedDate = QDateTime(QDate(2013, 5, 6), QTime(7, 8, 9), QTimeZone::utc());
+        changes.classification = NoteMessageWrapper::Confidential;
+        const QByteArray patched = patchNoteHeaders(raw, changes);
+
+        QCOMPARE(patched.sliced(patched.indexOf(separator)), raw.sliced(raw.indexOf(separator)));
+        if (crlf) {
+            QCOMPARE(patched.count("\r\n"), patched.count('\n'));
+        }
+
+        auto msg = KMime::MessagePtr(new KMime::Message);
+        msg->setContent(QByteArray(patched).replace("\r\n", "\n"));
+        msg->parse();
+        NoteMessageWrapper result(msg);
+        QCOMPARE(result.title(), *changes.title);
+        QCOMPARE(result.lastModifiedDate(), *changes.lastModifiedDate);
+        QCOMPARE(result.classification(), NoteMessageWrapper::Confidential);
+        QCOMPARE(result.uid(), note.uid());
+        QCOMPARE(result.text(), note.text());
+        QCOMPARE(result.attachments(), note.attachments());
+        QCOMPARE(result.custom(), note.custom());
+
+        // The fields are formatted like message() does
+        note.setTitle(*changes.title);
+        note.setLastModifiedDate(*changes.lastModifiedDate);
+        note.setClassification(NoteMessageWrapper::Confidential);
+        const KMime::MessagePtr expected = note.message();
+        QCOMPARE(msg->subject(false)->as7BitString(), expected->subject(false)->as7BitString());
+        QCOMPARE(msg->headerByType("X-Akonotes-LastModified")->as7BitString(), expected->headerByType("X-Akonotes-LastModified")->as7BitString());
+        QCOMPARE(msg->headerByType("X-Akonotes-Classification")->as7BitString(), expected->headerByType("X-Akonotes-Classification")->as7BitString());
+
+        // Missing headers are added, unchanged ones are left alone
+        const QByteArray minimal = crlf ? "Subject: title\r\n\r\nbody\r\n" : "Subject: title\n\nbody\n";
+        changes.title.reset();
+        const QByteArray added = patchNoteHeaders(minimal, changes);
+        QVERIFY(added.startsWith(minimal.first(minimal.indexOf(separator))));
+        QVERIFY(added.endsWith(separator + "body" + separator.first(separator.size() / 2)));
+        const NoteHeaderSummary summary = scanNoteHeaders(added);
+        QCOMPARE(summary.title, QStringLiteral("title"));
+        QCOMPARE(summary.lastModifiedDate, *changes.lastModifiedDate);
+        QCOMPARE(summary.classification, NoteMessageWrapper::Confidential);
+
+        QVERIFY(patchNoteHeaders(QByteArray(), changes).isEmpty());
+    }
+
+    void testLastModifiedDate_data()
+    {
+        QTest::addColumn<QByteArray>("value");
+        QTest::addColumn<QDateTime>("expected");
+        const QDateTime date(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc());
+        QTest::newRow("message") << QByteArray("Sat, 03 Mar 2012 04:04:04 +0000") << date;
+        QTest::newRow("no day name") << QByteArray("03 Mar 2012 04:04:04 +0000") << date;
+        QTest::newRow("no comma") << QByteArray("Sat 03 Mar 2012 04:04:04 +0000") << date;
+        QTest::newRow("short day") << QByteArray("Sat, 3 Mar 2012 04:04:04 +0000") << date;
+        QTest::newRow("no seconds") << QByteArray("Sat, 03 Mar 2012 04:04 +0000") << date.addSecs(-4);
+        QTest::newRow("offset") << QByteArray("Sat, 03 Mar 2012 05:34:04 +0130") << date;
+        QTest::newRow("negative offset") << QByteArray("Fri, 02 Mar 2012 23:04:04 -0500") << date;
+        QTest::newRow("gmt") << QByteArray("Sat, 03 Mar 2012 04:04:04 GMT") << date;
+        QTest::newRow("est") << QByteArray("Fri, 02 Mar 2012 23:04:04 EST") << date;
+        QTest::newRow("no zone") << QByteArray("Sat, 03 Mar 2012 04:04:04") << date;
+        QTest::newRow("comment") << QByteArray("Sat, 03 Mar 2012 04:04:04 +0000 (UTC)") << date;
+        QTest::newRow("two digit year") << QByteArray("Sat, 03 Mar 12 04:04:04 +0000") << date;
+        QTest::newRow("case") << QByteArray("SAT, 03 MAR 2012 04:04:04 gmt") << date;
+        QTest::newRow("folded") << QByteArray("Sat, 03 Mar 2012\n 04:04:04 +0000") << date;
+        QTest::newRow("invalid day") << QByteArray("Sat, 30 Feb 2012 04:04:04 +0000") << QDateTime();
+        QTest::newRow("invalid time") << QByteArray("Sat, 03 Mar 2012 24:04:04 +0000") << QDateTime();
+        QTest::newRow("garbage") << QByteArray("yesterday") << QDateTime();
+    }
+
+    void testLastModifiedDate()
+    {
+        QFETCH(QByteArray, value);
+        QFETCH(QDateTime, expected);
+        const NoteHeaderSummary summary = scanNoteHeaders("X-Akonotes-LastModified: " + value + "\n\nbody\n");
+        QCOMPARE(summary.lastModifiedDate.isValid(), expected.isValid());
+        if (expected.isValid()) {
+            QCOMPARE(summary.lastModifiedDate, expected);
+        }
+    }
+
+    void testFormatLastModifiedDate()
+    {
+        const QDateTime dates[] = {
+            QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()),
+            QDateTime(QDate(1999, 12, 31), QTime(23, 59, 59), QTimeZone::fromSecondsAheadOfUtc(5 * 3600 + 30 * 60)),
+            QDateTime(QDate(2024, 2, 29), QTime(0, 0), QTimeZone::fromSecondsAheadOfUtc(-8 * 3600)),
+            QDateTime(QDate(2026, 7, 5), QTime(12, 30, 1), QTimeZone::LocalTime),
+        };
+        for (const QDateTime &date : dates) {
+            NoteMessageWrapper note;
+            note.setLastModifiedDate(date);
+            const KMime::MessagePtr msg = note.message();
+            QCOMPARE(msg->headerByType("X-Akonotes-LastModified")->asUnicodeString(),
+                     QLocale::c().toString(date, QStringLiteral("ddd, ")) + date.toString(Qt::RFC2822Date));
+            QCOMPARE(NoteMessageWrapper(msg).lastModifiedDate(), date);
+        }
+    }
+
+    void testEstimatedMemoryUsage()
+    {
+        const QByteArray data(64 * 1024, 'a');
+        Attachment attachment(data, QStringLiteral("application/octet-stream"));
+        QVERIFY(attachment.estimatedMemoryUsage() > data.size());
+        QVERIFY(attachment.estimatedMemoryUsage() < data.size() + 1024);
+
+        NoteMessageWrapper note;
+        note.setText(QString(10000, QLatin1Char('t')));
+        note.custom().insert(QStringLiteral("key"), QString(1000, QLatin1Char('v')));
+        note.attachments() << attachment << Attachment(attachment);
+        NoteMemoryUsage usage = note.estimatedMemoryUsage();
+        QVERIFY(usage.text >= 10000 * qsizetype(sizeof(QChar)));
+        QVERIFY(usage.custom >= 1000 * qsizetype(sizeof(QChar)));
+        // Both attachments share the data
+        QVERIFY(usage.attachments < 2 * data.size());
+        QCOMPARE(usage.message, 0);
+        QCOMPARE(usage.total(), usage.text + usage.custom + usage.attachments + usage.message + usage.other);
+
+        // Nothing is kept by message() if asked so
+        note.setReuseEncodedParts(false);
+        const KMime::MessagePtr msg = note.message();
+        QVERIFY(note.estimatedMemoryUsage().message < 1024);
+
+        // The encoded attachment is kept for the next message() by default, but the data is not counted again
+        note.setReuseEncodedParts(true);
+        (void)note.message();
+        usage = note.estimatedMemoryUsage();
+        QVERIFY(usage.attachments < 2 * data.size());
+        QVERIFY(usage.message > data.size() * 4 / 3);
+        QVERIFY(usage.message < data.size() * 2);
+
+        // A lazily parsed note holds the message
+        const NoteMessageWrapper lazy(msg, NoteMessageWrapper::LazyParsing);
+        const NoteMemoryUsage lazyUsage = lazy.estimatedMemoryUsage();
+        QCOMPARE(lazyUsage.text, 0);
+        QCOMPARE(lazyUsage.attachments, 0);
+        QVERIFY(lazyUsage.message > data.size() * 4 / 3);
+    }
+
+    void testEstimatedMemoryUsageMatchesHeap()
+    {
+#ifndef HAVE_MALLINFO2
+        QSKIP("Needs mallinfo2() from glibc");
+#else
+        auto heapInUse = [] {
+            const struct mallinfo2 info = mallinfo2();
+            return qint64(info.uordblks + info.hblkhd);
+        };
+        auto createMessage = [] {
+            NoteMessageWrapper note;
+            note.setTitle(QStringLiteral("title"));
+            note.setText(QString(200 * 1024, QLatin1Char('t')));
+            for (int i = 0; i < 100; ++i) {
+                note.custom().insert(QStringLiteral("key%1").arg(i), QString(100, QLatin1Char('v')));
+            }
+            QByteArray data(300 * 1024, Qt::Uninitialized);
+            for (int i = 0; i < data.size(); ++i) {
+                data[i] = char(i * 7);
+            }
+            note.attachments() << Attachment(data, QStringLiteral("application/octet-stream"));
+            return note.message()->encodedContent();
+        };
+        auto parse = [](const QByteArray &raw) {
+            auto msg = KMime::MessagePtr(new KMime::Message);
+            msg->setContent(raw);
+            msg->parse();
+            return std::make_unique<NoteMessageWrapper>(msg);
+        };
+        const QByteArray raw = createMessage();
+        parse(raw); // warm up lazily initialized globals
+
+        const qint64 before = heapInUse();
+        const std::unique_ptr<NoteMessageWrapper> note = parse(raw);
+        const qint64 measured = heapInUse() - before;
+        const qint64 estimated = note->estimatedMemoryUsage().total();
+        // Only the order of magnitude is checked, as the allocator rounds up
+        // and reuses free chunks depending on its state and version
+        QVERIFY2(estimated > measured / 2 && estimated < measured * 2,
+                 qPrintable(QStringLiteral("measured %1, estimated %2").arg(measured).arg(estimated)));
+#endif
+    }
+
+    void testFileBackedAttachments()
+    {
+        QTemporaryDir spillDirectory;
+        QVERIFY(spillDirectory.isValid());
+        setAttachmentSpillThreshold(1024);
+        setAttachmentSpillDirectory(spillDirectory.path());
+        const auto resetSpilling = qScopeGuard([] {
+            setAttachmentSpillThreshold(0);
+            setAttachmentSpillDirectory(QString());
+        });
+        QCOMPARE(attachmentSpillDirectory(), spillDirectory.path());
+
+        QByteArray large(100 * 1024, Qt::Uninitialized);
+        for (int i = 0; i < large.size(); ++i) {
+            large[i] = char(i * 13);
+        }
+        NoteMessageWrapper note;
+        note.attachments() << Attachment(large, QStringLiteral("image/png")) << Attachment(QByteArray(100, 'a'), QStringLiteral("text/plain"))
+                           << Attachment(QUrl(QStringLiteral("file://url/to/file")), QStringLiteral("text/plain"));
+        QVERIFY(!note.attachments().at(0).isFileBacked());
+
+        std::unique_ptr<QIODevice> device;
+        {
+            NoteMessageWrapper parsed(note.message());
+            const QList<Attachment> &attachments = std::as_const(parsed).attachments();
+            QVERIFY(attachments.at(0).isFileBacked());
+            QVERIFY(!attachments.at(1).isFileBacked());
+#ifdef Q_OS_UNIX
+            // Only the mapping of the removed file is left
+            QVERIFY(QDir(spillDirectory.path()).entryList(QDir::Files).isEmpty());
+#else
+            QCOMPARE(QDir(spillDirectory.path()).entryList(QDir::Files).size(), 1);
+#endif
+            QCOMPARE(attachments, note.attachments());
+            QCOMPARE(attachments.at(0).data(), large);
+            QVERIFY(parsed.estimatedMemoryUsage().attachments < large.size());
+            QVERIFY(!attachments.at(2).open());
+
+            // Round trips keep the data
+            NoteMessageWrapper again(parsed.message());
+            QCOMPARE(again.attachments(), note.attachments());
+            QBuffer buffer;
+            buffer.open(QIODevice::WriteOnly);
+            QVERIFY(parsed.writeTo(&buffer));
+            auto msg = KMime::MessagePtr(new KMime::Message);
+            msg->setContent(buffer.data());
+            msg->parse();
+            QCOMPARE(NoteMessageWrapper(msg).attachments(), note.attachments());
+
+            device = attachments.at(0).open();
+        }
+        // The device keeps the mapping alive
+        QVERIFY(device->isReadable());
+        QCOMPARE(device->read(10), large.first(10));
+        QCOMPARE(device->readAll(), large.sliced(10));
+        device.reset();
+        QVERIFY(QDir(spillDirectory.path()).entryList(QDir::Files).isEmpty());
+
+        // In memory attachments can be read the same way
+        device = note.attachments().at(1).open();
+        QCOMPARE(device->readAll(), QByteArray(100, 'a'));
+    }
+
+    void testStreamingAttachment()
+    {
+        QByteArray large(50 * 1024 + 7, Qt::Uninitialized);
+        for (int i = 0; i < large.size(); ++i) {
+            large[i] = char(i * 31);
+        }
+        NoteMessageWrapper note;
+        note.attachments() << Attachment(large, QStringLiteral("image/png"));
+        Attachment encoded(large.toBase64(), QStringLiteral("image/png"));
+        encoded.setDataBase64Encoded(true);
+        note.attachments() << encoded;
+
+        NoteMessageWrapper parsed(note.message());
+        const QList<Attachment> &attachments = std::as_const(parsed).attachments();
+
+        // Only the encoded data is held until the data is needed
+        const qsizetype encodedUsage = parsed.estimatedMemoryUsage().attachments;
+        QVERIFY(encodedUsage < 2 * large.size() * 4 / 3 + 4096);
+        std::unique_ptr<QIODevice> device = attachments.at(0).open();
+        QVERIFY(device->isSequential());
+        // The size is known without decoding
+        QCOMPARE(device->size(), large.size());
+        QCOMPARE(parsed.estimatedMemoryUsage().attachments, encodedUsage);
+        QByteArray streamed;
+        while (!device->atEnd()) {
+            const QByteArray chunk = device->read(1000);
+            QVERIFY(!chunk.isEmpty());
+            streamed += chunk;
+        }
+        QCOMPARE(streamed, large);
+        QCOMPARE(parsed.estimatedMemoryUsage().attachments, encodedUsage);
+
+        // Writing the note does not decode it either
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(parsed.writeTo(&buffer));
+        QCOMPARE(parsed.estimatedMemoryUsage().attachments, encodedUsage);
+        auto msg = KMime::MessagePtr(new KMime::Message);
+        msg->setContent(buffer.data());
+        msg->parse();
+        QCOMPARE(NoteMessageWrapper(msg).attachments().at(0).data(), large);
+
+        QCOMPARE(attachments.at(0).data(), large);
+        QCOMPARE(attachments.at(1).data(), large);
+        QCOMPARE(attachments.at(0), note.attachments().at(0));
+        QVERIFY(parsed.estimatedMemoryUsage().attachments >= encodedUsage + 2 * large.size());
+        QCOMPARE(attachments.at(0).open()->readAll(), large);
+
+        // Attachments holding base64 data are decoded while reading too
+        device = note.attachments().at(1).open();
+        QCOMPARE(device->size(), large.size());
+        QCOMPARE(device->read(3), large.first(3));
+        QCOMPARE(device->readAll(), large.sliced(3));
+        QVERIFY(device->atEnd());
+    }
+
+    void testAttachmentDeduplication()
+    {
+        setAttachmentDeduplicationEnabled(true);
+        resetAttachmentDeduplicationStatistics();
+        const auto disableDeduplication = qScopeGuard([] {
+            setAttachmentDeduplicationEnabled(false);
+        });
+        const AttachmentDeduplicationStatistics initial = attachmentDeduplicationStatistics();
+
+        const QByteArray logo(10000, 'l');
+        NoteMessageWrapper note;
+        note.attachments() << Attachment(logo, QStringLiteral("image/png")) << Attachment(QByteArray(10000, 's'), QStringLiteral("image/png"));
+        NoteMessageWrapper other;
+        other.setText(QStringLiteral("other"));
+        other.attachments() << Attachment(logo, QStringLiteral("image/png")) << Attachment(logo, QStringLiteral("image/jpeg"));
+
+        {
+            const NoteMessageWrapper first(note.message());
+            const NoteMessageWrapper second(other.message());
+            const QList<Attachment> &a = std::as_const(first).attachments();
+            const QList<Attachment> &b = std::as_const(second).attachments();
+            // Equal content and mimetype share the buffer across notes
+            QCOMPARE(a.at(0).data().constData(), b.at(0).data().constData());
+            QCOMPARE(a.at(0), b.at(0));
+            QVERIFY(a.at(0) != a.at(1));
+            QVERIFY(b.at(0) != b.at(1));
+            QVERIFY(a.at(0).data().constData() != b.at(1).data().constData());
+            QCOMPARE(b.at(1).data(), logo);
+
+            const AttachmentDeduplicationStatistics statistics = attachmentDeduplicationStatistics();
+            QCOMPARE(statistics.lookups, 4);
+            QCOMPARE(statistics.hits, 1);
+            QCOMPARE(statistics.savedBytes, logo.size());
+            QCOMPARE(statistics.entries, initial.entries + 3);
+            QCOMPARE(statistics.storedBytes, initial.storedBytes + 3 * logo.size());
+
+            // Round trips keep the data
+            QCOMPARE(NoteMessageWrapper(first.message()).attachments(), note.attachments());
+        }
+        // Payloads go away with the last attachment using them
+        QCOMPARE(attachmentDeduplicationStatistics().entries, initial.entries);
+        QCOMPARE(attachmentDeduplicationStatistics().storedBytes, initial.storedBytes);
+
+        setAttachmentDeduplicationEnabled(false);
+        resetAttachmentDeduplicationStatistics();
+        const NoteMessageWrapper unshared(note.message());
+        QCOMPARE(unshared.attachments(), note.attachments());
+        QCOMPARE(attachmentDeduplicationStatistics().lookups, 0);
+    }
+
+    void testCanonicalSerialization()
+    {
+        auto write = [](const NoteMessageWrapper &note, NoteMessageWrapper::SerializationMode mode) {
+            QBuffer buffer;
+            buffer.open(QIODevice::WriteOnly);
+            return note.writeTo(&buffer, mode) ? buffer.data() : QByteArray();
+        };
+        auto parse = [](const QByteArray &raw) {
+            auto msg = KMime::MessagePtr(new KMime::Message);
+            msg->setContent(raw);
+            msg->parse();
+            return msg;
+        };
+
+        NoteMessageWrapper note;
+        note.setTitle(QStringLiteral("title"));
+        note.setText(QStringLiteral("text  \n"));
+        note.setUid(QStringLiteral("uid"));
+        note.setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(3, 3, 3, 500), QTimeZone::fromSecondsAheadOfUtc(3600)));
+        note.setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()));
+        note.custom().insert(QStringLiteral("key"), QStringLiteral("value"));
+        Attachment encoded(QByteArray("ZW5jb2Rl\nZA=="), QStringLiteral("text/plain"));
+        encoded.setDataBase64Encoded(true);
+        note.attachments() << Attachment(QByteArray(1000, 'a'), QStringLiteral("application/octet-stream")) << encoded;
+
+        const QByteArray canonical = write(note, NoteMessageWrapper::CanonicalSerialization);
+        QVERIFY(!canonical.isEmpty());
+        QCOMPARE(write(note, NoteMessageWrapper::CanonicalSerialization), canonical);
+        // The default mode uses a random boundary
+        QVERIFY(write(note, NoteMessageWrapper::DefaultSerialization) != write(note, NoteMessageWrapper::DefaultSerialization));
+        QVERIFY(canonical.contains("+0000"));
+
+        // The same bytes no matter how the note was encoded before
+        const NoteMessageWrapper parsed(parse(canonical));
+        QCOMPARE(write(parsed, NoteMessageWrapper::CanonicalSerialization), canonical);
+        QCOMPARE(parsed.attachments().at(1).data(), QByteArray("encoded"));
+        const NoteMessageWrapper assembled(note.message(), NoteMessageWrapper::LazyParsing);
+        QCOMPARE(write(assembled, NoteMessageWrapper::CanonicalSerialization), canonical);
+
+        // Empty fields are not filled in
+        const NoteMessageWrapper empty;
+        const QByteArray emptyCanonical = write(empty, NoteMessageWrapper::CanonicalSerialization);
+        QCOMPARE(write(empty, NoteMessageWrapper::CanonicalSerialization), emptyCanonical);
+        const NoteMessageWrapper parsedEmpty(parse(emptyCanonical));
+        QVERIFY(parsedEmpty.uid().isEmpty());
+        QVERIFY(parsedEmpty.title().isEmpty());
+        QVERIFY(!parsedEmpty.lastModifiedDate().isValid());
+        QCOMPARE(parsedEmpty.fingerprint(), empty.fingerprint());
+    }
+
+    void testFingerprint()
+    {
+        auto createNote = [] {
+            auto note = std::make_unique<NoteMessageWrapper>();
+            note->setTitle(QStringLiteral("title"));
+            note->setText(QStringLiteral("<html><body>text</body></html>"), Qt::RichText);
+            note->setUid(QStringLiteral("uid"));
+            note->setFrom(QStringLiteral("from@kde.org"));
+            note->setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(3, 3, 3), QTimeZone::utc()));
+            note->setLastModifiedDate(QDateTime(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::utc()));
+            note->custom().insert(QStringLiteral("key"), QStringLiteral("value"));
+            Attachment a(QByteArray("data"), QStringLiteral("text/plain"));
+            a.setLabel(QStringLiteral("label"));
+            note->attachments() << a << Attachment(QUrl(QStringLiteral("file://url/to/file")), QStringLiteral("mimetype/mime"));
+            return note;
+        };
+
+        const auto note = createNote();
+        const QByteArray fingerprint = note->fingerprint();
+        QCOMPARE(fingerprint.size(), 16);
+        QCOMPARE(createNote()->fingerprint(), fingerprint);
+        QCOMPARE(NoteMessageWrapper(note->message()).fingerprint(), fingerprint);
+        QCOMPARE(NoteMessageWrapper(note->message(), NoteMessageWrapper::LazyParsing).fingerprint(), fingerprint);
+
+        // Representations of the same content
+        auto same = createNote();
+        same->setCreationDate(QDateTime(QDate(2012, 3, 3), QTime(5, 3, 3, 999), QTimeZone::fromSecondsAheadOfUtc(7200)));
+        same->setText(QStringLiteral("<html><body>text</body></html> \n"), Qt::RichText);
+        Attachment encoded(QByteArray("ZGF0YQ=="), QStringLiteral("text/plain"));
+        encoded.setDataBase64Encoded(true);
+        encoded.setLabel(QStringLiteral("label"));
+        same->attachments()[0] = encoded;
+        QCOMPARE(same->fingerprint(), fingerprint);
+
+        const std::vector<std::function<void(NoteMessageWrapper &)>> changes = {
+            [](NoteMessageWrapper &n) {
+                n.setTitle(QStringLiteral("titl"));
+                n.setText(QStringLiteral("e<html><body>text</body></html>"), Qt::RichText);
+            },
+            [](NoteMessageWrapper &n) {
+                n.setText(n.text(), Qt::PlainText);
+            },
+            [](NoteMessageWrapper &n) {
+                n.setUid(QStringLiteral("uid2"));
+            },
+            [](NoteMessageWrapper &n) {
+                n.setFrom(QString());
+            },
+            [](NoteMessageWrapper &n) {
+                n.setClassification(NoteMessageWrapper::Private);
+            },
+            [](NoteMessageWrapper &n) {
+                n.setLastModifiedDate(n.lastModifiedDate().addSecs(1));
+            },
+            [](NoteMessageWrapper &n) {
+                n.setCreationDate(QDateTime());
+            },
+            [](NoteMessageWrapper &n) {
+                n.custom().insert(QStringLiteral("key"), QStringLiteral("other"));
+            },
+            [](NoteMessageWrapper &n) {
+                n.attachments()[0].setLabel(QString());
+            },
+            [](NoteMessageWrapper &n) {
+                n.attachments()[0] = Attachment(QByteArray("dat"), QStringLiteral("text/plain"));
+            },
+            [](NoteMessageWrapper &n) {
+                n.attachments().swapItemsAt(0, 1);
+            },
+        };
+        QSet<QByteArray> fingerprints = {fingerprint};
+        for (const auto &change : changes) {
+            auto changed = createNote();
+            change(*changed);
+            fingerprints.insert(changed->fingerprint());
+        }
+        QCOMPARE(fingerprints.size(), qsizetype(changes.size() + 1));
+    }
+
     void createIfEmpty()
     {
         NoteMessageWrapper note;
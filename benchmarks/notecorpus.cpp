@@ -0,0 +1,164 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notecorpus.h"
+
+#include "noteutils.h"
+
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <QTest>
+#include <QTimeZone>
+
+#include <iterator>
+
+using namespace Akonadi::NoteUtils;
+
+namespace NoteCorpus
+{
+static QString words(QRandomGenerator &rng, int count)
+{
+    static const char *const dictionary[] = {"note", "meeting", "akonadi", "résumé", "list", "buy", "milk", "call", "project", "über",
+                                             "draft", "idea",  "review",  "release", "todo", "fix", "bug",  "kde",  "plasma",  "naïve"};
+    QString result;
+    for (int i = 0; i < count; ++i) {
+        if (i) {
+            result += QLatin1Char(' ');
+        }
+        result += QString::fromUtf8(dictionary[rng.bounded(int(std::size(dictionary)))]);
+    }
+    return result;
+}
+
+static QString richText(QRandomGenerator &rng, int paragraphs)
+{
+    QString html = QStringLiteral(
+        "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0//EN\" \"http://www.w3.org/TR/REC-html40/strict.dtd\">\n"
+        "<html><head><meta name=\"qrichtext\" content=\"1\" /><style type=\"text/css\">\n"
+        "p, li { white-space: pre-wrap; }\n</style></head>"
+        "<body style=\" font-family:'Noto Sans'; font-size:10pt; font-weight:400; font-style:normal;\">\n");
+    for (int i = 0; i < paragraphs; ++i) {
+        // Drawn one after the other, the order of function arguments is unspecified
+        const int color = rng.bounded(0xffffff);
+        const QString title = words(rng, 3);
+        const QString text = words(rng, 25);
+        const QString tag = words(rng, 1);
+        html += QStringLiteral(
+                    "<p style=\" margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px;\">"
+                    "<span style=\" font-weight:600; color:#%1;\">%2</span> %3 &amp; &lt;%4&gt;</p>\n")
+                    .arg(color, 6, 16, QLatin1Char('0'))
+                    .arg(title, text, tag);
+    }
+    html += QStringLiteral("</body></html>");
+    return html;
+}
+
+static QByteArray payload(QRandomGenerator &rng, qsizetype size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    const qsizetype whole = size / qsizetype(sizeof(quint32));
+    rng.fillRange(reinterpret_cast<quint32 *>(data.data()), whole);
+    for (qsizetype i = whole * qsizetype(sizeof(quint32)); i < size; ++i) {
+        data[i] = char(rng.generate());
+    }
+    return data;
+}
+
+int defaultCount(Kind kind)
+{
+    switch (kind) {
+    case PlainNotes:
+        return 2000;
+    case RichTextNotes:
+        return 200;
+    case ManyCustomKeys:
+        return 200;
+    case ManyAttachments:
+        return 100;
+    case LargeAttachments:
+        return 10;
+    }
+    return 0;
+}
+
+Corpus generate(Kind kind, int count, quint32 seed)
+{
+    QRandomGenerator rng(seed + uint(kind));
+    const QDateTime base(QDate(2024, 1, 1), QTime(8, 0), QTimeZone::utc());
+
+    Corpus corpus;
+    corpus.messages.reserve(count);
+    corpus.raw.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        NoteMessageWrapper note;
+        note.setUid(QStringLiteral("%1-note-%2").arg(uint(kind)).arg(i, 6, 10, QLatin1Char('0')));
+        note.setTitle(words(rng, 4));
+        note.setFrom(QStringLiteral("benchmark@kde.org"));
+        note.setCreationDate(base.addSecs(i * 60));
+        note.setLastModifiedDate(base.addSecs(i * 60 + rng.bounded(86400)));
+        note.setClassification(NoteMessageWrapper::Classification(i % 3));
+
+        switch (kind) {
+        case PlainNotes:
+            note.setText(words(rng, 20 + rng.bounded(80)));
+            break;
+        case RichTextNotes:
+            note.setText(richText(rng, 150 + rng.bounded(100)), Qt::RichText);
+            break;
+        case ManyCustomKeys:
+            note.setText(words(rng, 30));
+            for (int k = 0; k < 300; ++k) {
+                note.custom().insert(QStringLiteral("key%1").arg(k, 4, 10, QLatin1Char('0')), words(rng, 3));
+            }
+            break;
+        case ManyAttachments:
+            note.setText(words(rng, 30));
+            for (int a = 0; a < 30; ++a) {
+                Attachment attachment(payload(rng, 2048 + rng.bounded(4096)), QStringLiteral("image/png"));
+                attachment.setLabel(QStringLiteral("image%1.png").arg(a));
+                attachment.setContentID(QStringLiteral("image%1@kde.org").arg(a));
+                note.attachments().append(attachment);
+            }
+            break;
+        case LargeAttachments:
+            note.setText(words(rng, 30));
+            for (int a = 0; a < 2; ++a) {
+                Attachment attachment(payload(rng, 2 * 1024 * 1024 + rng.bounded(1024 * 1024)), QStringLiteral("application/pdf"));
+                attachment.setLabel(QStringLiteral("scan%1.pdf").arg(a));
+                note.attachments().append(attachment);
+            }
+            note.attachments().append(Attachment(QUrl(QStringLiteral("https://kde.org/notes/%1").arg(i)), QStringLiteral("text/html")));
+            break;
+        }
+
+        const KMime::MessagePtr msg = note.message();
+        if (msg->contentType()->isMultipart()) {
+            // message() picks a random boundary, a fixed one keeps the bytes the same on every run
+            msg->contentType()->setBoundary("nextPartNoteCorpus");
+            msg->assemble();
+        }
+        const QByteArray raw = msg->encodedContent();
+        corpus.bytes += raw.size();
+        corpus.raw.append(raw);
+        // Parse the bytes again, that is what a reader gets from Akonadi
+        auto parsed = KMime::MessagePtr(new KMime::Message);
+        parsed->setContent(raw);
+        parsed->parse();
+        corpus.messages.append(parsed);
+    }
+    return corpus;
+}
+
+void addKindRows()
+{
+    QTest::addColumn<int>("kind");
+    QTest::newRow("plain") << int(PlainNotes);
+    QTest::newRow("richtext") << int(RichTextNotes);
+    QTest::newRow("manycustomkeys") << int(ManyCustomKeys);
+    QTest::newRow("manyattachments") << int(ManyAttachments);
+    QTest::newRow("largeattachments") << int(LargeAttachments);
+}
+}
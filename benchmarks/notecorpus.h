@@ -0,0 +1,48 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <KMime/Message>
+
+#include <QByteArray>
+#include <QList>
+
+/**
+ * Deterministic note corpora for the benchmarks
+ *
+ * The same kind, count and seed always produce byte-identical messages,
+ * so numbers from different runs and revisions can be compared.
+ */
+namespace NoteCorpus
+{
+enum Kind {
+    PlainNotes, ///< short plain text notes without parts
+    RichTextNotes, ///< large Qt rich-text notes with inline styles
+    ManyCustomKeys, ///< notes with hundreds of custom values
+    ManyAttachments, ///< notes with dozens of small inline attachments
+    LargeAttachments ///< notes with a few multi-megabyte inline attachments
+};
+
+struct Corpus {
+    QList<KMime::MessagePtr> messages;
+    QList<QByteArray> raw; ///< encodedContent() of each message
+    qint64 bytes = 0; ///< total size of raw
+};
+
+/**
+ * Returns the default number of notes for @p kind, chosen so that one pass
+ * over the corpus takes roughly the same time for every kind
+ */
+int defaultCount(Kind kind);
+
+Corpus generate(Kind kind, int count, quint32 seed = 42);
+
+/**
+ * Adds one data row per corpus kind, with a "kind" column of type int
+ */
+void addKindRows();
+}
@@ -0,0 +1,531 @@
+/*
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "base64_p.h"
+#include "customxml_p.h"
+#include "htmltoplaintext_p.h"
+#include "notecorpus.h"
+#include "notesnapshot.h"
+#include "noteutils.h"
+#include "rfc2822date_p.h"
+
+#include <QBuffer>
+#include <QDomDocument>
+#include <QElapsedTimer>
+#include <QLocale>
+#include <QRegularExpression>
+#include <QTest>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimeZone>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace Akonadi::NoteUtils;
+
+// The regular expression based toPlainText() used up to 6.2, for comparison
+static QString legacyToPlainText(const QString &text)
+{
+    const QRegularExpression rx(QStringLiteral("<body[^>]*>(.*)</body>"), QRegularExpression::CaseInsensitiveOption);
+    QString body = rx.match(text).captured(1);
+    return body.remove(QRegularExpression(QStringLiteral("<[^>]*>"))).trimmed().toHtmlEscaped();
+}
+
+// The QDom based custom-values codec used up to 6.2, for comparison
+namespace LegacyCustomXml
+{
+static QByteArray write(const QMap<QString, QString> &custom)
+{
+    QDomDocument document;
+    document.appendChild(document.createProcessingInstruction(QStringLiteral("xml"), QStringLiteral("version=\"1.0\" encoding=\"UTF-8\"")));
+    QDomElement element = document.createElement(QStringLiteral("custom"));
+    element.setAttribute(QStringLiteral("version"), QStringLiteral("1.0"));
+    for (auto it = custom.cbegin(), end = custom.cend(); it != end; ++it) {
+        QDomElement e = element.ownerDocument().createElement(it.key());
+        e.appendChild(element.ownerDocument().createTextNode(it.value()));
+        element.appendChild(e);
+        document.appendChild(element);
+    }
+    return document.toString().toLatin1();
+}
+
+static void read(const QByteArray &xml, QMap<QString, QString> &custom)
+{
+    QDomDocument document;
+    if (!document.setContent(xml)) {
+        return;
+    }
+    const QDomElement top = document.documentElement();
+    for (QDomNode n = top.firstChild(); !n.isNull(); n = n.nextSibling()) {
+        if (n.isElement()) {
+            const QDomElement e = n.toElement();
+            custom.insert(e.tagName(), e.text());
+        }
+    }
+}
+}
+
+class NotesBenchmark : public QObject
+{
+    Q_OBJECT
+private:
+    // Runs @p pass once more outside of QBENCHMARK and prints notes/s and MB/s for it
+    template<typename Pass>
+    static void reportThroughput(qsizetype notes, qint64 bytes, Pass pass)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        pass();
+        const double seconds = std::max<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+        qInfo("%s: %.0f notes/s, %.1f MB/s", QTest::currentDataTag(), notes / seconds, bytes / seconds / (1024 * 1024));
+    }
+
+    static NoteCorpus::Corpus corpus()
+    {
+        QFETCH(int, kind);
+        const auto k = NoteCorpus::Kind(kind);
+        return NoteCorpus::generate(k, NoteCorpus::defaultCount(k));
+    }
+
+    static std::vector<std::unique_ptr<NoteMessageWrapper>> wrappers(const NoteCorpus::Corpus &corpus)
+    {
+        std::vector<std::unique_ptr<NoteMessageWrapper>> notes;
+        notes.reserve(corpus.messages.size());
+        for (const KMime::MessagePtr &msg : corpus.messages) {
+            notes.push_back(std::make_unique<NoteMessageWrapper>(msg));
+        }
+        return notes;
+    }
+
+private Q_SLOTS:
+    void parseMessage_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    // NoteMessageWrapper(const KMime::MessagePtr &) on already parsed messages
+    void parseMessage()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        auto pass = [&c] {
+            for (const KMime::MessagePtr &msg : c.messages) {
+                NoteMessageWrapper note(msg);
+                Q_UNUSED(note);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(c.messages.size(), c.bytes, pass);
+    }
+
+    void parseRaw_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    // KMime parse of the raw bytes followed by NoteMessageWrapper construction
+    void parseRaw()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        auto pass = [&c] {
+            for (const QByteArray &raw : c.raw) {
+                auto msg = KMime::MessagePtr(new KMime::Message);
+                msg->setContent(raw);
+                msg->parse();
+                NoteMessageWrapper note(msg);
+                Q_UNUSED(note);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(c.raw.size(), c.bytes, pass);
+    }
+
+    void serialize_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    // NoteMessageWrapper::message() and encodedContent()
+    void serialize()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        const auto notes = wrappers(c);
+        auto pass = [&notes] {
+            for (const auto &note : notes) {
+                const QByteArray raw = note->message()->encodedContent();
+                Q_UNUSED(raw);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(c.raw.size(), c.bytes, pass);
+    }
+
+    void roundTrip_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    // raw bytes -> NoteMessageWrapper -> raw bytes
+    void roundTrip()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        auto pass = [&c] {
+            for (const QByteArray &raw : c.raw) {
+                auto msg = KMime::MessagePtr(new KMime::Message);
+                msg->setContent(raw);
+                msg->parse();
+                const NoteMessageWrapper note(msg);
+                const QByteArray result = note.message()->encodedContent();
+                Q_UNUSED(result);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(c.raw.size(), c.bytes, pass);
+    }
+
+    void customValues_data()
+    {
+        QTest::addColumn<bool>("legacy");
+        QTest::addColumn<int>("keys");
+        for (int keys : {10, 300, 1000}) {
+            QTest::addRow("qdom-%d", keys) << true << keys;
+            QTest::addRow("stream-%d", keys) << false << keys;
+        }
+    }
+
+    // Writing and reading the body of the custom-values part
+    void customValues()
+    {
+        QFETCH(bool, legacy);
+        QFETCH(int, keys);
+
+        QMap<QString, QString> custom;
+        for (int k = 0; k < keys; ++k) {
+            custom.insert(QStringLiteral("key%1").arg(k, 4, 10, QLatin1Char('0')), QStringLiteral("value of key %1 & more").arg(k));
+        }
+        const QByteArray xml = CustomXml::write(custom);
+        constexpr int notes = 100;
+        auto pass = [&] {
+            for (int i = 0; i < notes; ++i) {
+                QMap<QString, QString> values;
+                if (legacy) {
+                    LegacyCustomXml::read(LegacyCustomXml::write(custom), values);
+                } else {
+                    (void)CustomXml::read(CustomXml::write(custom), values);
+                }
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(notes, qint64(notes) * xml.size(), pass);
+    }
+
+    void toPlainText_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    void toPlainText()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        const auto notes = wrappers(c);
+        qint64 textBytes = 0;
+        for (const auto &note : notes) {
+            textBytes += note->text().size() * qint64(sizeof(QChar));
+        }
+        auto pass = [&notes] {
+            for (const auto &note : notes) {
+                const QString text = note->toPlainText();
+                Q_UNUSED(text);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(notes.size(), textBytes, pass);
+    }
+
+    void parseNotes_data()
+    {
+        QTest::addColumn<int>("threads");
+        for (int threads = 1; threads < QThread::idealThreadCount(); threads *= 2) {
+            QTest::addRow("%d-threads", threads) << threads;
+        }
+        QTest::addRow("%d-threads", QThread::idealThreadCount()) << QThread::idealThreadCount();
+    }
+
+    // Batch parsing of raw messages, to show how it scales with the number of cores
+    void parseNotes()
+    {
+        QFETCH(int, threads);
+        NoteCorpus::Corpus c = NoteCorpus::generate(NoteCorpus::PlainNotes, NoteCorpus::defaultCount(NoteCorpus::PlainNotes));
+        const NoteCorpus::Corpus rich = NoteCorpus::generate(NoteCorpus::RichTextNotes, NoteCorpus::defaultCount(NoteCorpus::RichTextNotes));
+        c.raw += rich.raw;
+        c.bytes += rich.bytes;
+
+        QThreadPool pool;
+        pool.setMaxThreadCount(threads);
+        auto pass = [&] {
+            const QList<NoteParseResult> results = Akonadi::NoteUtils::parseNotes(c.raw, &pool);
+            Q_UNUSED(results);
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(c.raw.size(), c.bytes, pass);
+    }
+
+    void htmlToPlainText_data()
+    {
+        QTest::addColumn<bool>("legacy");
+        QTest::newRow("regex") << true;
+        QTest::newRow("streaming") << false;
+    }
+
+    // The text conversion alone, on the rich-text corpus
+    void htmlToPlainText()
+    {
+        QFETCH(bool, legacy);
+        const NoteCorpus::Corpus c = NoteCorpus::generate(NoteCorpus::RichTextNotes, NoteCorpus::defaultCount(NoteCorpus::RichTextNotes));
+        QStringList texts;
+        qint64 textBytes = 0;
+        for (const KMime::MessagePtr &msg : c.messages) {
+            texts.append(NoteMessageWrapper(msg).text());
+            textBytes += texts.last().size() * qint64(sizeof(QChar));
+        }
+        auto pass = [&] {
+            for (const QString &text : std::as_const(texts)) {
+                const QString plainText = legacy ? legacyToPlainText(text) : Akonadi::NoteUtils::htmlToPlainText(text);
+                Q_UNUSED(plainText);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(texts.size(), textBytes, pass);
+    }
+
+    void lastModifiedDate_data()
+    {
+        QTest::addColumn<bool>("legacy");
+        QTest::newRow("qdatetime") << true;
+        QTest::newRow("codec") << false;
+    }
+
+    // Formatting and parsing the X-Akonotes-LastModified value of many notes
+    void lastModifiedDate()
+    {
+        QFETCH(bool, legacy);
+        QList<QDateTime> dates;
+        QDateTime date(QDate(2012, 3, 3), QTime(4, 4, 4), QTimeZone::fromSecondsAheadOfUtc(3600));
+        for (int i = 0; i < 10000; ++i) {
+            dates.append(date);
+            date = date.addSecs(86400 + 3607);
+        }
+        qint64 headerBytes = 0;
+        auto pass = [&] {
+            headerBytes = 0;
+            for (const QDateTime &dateTime : std::as_const(dates)) {
+                QDateTime parsed;
+                if (legacy) {
+                    const QString header = QLocale::c().toString(dateTime, QStringLiteral("ddd, ")) + dateTime.toString(Qt::RFC2822Date);
+                    parsed = QDateTime::fromString(header, Qt::RFC2822Date);
+                    headerBytes += header.size();
+                } else {
+                    char buffer[Rfc2822Date::MaxFormattedLength];
+                    const qsizetype length = Rfc2822Date::format(dateTime, buffer);
+                    parsed = Rfc2822Date::parse(QByteArrayView(buffer, length));
+                    headerBytes += length;
+                }
+                Q_ASSERT(parsed == dateTime);
+                Q_UNUSED(parsed);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(dates.size(), headerBytes, pass);
+    }
+
+    void base64_data()
+    {
+        QTest::addColumn<int>("simd");
+        QTest::addColumn<bool>("decode");
+        for (bool decode : {false, true}) {
+            const char *direction = decode ? "decode" : "encode";
+            QTest::addRow("%s qt", direction) << -1 << decode;
+            QTest::addRow("%s scalar", direction) << int(Base64::Simd::None) << decode;
+            QTest::addRow("%s ssse3", direction) << int(Base64::Simd::Ssse3) << decode;
+            QTest::addRow("%s avx2", direction) << int(Base64::Simd::Avx2) << decode;
+        }
+    }
+
+    // Encoding and decoding attachment bodies of 16 MB in total, "qt" uses
+    // QByteArray::toBase64() plus line breaks and QByteArray::fromBase64()
+    void base64()
+    {
+        QFETCH(int, simd);
+        QFETCH(bool, decode);
+        QList<QByteArray> attachments;
+        for (int i = 0; i < 64; ++i) {
+            QByteArray data(256 * 1024, Qt::Uninitialized);
+            for (qsizetype j = 0; j < data.size(); ++j) {
+                data[j] = char(j * 7 + i);
+            }
+            attachments.append(data);
+        }
+        QList<QByteArray> encoded;
+        for (const QByteArray &data : std::as_const(attachments)) {
+            encoded.append(Base64::encode(data));
+        }
+        if (simd > int(Base64::bestSimd())) {
+            QSKIP("Not supported by this CPU");
+        }
+        auto pass = [&] {
+            for (qsizetype i = 0; i < attachments.size(); ++i) {
+                QByteArray result;
+                if (decode) {
+                    result = simd < 0 ? QByteArray::fromBase64(encoded.at(i)) : Base64::decode(encoded.at(i), Base64::Simd(simd));
+                } else if (simd < 0) {
+                    const QByteArray flat = attachments.at(i).toBase64();
+                    for (qsizetype line = 0; line < flat.size(); line += 76) {
+                        result += QByteArrayView(flat).sliced(line, std::min<qsizetype>(76, flat.size() - line));
+                        result += '\n';
+                    }
+                } else {
+                    result = Base64::encode(attachments.at(i), Base64::Simd(simd));
+                }
+                Q_ASSERT(result == (decode ? attachments.at(i) : encoded.at(i)));
+                Q_UNUSED(result);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(attachments.size(), 64 * 256 * 1024, pass);
+    }
+
+    void preview_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    // preview() on lazily parsed notes, as used by list views
+    void preview()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        auto pass = [&c] {
+            for (const KMime::MessagePtr &msg : c.messages) {
+                const NoteMessageWrapper note(msg, NoteMessageWrapper::LazyParsing);
+                const QString preview = note.preview(200);
+                Q_UNUSED(preview);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(c.messages.size(), c.bytes, pass);
+    }
+
+    void attachmentAccess_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    // Reading every attachment payload of freshly parsed notes
+    void attachmentAccess()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        qint64 payloadBytes = 0;
+        auto pass = [&c, &payloadBytes] {
+            payloadBytes = 0;
+            for (const KMime::MessagePtr &msg : c.messages) {
+                NoteMessageWrapper note(msg, NoteMessageWrapper::LazyParsing);
+                for (const Attachment &attachment : note.attachments()) {
+                    payloadBytes += attachment.data().size();
+                }
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(c.messages.size(), payloadBytes, pass);
+    }
+
+    void fingerprint_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    // Hashing parsed notes, what a sync compares instead of serializing them
+    void fingerprint()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        const auto notes = wrappers(c);
+        auto pass = [&notes] {
+            for (const auto &note : notes) {
+                const QByteArray fingerprint = note->fingerprint();
+                Q_UNUSED(fingerprint);
+            }
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(notes.size(), c.bytes, pass);
+    }
+
+    void loadSnapshot_data()
+    {
+        NoteCorpus::addKindRows();
+    }
+
+    // Loading a snapshot of the notes and reading the fields shown in a list, compare with parseRaw
+    void loadSnapshot()
+    {
+        const NoteCorpus::Corpus c = corpus();
+        const auto notes = wrappers(c);
+        QList<const NoteMessageWrapper *> pointers;
+        for (const auto &note : notes) {
+            pointers.append(note.get());
+        }
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(NoteSnapshot::write(&buffer, pointers));
+        const QByteArray data = buffer.data();
+
+        auto pass = [&data] {
+            NoteSnapshot snapshot;
+            if (!snapshot.load(data)) {
+                return;
+            }
+            qsizetype titleChars = 0;
+            for (qsizetype i = 0; i < snapshot.count(); ++i) {
+                titleChars += snapshot.title(i).size();
+                const QDateTime date = snapshot.lastModifiedDate(i);
+                Q_UNUSED(date);
+            }
+            Q_UNUSED(titleChars);
+        };
+        QBENCHMARK {
+            pass();
+        }
+        reportThroughput(c.messages.size(), data.size(), pass);
+    }
+};
+
+QTEST_GUILESS_MAIN(NotesBenchmark)
+
+#include "notesbenchmark.moc"
@@ -0,0 +1,108 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "attachmentstore_p.h"
+#include "noteutils.h"
+
+#include <QCryptographicHash>
+#include <QHash>
+#include <QMutex>
+#include <QWeakPointer>
+
+#include <atomic>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+namespace
+{
+struct Store {
+    QMutex mutex;
+    // Keyed by the digest followed by the mimetype
+    QHash<QByteArray, QWeakPointer<const StoredPayload>> payloads;
+    AttachmentDeduplicationStatistics statistics;
+};
+
+QByteArray storeKey(const QByteArray &digest, const QString &mimetype)
+{
+    return digest + mimetype.toUtf8();
+}
+}
+Q_GLOBAL_STATIC(Store, s_store)
+
+static std::atomic<bool> s_deduplicationEnabled = false;
+
+StoredPayload::StoredPayload(const QByteArray &data, const QByteArray &digest, const QString &mimetype)
+    : data(data)
+    , digest(digest)
+    , mimetype(mimetype)
+{
+}
+
+StoredPayload::~StoredPayload()
+{
+    if (s_store.isDestroyed()) {
+        return;
+    }
+    const QMutexLocker locker(&s_store->mutex);
+    // The entry may already belong to a payload created while this one was being destroyed
+    const auto it = s_store->payloads.constFind(storeKey(digest, mimetype));
+    if (it != s_store->payloads.cend() && it->isNull()) {
+        s_store->payloads.erase(it);
+    }
+    --s_store->statistics.entries;
+    s_store->statistics.storedBytes -= data.size();
+}
+
+QSharedPointer<const StoredPayload> AttachmentStore::intern(const QByteArray &data, const QString &mimetype)
+{
+    const QByteArray digest = QCryptographicHash::hash(data, QCryptographicHash::Blake2b_256);
+    const QByteArray key = storeKey(digest, mimetype);
+
+    const QMutexLocker locker(&s_store->mutex);
+    AttachmentDeduplicationStatistics &statistics = s_store->statistics;
+    ++statistics.lookups;
+    QWeakPointer<const StoredPayload> &entry = s_store->payloads[key];
+    QSharedPointer<const StoredPayload> payload = entry.toStrongRef();
+    if (payload) {
+        ++statistics.hits;
+        statistics.savedBytes += data.size();
+        return payload;
+    }
+    payload = QSharedPointer<const StoredPayload>(new StoredPayload(data, digest, mimetype));
+    entry = payload;
+    ++statistics.entries;
+    statistics.storedBytes += data.size();
+    return payload;
+}
+
+void setAttachmentDeduplicationEnabled(bool enabled)
+{
+    s_deduplicationEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool attachmentDeduplicationEnabled()
+{
+    return s_deduplicationEnabled.load(std::memory_order_relaxed);
+}
+
+AttachmentDeduplicationStatistics attachmentDeduplicationStatistics()
+{
+    const QMutexLocker locker(&s_store->mutex);
+    return s_store->statistics;
+}
+
+void resetAttachmentDeduplicationStatistics()
+{
+    const QMutexLocker locker(&s_store->mutex);
+    AttachmentDeduplicationStatistics &statistics = s_store->statistics;
+    statistics.lookups = 0;
+    statistics.hits = 0;
+    statistics.savedBytes = 0;
+}
+}
+}
@@ -0,0 +1,45 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+/**
+ * Decoded attachment data shared by all parsed attachments with the same
+ * content and mimetype
+ *
+ * The store only references a payload weakly, it is removed from the store
+ * when the last attachment using it goes away.
+ */
+class StoredPayload
+{
+public:
+    StoredPayload(const QByteArray &data, const QByteArray &digest, const QString &mimetype);
+    ~StoredPayload();
+
+    const QByteArray data;
+    // BLAKE2b-256 of data
+    const QByteArray digest;
+    const QString mimetype;
+};
+
+namespace AttachmentStore
+{
+/**
+ * Returns the payload for @p data, the same one for all calls with equal data
+ * and mimetype as long as any of them is alive
+ */
+[[nodiscard]] QSharedPointer<const StoredPayload> intern(const QByteArray &data, const QString &mimetype);
+}
+}
+}
@@ -0,0 +1,279 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "base64_p.h"
+
+#include <QtGlobal>
+
+#include <algorithm>
+#include <array>
+
+#if defined(Q_PROCESSOR_X86) && defined(Q_CC_GNU)
+#define BASE64_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+namespace Base64
+{
+namespace
+{
+constexpr char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The value of each character, -1 for characters outside the alphabet
+constexpr std::array<qint8, 256> DecodeTable = [] {
+    std::array<qint8, 256> table{};
+    table.fill(-1);
+    for (int i = 0; i < 64; ++i) {
+        table[uchar(Alphabet[i])] = qint8(i);
+    }
+    return table;
+}();
+
+constexpr qsizetype LineLength = 76;
+constexpr qsizetype LineInput = LineLength / 4 * 3;
+
+// The SIMD decoders store a few bytes past the data they produce
+constexpr qsizetype StoreSlack = 8;
+
+inline void encodeGroup(const uchar *in, char *out)
+{
+    const quint32 group = quint32(in[0]) << 16 | quint32(in[1]) << 8 | in[2];
+    out[0] = Alphabet[group >> 18];
+    out[1] = Alphabet[(group >> 12) & 0x3f];
+    out[2] = Alphabet[(group >> 6) & 0x3f];
+    out[3] = Alphabet[group & 0x3f];
+}
+
+#ifdef BASE64_X86_SIMD
+// The SIMD code follows Wojciech Muła's and Alfred Klomp's base64 algorithms
+
+// Encodes groups of 12 bytes while at least 16 are readable and at most size are consumed,
+// returns the number of bytes consumed
+__attribute__((target("ssse3"))) qsizetype encodeSsse3(const uchar *in, qsizetype size, qsizetype readable, char *out)
+{
+    const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m128i offsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    qsizetype pos = 0;
+    while (size - pos >= 12 && readable - pos >= 16) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + pos)), spread);
+        // Moves the four 6 bit values of each group to their own byte
+        const __m128i ac = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        const __m128i bd = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        v = _mm_or_si128(ac, bd);
+        // 0-25 map to index 0, 26-51 to 1, 52-61 to 2-11, 62 to 12 and 63 to 13
+        __m128i index = _mm_subs_epu8(v, _mm_set1_epi8(51));
+        index = _mm_sub_epi8(index, _mm_cmpgt_epi8(v, _mm_set1_epi8(25)));
+        v = _mm_add_epi8(v, _mm_shuffle_epi8(offsets, index));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), v);
+        pos += 12;
+        out += 16;
+    }
+    return pos;
+}
+
+// Decodes blocks of 16 characters up to the first block with a character outside the
+// alphabet, returns the number of characters consumed
+__attribute__((target("ssse3"))) qsizetype decodeSsse3(const uchar *in, qsizetype size, char *out)
+{
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    qsizetype pos = 0;
+    while (size - pos >= 16) {
+        const __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + pos));
+        const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), nibble);
+        const __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+        const __m128i lo = _mm_shuffle_epi8(lutLo, _mm_and_si128(str, nibble));
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128()))) {
+            break;
+        }
+        const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(_mm_cmpeq_epi8(str, _mm_set1_epi8('/')), hiNibbles));
+        __m128i values = _mm_add_epi8(str, roll);
+        values = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        values = _mm_madd_epi16(values, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(values, pack));
+        pos += 16;
+        out += 12;
+    }
+    return pos;
+}
+
+// Same as decodeSsse3() with blocks of 32 characters
+__attribute__((target("avx2"))) qsizetype decodeAvx2(const uchar *in, qsizetype size, char *out)
+{
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a, //
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, //
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, //
+                                             0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, //
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    qsizetype pos = 0;
+    while (size - pos >= 32) {
+        const __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + pos));
+        const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), nibble);
+        const __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        const __m256i lo = _mm256_shuffle_epi8(lutLo, _mm256_and_si256(str, nibble));
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        const __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, _mm256_set1_epi8('/')), hiNibbles));
+        __m256i values = _mm256_add_epi8(str, roll);
+        values = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        values = _mm256_madd_epi16(values, _mm256_set1_epi32(0x00011000));
+        values = _mm256_shuffle_epi8(values, pack);
+        // Joins the 12 bytes of both lanes
+        values = _mm256_permutevar8x32_epi32(values, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), values);
+        pos += 32;
+        out += 24;
+    }
+    return pos;
+}
+#endif
+}
+
+Simd bestSimd()
+{
+#ifdef BASE64_X86_SIMD
+    static const Simd best = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return Simd::Avx2;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return Simd::Ssse3;
+        }
+        return Simd::None;
+    }();
+    return best;
+#else
+    return Simd::None;
+#endif
+}
+
+QByteArray encode(QByteArrayView data, Simd simd)
+{
+    simd = std::min(simd, bestSimd());
+    const auto in = reinterpret_cast<const uchar *>(data.data());
+    const qsizetype size = data.size();
+    const qsizetype lines = (size + LineInput - 1) / LineInput;
+    const qsizetype encodedSize = (size + 2) / 3 * 4 + lines;
+    QByteArray result(encodedSize, Qt::Uninitialized);
+    char *out = result.data();
+    for (qsizetype line = 0; line < size; line += LineInput) {
+        const qsizetype length = std::min(LineInput, size - line);
+        qsizetype pos = 0;
+#ifdef BASE64_X86_SIMD
+        if (simd != Simd::None) {
+            // The loads may read into the next line, but not past the data
+            pos = encodeSsse3(in + line, length, size - line, out);
+            out += pos / 3 * 4;
+        }
+#endif
+        for (; length - pos >= 3; pos += 3) {
+            encodeGroup(in + line + pos, out);
+            out += 4;
+        }
+        if (pos < length) {
+            const uchar last[3] = {in[line + pos], length - pos > 1 ? in[line + pos + 1] : uchar(0), 0};
+            encodeGroup(last, out);
+            out[3] = '=';
+            if (length - pos == 1) {
+                out[2] = '=';
+            }
+            out += 4;
+        }
+        *out++ = '\n';
+    }
+    Q_ASSERT(out - result.constData() == encodedSize);
+    return result;
+}
+
+Decoder::Decoder(Simd simd)
+    : mSimd(std::min(simd, bestSimd()))
+{
+}
+
+qsizetype Decoder::maxDecodedSize(qsizetype encodedSize)
+{
+    return (encodedSize + 3) / 4 * 3 + 3 + StoreSlack;
+}
+
+qsizetype Decoder::decode(QByteArrayView encoded, char *out)
+{
+    const auto in = reinterpret_cast<const uchar *>(encoded.data());
+    const qsizetype size = encoded.size();
+    char *const begin = out;
+    qsizetype pos = 0;
+    while (pos < size) {
+        // Runs of the alphabet can be decoded in blocks at the start of a group of four,
+        // anything else like the line breaks goes through the bit buffer one by one
+        if (mBitCount == 0) {
+#ifdef BASE64_X86_SIMD
+            qsizetype consumed = 0;
+            if (mSimd == Simd::Avx2) {
+                consumed = decodeAvx2(in + pos, size - pos, out);
+                pos += consumed;
+                out += consumed / 4 * 3;
+            }
+            if (mSimd != Simd::None) {
+                consumed = decodeSsse3(in + pos, size - pos, out);
+                pos += consumed;
+                out += consumed / 4 * 3;
+            }
+#endif
+            for (; size - pos >= 4; pos += 4) {
+                const int a = DecodeTable[in[pos]];
+                const int b = DecodeTable[in[pos + 1]];
+                const int c = DecodeTable[in[pos + 2]];
+                const int d = DecodeTable[in[pos + 3]];
+                if ((a | b | c | d) < 0) {
+                    break;
+                }
+                const quint32 group = quint32(a) << 18 | quint32(b) << 12 | quint32(c) << 6 | quint32(d);
+                out[0] = char(group >> 16);
+                out[1] = char(group >> 8);
+                out[2] = char(group);
+                out += 3;
+            }
+            if (pos == size) {
+                break;
+            }
+        }
+        const int value = DecodeTable[in[pos++]];
+        if (value < 0) {
+            continue;
+        }
+        mBits = mBits << 6 | quint32(value);
+        mBitCount += 6;
+        if (mBitCount >= 8) {
+            mBitCount -= 8;
+            *out++ = char(mBits >> mBitCount);
+            mBits &= (1u << mBitCount) - 1;
+        }
+    }
+    return out - begin;
+}
+
+QByteArray decode(QByteArrayView encoded, Simd simd)
+{
+    QByteArray result(Decoder::maxDecodedSize(encoded.size()), Qt::Uninitialized);
+    Decoder decoder(simd);
+    result.truncate(decoder.decode(encoded, result.data()));
+    return result;
+}
+}
+}
+}
@@ -0,0 +1,70 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+/**
+ * Base64 codec for attachment bodies
+ *
+ * On x86 the SSSE3 or AVX2 code is chosen at runtime, the results are the
+ * same with every instruction set.
+ */
+namespace Base64
+{
+enum class Simd {
+    None,
+    Ssse3,
+    Avx2,
+};
+
+// The best instruction set supported by this CPU
+[[nodiscard]] Simd bestSimd();
+
+/**
+ * Encodes @p data in lines of 76 characters, each ending with a line feed,
+ * which is how KMime encodes base64 bodies
+ *
+ * @p simd is lowered to bestSimd() if the CPU does not support it.
+ */
+[[nodiscard]] QByteArray encode(QByteArrayView data, Simd simd = bestSimd());
+
+/**
+ * Decodes base64 text in pieces that need not end on a group of four
+ *
+ * Like QByteArray::fromBase64(), characters outside the alphabet, line breaks
+ * and padding included, are skipped.
+ */
+class Decoder
+{
+public:
+    explicit Decoder(Simd simd = bestSimd());
+
+    // The room decode() may need for @p encodedSize characters
+    [[nodiscard]] static qsizetype maxDecodedSize(qsizetype encodedSize);
+
+    // Writes the data decoded so far to @p out, returns its size
+    qsizetype decode(QByteArrayView encoded, char *out);
+
+private:
+    Simd mSimd;
+    quint32 mBits = 0;
+    int mBitCount = 0;
+};
+
+/**
+ * Decodes @p encoded, the result is the same as with QByteArray::fromBase64()
+ */
+[[nodiscard]] QByteArray decode(QByteArrayView encoded, Simd simd = bestSimd());
+}
+}
+}
@@ -0,0 +1,88 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "customxml_p.h"
+
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+namespace CustomXml
+{
+static void writeDocument(QXmlStreamWriter &writer, const QMap<QString, QString> &custom)
+{
+    writer.setAutoFormatting(true);
+    writer.setAutoFormattingIndent(1);
+    writer.writeStartDocument();
+    writer.writeStartElement(QStringLiteral("custom"));
+    writer.writeAttribute(QStringLiteral("version"), QStringLiteral("1.0"));
+    for (auto it = custom.cbegin(), end = custom.cend(); it != end; ++it) {
+        writer.writeTextElement(it.key(), it.value());
+    }
+    writer.writeEndElement();
+    writer.writeEndDocument();
+}
+
+QByteArray write(const QMap<QString, QString> &custom)
+{
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    writeDocument(writer, custom);
+    return xml;
+}
+
+bool write(QIODevice *device, const QMap<QString, QString> &custom)
+{
+    QXmlStreamWriter writer(device);
+    writeDocument(writer, custom);
+    return !writer.hasError();
+}
+
+bool read(const QByteArray &xml, QMap<QString, QString> &custom, ReadError *error)
+{
+    QXmlStreamReader reader(xml);
+    auto fail = [&reader, error](ReadError::Kind kind, const QString &detail) {
+        if (error) {
+            *error = {kind, detail, reader.lineNumber(), reader.columnNumber()};
+        }
+        return false;
+    };
+    if (!reader.readNextStartElement()) {
+        return reader.hasError() ? fail(ReadError::SyntaxError, reader.errorString()) : fail(ReadError::EmptyDocument, QString());
+    }
+    if (reader.name() != QLatin1StringView("custom")) {
+        return fail(ReadError::WrongRootElement, reader.name().toString());
+    }
+
+    QMap<QString, QString> values;
+    while (reader.readNextStartElement()) {
+        const QString key = reader.name().toString();
+        // Same as QDomElement::text(): nested elements contribute their text
+        values.insert(key, reader.readElementText(QXmlStreamReader::IncludeChildElements));
+    }
+    // Like QDomDocument, only whitespace, comments and processing instructions may follow the root element
+    while (!reader.hasError() && reader.readNext() != QXmlStreamReader::EndDocument) {
+        if (!reader.hasError() && !reader.isWhitespace() && !reader.isComment() && !reader.isProcessingInstruction()) {
+            return fail(ReadError::TrailingContent, QString());
+        }
+    }
+    if (reader.hasError()) {
+        return fail(ReadError::SyntaxError, reader.errorString());
+    }
+
+    if (custom.isEmpty()) {
+        custom = std::move(values);
+    } else {
+        custom.insert(values);
+    }
+    return true;
+}
+}
+}
+}
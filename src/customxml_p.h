@@ -0,0 +1,62 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+
+class QIODevice;
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+/**
+ * Single-pass codec for the body of the custom-values part of a note
+ *
+ * The format is an XML document with a \<custom version="1.0"\> root element
+ * that holds one element per key, with the value as its text. Documents are
+ * written as UTF-8.
+ */
+namespace CustomXml
+{
+[[nodiscard]] QByteArray write(const QMap<QString, QString> &custom);
+/**
+ * Writes the document for @p custom to @p device
+ *
+ * @return false if writing to @p device failed
+ */
+[[nodiscard]] bool write(QIODevice *device, const QMap<QString, QString> &custom);
+
+/**
+ * Why a document could not be read, translating it is up to the caller
+ */
+struct ReadError {
+    enum Kind {
+        NoError,
+        EmptyDocument,
+        WrongRootElement, ///< detail is the name of the root element
+        TrailingContent, ///< there is more than whitespace, comments and processing instructions after the root element
+        SyntaxError, ///< detail is the message of QXmlStreamReader
+    };
+    Kind kind = NoError;
+    QString detail;
+    qint64 line = 0;
+    qint64 column = 0;
+};
+
+/**
+ * Reads the values of @p xml into @p custom
+ *
+ * @p custom is left untouched if @p xml is not a valid custom document,
+ * @p error then describes the problem.
+ */
+[[nodiscard]] bool read(const QByteArray &xml, QMap<QString, QString> &custom, ReadError *error = nullptr);
+}
+}
+}
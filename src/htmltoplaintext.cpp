@@ -0,0 +1,283 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "htmltoplaintext_p.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+// Returns the position of the first '<' or '&' at or after from, or size if there is none.
+// The fixed size inner loop has no early exit, so the compiler can vectorize it.
+static qsizetype findMarkup(const char16_t *text, qsizetype from, qsizetype size)
+{
+    constexpr qsizetype BlockSize = 16;
+    qsizetype i = from;
+    for (; i + BlockSize <= size; i += BlockSize) {
+        bool found = false;
+        for (qsizetype k = 0; k < BlockSize; ++k) {
+            found |= (text[i + k] == u'<') | (text[i + k] == u'&');
+        }
+        if (found) {
+            break;
+        }
+    }
+    for (; i < size; ++i) {
+        if (text[i] == u'<' || text[i] == u'&') {
+            return i;
+        }
+    }
+    return size;
+}
+
+struct NamedEntity {
+    QLatin1StringView name;
+    char16_t value;
+};
+
+// The character entity references of HTML 4 and &apos;, sorted by name
+static constexpr NamedEntity namedEntities[] = {
+    {QLatin1StringView("AElig"), 0x00c6}, {QLatin1StringView("Aacute"), 0x00c1}, {QLatin1StringView("Acirc"), 0x00c2}, {QLatin1StringView("Agrave"), 0x00c0},
+    {QLatin1StringView("Alpha"), 0x0391}, {QLatin1StringView("Aring"), 0x00c5}, {QLatin1StringView("Atilde"), 0x00c3}, {QLatin1StringView("Auml"), 0x00c4},
+    {QLatin1StringView("Beta"), 0x0392}, {QLatin1StringView("Ccedil"), 0x00c7}, {QLatin1StringView("Chi"), 0x03a7}, {QLatin1StringView("Dagger"), 0x2021},
+    {QLatin1StringView("Delta"), 0x0394}, {QLatin1StringView("ETH"), 0x00d0}, {QLatin1StringView("Eacute"), 0x00c9}, {QLatin1StringView("Ecirc"), 0x00ca},
+    {QLatin1StringView("Egrave"), 0x00c8}, {QLatin1StringView("Epsilon"), 0x0395}, {QLatin1StringView("Eta"), 0x0397}, {QLatin1StringView("Euml"), 0x00cb},
+    {QLatin1StringView("Gamma"), 0x0393}, {QLatin1StringView("Iacute"), 0x00cd}, {QLatin1StringView("Icirc"), 0x00ce}, {QLatin1StringView("Igrave"), 0x00cc},
+    {QLatin1StringView("Iota"), 0x0399}, {QLatin1StringView("Iuml"), 0x00cf}, {QLatin1StringView("Kappa"), 0x039a}, {QLatin1StringView("Lambda"), 0x039b},
+    {QLatin1StringView("Mu"), 0x039c}, {QLatin1StringView("Ntilde"), 0x00d1}, {QLatin1StringView("Nu"), 0x039d}, {QLatin1StringView("OElig"), 0x0152},
+    {QLatin1StringView("Oacute"), 0x00d3}, {QLatin1StringView("Ocirc"), 0x00d4}, {QLatin1StringView("Ograve"), 0x00d2}, {QLatin1StringView("Omega"), 0x03a9},
+    {QLatin1StringView("Omicron"), 0x039f}, {QLatin1StringView("Oslash"), 0x00d8}, {QLatin1StringView("Otilde"), 0x00d5}, {QLatin1StringView("Ouml"), 0x00d6},
+    {QLatin1StringView("Phi"), 0x03a6}, {QLatin1StringView("Pi"), 0x03a0}, {QLatin1StringView("Prime"), 0x2033}, {QLatin1StringView("Psi"), 0x03a8},
+    {QLatin1StringView("Rho"), 0x03a1}, {QLatin1StringView("Scaron"), 0x0160}, {QLatin1StringView("Sigma"), 0x03a3}, {QLatin1StringView("THORN"), 0x00de},
+    {QLatin1StringView("Tau"), 0x03a4}, {QLatin1StringView("Theta"), 0x0398}, {QLatin1StringView("Uacute"), 0x00da}, {QLatin1StringView("Ucirc"), 0x00db},
+    {QLatin1StringView("Ugrave"), 0x00d9}, {QLatin1StringView("Upsilon"), 0x03a5}, {QLatin1StringView("Uuml"), 0x00dc}, {QLatin1StringView("Xi"), 0x039e},
+    {QLatin1StringView("Yacute"), 0x00dd}, {QLatin1StringView("Yuml"), 0x0178}, {QLatin1StringView("Zeta"), 0x0396}, {QLatin1StringView("aacute"), 0x00e1},
+    {QLatin1StringView("acirc"), 0x00e2}, {QLatin1StringView("acute"), 0x00b4}, {QLatin1StringView("aelig"), 0x00e6}, {QLatin1StringView("agrave"), 0x00e0},
+    {QLatin1StringView("alefsym"), 0x2135}, {QLatin1StringView("alpha"), 0x03b1}, {QLatin1StringView("amp"), 0x0026}, {QLatin1StringView("and"), 0x2227},
+    {QLatin1StringView("ang"), 0x2220}, {QLatin1StringView("apos"), 0x0027}, {QLatin1StringView("aring"), 0x00e5}, {QLatin1StringView("asymp"), 0x2248},
+    {QLatin1StringView("atilde"), 0x00e3}, {QLatin1StringView("auml"), 0x00e4}, {QLatin1StringView("bdquo"), 0x201e}, {QLatin1StringView("beta"), 0x03b2},
+    {QLatin1StringView("brvbar"), 0x00a6}, {QLatin1StringView("bull"), 0x2022}, {QLatin1StringView("cap"), 0x2229}, {QLatin1StringView("ccedil"), 0x00e7},
+    {QLatin1StringView("cedil"), 0x00b8}, {QLatin1StringView("cent"), 0x00a2}, {QLatin1StringView("chi"), 0x03c7}, {QLatin1StringView("circ"), 0x02c6},
+    {QLatin1StringView("clubs"), 0x2663}, {QLatin1StringView("cong"), 0x2245}, {QLatin1StringView("copy"), 0x00a9}, {QLatin1StringView("crarr"), 0x21b5},
+    {QLatin1StringView("cup"), 0x222a}, {QLatin1StringView("curren"), 0x00a4}, {QLatin1StringView("dArr"), 0x21d3}, {QLatin1StringView("dagger"), 0x2020},
+    {QLatin1StringView("darr"), 0x2193}, {QLatin1StringView("deg"), 0x00b0}, {QLatin1StringView("delta"), 0x03b4}, {QLatin1StringView("diams"), 0x2666},
+    {QLatin1StringView("divide"), 0x00f7}, {QLatin1StringView("eacute"), 0x00e9}, {QLatin1StringView("ecirc"), 0x00ea}, {QLatin1StringView("egrave"), 0x00e8},
+    {QLatin1StringView("empty"), 0x2205}, {QLatin1StringView("emsp"), 0x2003}, {QLatin1StringView("ensp"), 0x2002}, {QLatin1StringView("epsilon"), 0x03b5},
+    {QLatin1StringView("equiv"), 0x2261}, {QLatin1StringView("eta"), 0x03b7}, {QLatin1StringView("eth"), 0x00f0}, {QLatin1StringView("euml"), 0x00eb},
+    {QLatin1StringView("euro"), 0x20ac}, {QLatin1StringView("exist"), 0x2203}, {QLatin1StringView("fnof"), 0x0192}, {QLatin1StringView("forall"), 0x2200},
+    {QLatin1StringView("frac12"), 0x00bd}, {QLatin1StringView("frac14"), 0x00bc}, {QLatin1StringView("frac34"), 0x00be}, {QLatin1StringView("frasl"), 0x2044},
+    {QLatin1StringView("gamma"), 0x03b3}, {QLatin1StringView("ge"), 0x2265}, {QLatin1StringView("gt"), 0x003e}, {QLatin1StringView("hArr"), 0x21d4},
+    {QLatin1StringView("harr"), 0x2194}, {QLatin1StringView("hearts"), 0x2665}, {QLatin1StringView("hellip"), 0x2026}, {QLatin1StringView("iacute"), 0x00ed},
+    {QLatin1StringView("icirc"), 0x00ee}, {QLatin1StringView("iexcl"), 0x00a1}, {QLatin1StringView("igrave"), 0x00ec}, {QLatin1StringView("image"), 0x2111},
+    {QLatin1StringView("infin"), 0x221e}, {QLatin1StringView("int"), 0x222b}, {QLatin1StringView("iota"), 0x03b9}, {QLatin1StringView("iquest"), 0x00bf},
+    {QLatin1StringView("isin"), 0x2208}, {QLatin1StringView("iuml"), 0x00ef}, {QLatin1StringView("kappa"), 0x03ba}, {QLatin1StringView("lArr"), 0x21d0},
+    {QLatin1StringView("lambda"), 0x03bb}, {QLatin1StringView("lang"), 0x2329}, {QLatin1StringView("laquo"), 0x00ab}, {QLatin1StringView("larr"), 0x2190},
+    {QLatin1StringView("lceil"), 0x2308}, {QLatin1StringView("ldquo"), 0x201c}, {QLatin1StringView("le"), 0x2264}, {QLatin1StringView("lfloor"), 0x230a},
+    {QLatin1StringView("lowast"), 0x2217}, {QLatin1StringView("loz"), 0x25ca}, {QLatin1StringView("lrm"), 0x200e}, {QLatin1StringView("lsaquo"), 0x2039},
+    {QLatin1StringView("lsquo"), 0x2018}, {QLatin1StringView("lt"), 0x003c}, {QLatin1StringView("macr"), 0x00af}, {QLatin1StringView("mdash"), 0x2014},
+    {QLatin1StringView("micro"), 0x00b5}, {QLatin1StringView("middot"), 0x00b7}, {QLatin1StringView("minus"), 0x2212}, {QLatin1StringView("mu"), 0x03bc},
+    {QLatin1StringView("nabla"), 0x2207}, {QLatin1StringView("nbsp"), 0x00a0}, {QLatin1StringView("ndash"), 0x2013}, {QLatin1StringView("ne"), 0x2260},
+    {QLatin1StringView("ni"), 0x220b}, {QLatin1StringView("not"), 0x00ac}, {QLatin1StringView("notin"), 0x2209}, {QLatin1StringView("nsub"), 0x2284},
+    {QLatin1StringView("ntilde"), 0x00f1}, {QLatin1StringView("nu"), 0x03bd}, {QLatin1StringView("oacute"), 0x00f3}, {QLatin1StringView("ocirc"), 0x00f4},
+    {QLatin1StringView("oelig"), 0x0153}, {QLatin1StringView("ograve"), 0x00f2}, {QLatin1StringView("oline"), 0x203e}, {QLatin1StringView("omega"), 0x03c9},
+    {QLatin1StringView("omicron"), 0x03bf}, {QLatin1StringView("oplus"), 0x2295}, {QLatin1StringView("or"), 0x2228}, {QLatin1StringView("ordf"), 0x00aa},
+    {QLatin1StringView("ordm"), 0x00ba}, {QLatin1StringView("oslash"), 0x00f8}, {QLatin1StringView("otilde"), 0x00f5}, {QLatin1StringView("otimes"), 0x2297},
+    {QLatin1StringView("ouml"), 0x00f6}, {QLatin1StringView("para"), 0x00b6}, {QLatin1StringView("part"), 0x2202}, {QLatin1StringView("permil"), 0x2030},
+    {QLatin1StringView("perp"), 0x22a5}, {QLatin1StringView("phi"), 0x03c6}, {QLatin1StringView("pi"), 0x03c0}, {QLatin1StringView("piv"), 0x03d6},
+    {QLatin1StringView("plusmn"), 0x00b1}, {QLatin1StringView("pound"), 0x00a3}, {QLatin1StringView("prime"), 0x2032}, {QLatin1StringView("prod"), 0x220f},
+    {QLatin1StringView("prop"), 0x221d}, {QLatin1StringView("psi"), 0x03c8}, {QLatin1StringView("quot"), 0x0022}, {QLatin1StringView("rArr"), 0x21d2},
+    {QLatin1StringView("radic"), 0x221a}, {QLatin1StringView("rang"), 0x232a}, {QLatin1StringView("raquo"), 0x00bb}, {QLatin1StringView("rarr"), 0x2192},
+    {QLatin1StringView("rceil"), 0x2309}, {QLatin1StringView("rdquo"), 0x201d}, {QLatin1StringView("real"), 0x211c}, {QLatin1StringView("reg"), 0x00ae},
+    {QLatin1StringView("rfloor"), 0x230b}, {QLatin1StringView("rho"), 0x03c1}, {QLatin1StringView("rlm"), 0x200f}, {QLatin1StringView("rsaquo"), 0x203a},
+    {QLatin1StringView("rsquo"), 0x2019}, {QLatin1StringView("sbquo"), 0x201a}, {QLatin1StringView("scaron"), 0x0161}, {QLatin1StringView("sdot"), 0x22c5},
+    {QLatin1StringView("sect"), 0x00a7}, {QLatin1StringView("shy"), 0x00ad}, {QLatin1StringView("sigma"), 0x03c3}, {QLatin1StringView("sigmaf"), 0x03c2},
+    {QLatin1StringView("sim"), 0x223c}, {QLatin1StringView("spades"), 0x2660}, {QLatin1StringView("sub"), 0x2282}, {QLatin1StringView("sube"), 0x2286},
+    {QLatin1StringView("sum"), 0x2211}, {QLatin1StringView("sup"), 0x2283}, {QLatin1StringView("sup1"), 0x00b9}, {QLatin1StringView("sup2"), 0x00b2},
+    {QLatin1StringView("sup3"), 0x00b3}, {QLatin1StringView("supe"), 0x2287}, {QLatin1StringView("szlig"), 0x00df}, {QLatin1StringView("tau"), 0x03c4},
+    {QLatin1StringView("there4"), 0x2234}, {QLatin1StringView("theta"), 0x03b8}, {QLatin1StringView("thetasym"), 0x03d1}, {QLatin1StringView("thinsp"), 0x2009},
+    {QLatin1StringView("thorn"), 0x00fe}, {QLatin1StringView("tilde"), 0x02dc}, {QLatin1StringView("times"), 0x00d7}, {QLatin1StringView("trade"), 0x2122},
+    {QLatin1StringView("uArr"), 0x21d1}, {QLatin1StringView("uacute"), 0x00fa}, {QLatin1StringView("uarr"), 0x2191}, {QLatin1StringView("ucirc"), 0x00fb},
+    {QLatin1StringView("ugrave"), 0x00f9}, {QLatin1StringView("uml"), 0x00a8}, {QLatin1StringView("upsih"), 0x03d2}, {QLatin1StringView("upsilon"), 0x03c5},
+    {QLatin1StringView("uuml"), 0x00fc}, {QLatin1StringView("weierp"), 0x2118}, {QLatin1StringView("xi"), 0x03be}, {QLatin1StringView("yacute"), 0x00fd},
+    {QLatin1StringView("yen"), 0x00a5}, {QLatin1StringView("yuml"), 0x00ff}, {QLatin1StringView("zeta"), 0x03b6}, {QLatin1StringView("zwj"), 0x200d},
+    {QLatin1StringView("zwnj"), 0x200c},
+};
+
+static constexpr qsizetype MaxEntityLength = 12;
+
+// Decodes the character reference at text[pos] == '&' into the one or two UTF-16 code units of
+// decoded and sets length to their number. Returns the position after the reference, or pos if
+// it is not a valid one.
+static qsizetype decodeEntity(QStringView text, qsizetype pos, char16_t (&decoded)[2], qsizetype &length)
+{
+    const qsizetype semicolon = text.sliced(pos, std::min(text.size() - pos, MaxEntityLength)).indexOf(u';');
+    if (semicolon < 2) {
+        return pos;
+    }
+    const QStringView name = text.sliced(pos + 1, semicolon - 1);
+
+    length = 1;
+    if (name.front() == u'#') {
+        bool ok = false;
+        const bool hex = name.size() > 1 && (name[1] == u'x' || name[1] == u'X');
+        const uint codePoint = name.sliced(hex ? 2 : 1).toUInt(&ok, hex ? 16 : 10);
+        if (!ok) {
+            return pos;
+        }
+        if (codePoint == 0 || codePoint > 0x10ffff || QChar::isSurrogate(codePoint)) {
+            decoded[0] = char16_t(QChar::ReplacementCharacter);
+        } else if (QChar::requiresSurrogates(codePoint)) {
+            decoded[0] = QChar::highSurrogate(codePoint);
+            decoded[1] = QChar::lowSurrogate(codePoint);
+            length = 2;
+        } else {
+            decoded[0] = char16_t(codePoint);
+        }
+        return pos + semicolon + 1;
+    }
+
+    const auto entity = std::lower_bound(std::begin(namedEntities), std::end(namedEntities), name, [](const NamedEntity &entity, QStringView name) {
+        return name.compare(entity.name) > 0;
+    });
+    if (entity == std::end(namedEntities) || name.compare(entity->name) != 0) {
+        return pos;
+    }
+    decoded[0] = entity->value;
+    return pos + semicolon + 1;
+}
+
+// Appends a run of text, dropping whitespace at the start of the result
+static void appendText(QString &out, QStringView text)
+{
+    if (out.isEmpty()) {
+        while (!text.isEmpty() && text.front().isSpace()) {
+            text = text.sliced(1);
+        }
+    }
+    out.append(text);
+}
+
+// Truncates text to at most maxChars characters without splitting a surrogate pair
+static void truncatePlainText(QString &text, qsizetype maxChars)
+{
+    if (text.size() > maxChars) {
+        if (maxChars > 0 && text[maxChars - 1].isHighSurrogate()) {
+            --maxChars;
+        }
+        text.truncate(maxChars);
+    }
+}
+
+// A document whose <body> tag does not show up within this many characters is converted as a fragment
+static constexpr qsizetype MaxHeadLength = 64 * 1024;
+
+// Returns whether the incomplete html might still be followed by a <body> tag, that is whether it
+// starts like an HTML document and its head is not too long yet
+static bool bodyMayFollow(QStringView html)
+{
+    if (html.size() >= MaxHeadLength) {
+        return false;
+    }
+    while (!html.isEmpty() && html.front().isSpace()) {
+        html = html.sliced(1);
+    }
+    for (const QLatin1StringView start : {QLatin1StringView("<!doctype"), QLatin1StringView("<html")}) {
+        const qsizetype length = std::min(html.size(), start.size());
+        if (html.first(length).compare(start.first(length), Qt::CaseInsensitive) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Converts html into out, stopping once out holds more than maxChars characters if maxChars >= 0.
+// Returns false if html is incomplete and needs to be continued before more output can be produced.
+static bool convert(QStringView html, qsizetype maxChars, bool complete, QString &out)
+{
+    qsizetype begin = 0;
+    qsizetype end = html.size();
+    // Only the head window is searched, so a body-less text costs no more than its converted part
+    const qsizetype bodyTag = html.first(std::min(html.size(), MaxHeadLength)).indexOf(u"<body", 0, Qt::CaseInsensitive);
+    const qsizetype bodyTagEnd = bodyTag >= 0 ? html.indexOf(u'>', bodyTag) : -1;
+    if (!complete && bodyTagEnd < 0 && (bodyTag >= 0 || bodyMayFollow(html))) {
+        return false; // the body might start later on
+    }
+    if (bodyTagEnd >= 0) {
+        begin = bodyTagEnd + 1;
+        const qsizetype bodyEnd = complete ? html.lastIndexOf(u"</body>", -1, Qt::CaseInsensitive) : -1;
+        if (bodyEnd >= begin) {
+            end = bodyEnd;
+        }
+    }
+    const QStringView body = html.sliced(begin, end - begin);
+    const char16_t *text = body.utf16();
+    const qsizetype size = body.size();
+
+    out.clear();
+    out.reserve(maxChars >= 0 ? std::min(size, maxChars + 1) : size);
+    qsizetype pos = 0;
+    while (pos < size && (maxChars < 0 || out.size() <= maxChars)) {
+        // Never look further ahead than the output still needs
+        const qsizetype scanEnd = maxChars < 0 ? size : std::min(size, pos + maxChars + 1 - out.size());
+        const qsizetype markup = findMarkup(text, pos, scanEnd);
+        appendText(out, body.sliced(pos, markup - pos));
+        if (markup == scanEnd) {
+            pos = markup;
+            continue;
+        }
+        if (text[markup] == u'<') {
+            const qsizetype tagEnd = body.indexOf(u'>', markup + 1);
+            if (tagEnd < 0) {
+                if (!complete) {
+                    return maxChars >= 0 && out.size() >= maxChars;
+                }
+                // An unterminated tag is kept as text
+                appendText(out, body.sliced(markup));
+                break;
+            }
+            pos = tagEnd + 1;
+        } else {
+            char16_t decoded[2];
+            qsizetype length = 0;
+            const qsizetype entityEnd = decodeEntity(body, markup, decoded, length);
+            if (entityEnd == markup) {
+                if (!complete && size - markup < MaxEntityLength && body.sliced(markup).indexOf(u';') < 0) {
+                    // The reference might be cut off
+                    return maxChars >= 0 && out.size() >= maxChars;
+                }
+                out += QLatin1Char('&');
+                pos = markup + 1;
+            } else {
+                // A decoded character is text like any other, e.g. a leading &nbsp; is dropped
+                appendText(out, QStringView(decoded, length));
+                pos = entityEnd;
+            }
+        }
+    }
+    return complete || (maxChars >= 0 && out.size() >= maxChars);
+}
+
+QString htmlToPlainText(QStringView html)
+{
+    QString out;
+    convert(html, -1, true, out);
+    return std::move(out).trimmed();
+}
+
+bool htmlToPlainTextPrefix(QStringView html, qsizetype maxChars, bool complete, QString &result)
+{
+    if (!convert(html, maxChars, complete, result)) {
+        return false;
+    }
+    truncatePlainText(result, maxChars);
+    result = std::move(result).trimmed();
+    return true;
+}
+}
+}
@@ -0,0 +1,43 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QString>
+#include <QStringView>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+/**
+ * Converts the rich text of a note to plain text in a single linear pass
+ *
+ * Only the content of the \<body\> element is converted, or the whole text if
+ * there is no \<body\> tag within its first 64 KiB. Tags are dropped, character references are decoded and
+ * surrounding whitespace is trimmed. Apart from the result no memory is
+ * allocated.
+ */
+[[nodiscard]] QString htmlToPlainText(QStringView html);
+
+/**
+ * Converts the beginning of the rich text of a note to plain text
+ *
+ * Like htmlToPlainText(), but the conversion stops as soon as @p maxChars
+ * characters of plain text are available, so its cost depends on the length
+ * of the result and not on the length of @p html. An incomplete text that
+ * does not start with \<!DOCTYPE or \<html, or whose \<body\> tag is not
+ * within its first 64 KiB, is converted as a fragment without a body.
+ *
+ * @param complete false if @p html is only a prefix of the text
+ * @param result the first @p maxChars characters of htmlToPlainText(), with
+ *        trailing whitespace removed
+ * @return false if @p html is incomplete and more of it is needed to produce
+ *         @p maxChars characters, @p result is unspecified then
+ */
+[[nodiscard]] bool htmlToPlainTextPrefix(QStringView html, qsizetype maxChars, bool complete, QString &result);
+}
+}
@@ -0,0 +1,216 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notecache.h"
+
+#include <KMime/Message>
+#include <QCache>
+#include <QCryptographicHash>
+#include <QMutex>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+class NoteCachePrivate
+{
+public:
+    struct Entry {
+        QSharedPointer<const NoteMessageWrapper> note;
+    };
+
+    explicit NoteCachePrivate(qint64 maxCost)
+        : cache(maxCost)
+    {
+    }
+
+    QSharedPointer<const NoteMessageWrapper> lookup(const QByteArray &key);
+    void insert(const QByteArray &key, const QSharedPointer<const NoteMessageWrapper> &note);
+
+    mutable QMutex mutex;
+    QCache<QByteArray, Entry> cache;
+    NoteCache::Statistics statistics;
+};
+
+// Key of a raw message, a cryptographic digest of its bytes. Notes come from remote sources,
+// so a collision must not be possible to craft, a hit is not compared with the bytes.
+static QByteArray contentKey(const QByteArray &rawMessage)
+{
+    return 'c' + QCryptographicHash::hash(rawMessage, QCryptographicHash::Blake2b_256);
+}
+
+// Key of a note revision, or a null array if it cannot be identified
+static QByteArray revisionKey(const QString &uid, const QDateTime &lastModifiedDate)
+{
+    if (uid.isEmpty() || !lastModifiedDate.isValid()) {
+        return {};
+    }
+    const qint64 msecs = lastModifiedDate.toMSecsSinceEpoch();
+    QByteArray key;
+    key += 'r';
+    key.append(reinterpret_cast<const char *>(&msecs), sizeof(msecs));
+    key += uid.toUtf8();
+    return key;
+}
+
+QSharedPointer<const NoteMessageWrapper> NoteCachePrivate::lookup(const QByteArray &key)
+{
+    const QMutexLocker locker(&mutex);
+    if (const Entry *entry = cache.object(key)) {
+        ++statistics.hits;
+        return entry->note;
+    }
+    ++statistics.misses;
+    return {};
+}
+
+void NoteCachePrivate::insert(const QByteArray &key, const QSharedPointer<const NoteMessageWrapper> &note)
+{
+    const qsizetype cost = note->estimatedMemoryUsage().total();
+    const QMutexLocker locker(&mutex);
+    if (cost > cache.maxCost()) {
+        return;
+    }
+    const bool replaced = cache.contains(key);
+    const qsizetype before = cache.count();
+    cache.insert(key, new Entry{note}, cost);
+    statistics.evictions += before + (replaced ? 0 : 1) - cache.count();
+}
+
+NoteCache::NoteCache(qint64 maxCost)
+    : d_ptr(new NoteCachePrivate(maxCost))
+{
+}
+
+NoteCache::~NoteCache() = default;
+
+QSharedPointer<const NoteMessageWrapper> NoteCache::note(const QByteArray &rawMessage)
+{
+    Q_D(NoteCache);
+    if (rawMessage.isEmpty()) {
+        return {};
+    }
+    const QByteArray key = contentKey(rawMessage);
+    if (auto note = d->lookup(key)) {
+        return note;
+    }
+
+    // Parsed outside of the lock, so other threads are not held up
+    auto msg = KMime::MessagePtr(new KMime::Message);
+    msg->setContent(rawMessage);
+    msg->parse();
+    const QSharedPointer<const NoteMessageWrapper> note = QSharedPointer<NoteMessageWrapper>::create(msg);
+    // Decoded before the cost is taken, readers must not grow a published note
+    note->loadAll();
+    d->insert(key, note);
+    return note;
+}
+
+QSharedPointer<const NoteMessageWrapper> NoteCache::note(const KMime::MessagePtr &msg)
+{
+    Q_D(NoteCache);
+    if (!msg) {
+        return {};
+    }
+    QByteArray key;
+    {
+        // Decodes just the two headers
+        const NoteMessageWrapper headers(msg, NoteMessageWrapper::LazyParsing);
+        key = revisionKey(headers.uid(), headers.lastModifiedDate());
+    }
+    if (!key.isNull()) {
+        if (auto note = d->lookup(key)) {
+            return note;
+        }
+    } else {
+        const QMutexLocker locker(&d->mutex);
+        ++d->statistics.misses;
+    }
+
+    const QSharedPointer<const NoteMessageWrapper> note = QSharedPointer<NoteMessageWrapper>::create(msg);
+    if (!key.isNull()) {
+        note->loadAll();
+        d->insert(key, note);
+    }
+    return note;
+}
+
+QSharedPointer<const NoteMessageWrapper> NoteCache::find(const QString &uid, const QDateTime &lastModifiedDate) const
+{
+    Q_D(const NoteCache);
+    const QByteArray key = revisionKey(uid, lastModifiedDate);
+    if (key.isNull()) {
+        return {};
+    }
+    return const_cast<NoteCachePrivate *>(d)->lookup(key);
+}
+
+void NoteCache::insert(const QSharedPointer<const NoteMessageWrapper> &note)
+{
+    Q_D(NoteCache);
+    if (!note) {
+        return;
+    }
+    // Readers of a shared note must not decode fields concurrently
+    note->loadAll();
+    const QByteArray key = revisionKey(note->uid(), note->lastModifiedDate());
+    if (!key.isNull()) {
+        d->insert(key, note);
+    }
+}
+
+void NoteCache::clear()
+{
+    Q_D(NoteCache);
+    const QMutexLocker locker(&d->mutex);
+    d->cache.clear();
+}
+
+void NoteCache::setMaxCost(qint64 maxCost)
+{
+    Q_D(NoteCache);
+    const QMutexLocker locker(&d->mutex);
+    const qsizetype before = d->cache.count();
+    d->cache.setMaxCost(maxCost);
+    d->statistics.evictions += before - d->cache.count();
+}
+
+qint64 NoteCache::maxCost() const
+{
+    Q_D(const NoteCache);
+    const QMutexLocker locker(&d->mutex);
+    return d->cache.maxCost();
+}
+
+qint64 NoteCache::totalCost() const
+{
+    Q_D(const NoteCache);
+    const QMutexLocker locker(&d->mutex);
+    return d->cache.totalCost();
+}
+
+qsizetype NoteCache::count() const
+{
+    Q_D(const NoteCache);
+    const QMutexLocker locker(&d->mutex);
+    return d->cache.count();
+}
+
+NoteCache::Statistics NoteCache::statistics() const
+{
+    Q_D(const NoteCache);
+    const QMutexLocker locker(&d->mutex);
+    return d->statistics;
+}
+
+void NoteCache::resetStatistics()
+{
+    Q_D(NoteCache);
+    const QMutexLocker locker(&d->mutex);
+    d->statistics = {};
+}
+}
+}
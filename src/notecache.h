@@ -0,0 +1,130 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include "akonadi-notes_export.h"
+#include "noteutils.h"
+
+#include <QSharedPointer>
+
+#include <memory>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+class NoteCachePrivate;
+
+/**
+ * @short Cache of parsed notes
+ *
+ * Maps notes to fully parsed, immutable NoteMessageWrapper instances, so that
+ * opening the same note again does not run the KMime parse, the custom values
+ * parse and the attachment decoding again. Raw messages are looked up by a
+ * BLAKE2b-256 digest of their bytes, KMime messages by their uid and last
+ * modified date.
+ *
+ * The least recently used notes are evicted once the notes take more than
+ * maxCost() bytes. The cost of a note is its NoteMessageWrapper::estimatedMemoryUsage()
+ * once its attachments are decoded.
+ *
+ * All methods may be called from several threads at once. The returned notes
+ * stay valid after they are evicted. They are fully decoded, and only fully
+ * decoded notes may be read from several threads at once, including
+ * message() and writeTo(). A lazily parsed note with pending fields may not.
+ *
+ * @code
+ * NoteUtils::NoteCache cache(16 * 1024 * 1024);
+ * const auto note = cache.note(item.payload<KMime::MessagePtr>());
+ * qCDebug(AKONADINOTES_LOG) << note->title();
+ * @endcode
+ *
+ * @since 6.3
+ */
+class AKONADI_NOTES_EXPORT NoteCache
+{
+public:
+    /**
+     * Hit, miss and eviction counts since construction or the last resetStatistics()
+     */
+    struct Statistics {
+        qint64 hits = 0;
+        qint64 misses = 0;
+        qint64 evictions = 0;
+    };
+
+    /**
+     * Creates a cache that holds notes worth up to @p maxCost bytes
+     */
+    explicit NoteCache(qint64 maxCost = 64 * 1024 * 1024);
+    ~NoteCache();
+
+    /**
+     * Returns the note for the raw RFC822 bytes @p rawMessage, parsing it if it is not cached
+     *
+     * Returns null if @p rawMessage is empty.
+     */
+    [[nodiscard]] QSharedPointer<const NoteMessageWrapper> note(const QByteArray &rawMessage);
+
+    /**
+     * Returns the note for @p msg, parsing it if it is not cached
+     *
+     * The note is looked up by the uid and last modified date headers of
+     * @p msg, a message that lacks one of them is parsed but not cached.
+     * As KMime creates missing headers on access, @p msg must not be used by
+     * another thread meanwhile. Returns null if @p msg is null.
+     */
+    [[nodiscard]] QSharedPointer<const NoteMessageWrapper> note(const KMime::MessagePtr &msg);
+
+    /**
+     * Returns the cached note with the given uid and last modified date, or null
+     */
+    [[nodiscard]] QSharedPointer<const NoteMessageWrapper> find(const QString &uid, const QDateTime &lastModifiedDate) const;
+
+    /**
+     * Adds @p note under its uid and last modified date
+     *
+     * The note must not be modified afterwards. The pending fields of a
+     * lazily parsed note are decoded first, so that it can be read from
+     * several threads, other threads must not read it while this runs.
+     * Notes without uid or valid last modified date are not added.
+     */
+    void insert(const QSharedPointer<const NoteMessageWrapper> &note);
+
+    /**
+     * Removes all notes
+     */
+    void clear();
+
+    /**
+     * Sets the budget in bytes and evicts notes until the cached ones fit into it
+     */
+    void setMaxCost(qint64 maxCost);
+    [[nodiscard]] qint64 maxCost() const;
+
+    /**
+     * Returns the summed up cost of the cached notes in bytes
+     */
+    [[nodiscard]] qint64 totalCost() const;
+
+    /**
+     * Returns the number of cached notes
+     */
+    [[nodiscard]] qsizetype count() const;
+
+    [[nodiscard]] Statistics statistics() const;
+    void resetStatistics();
+
+private:
+    //@cond PRIVATE
+    Q_DISABLE_COPY(NoteCache)
+    std::unique_ptr<NoteCachePrivate> const d_ptr;
+    Q_DECLARE_PRIVATE(NoteCache)
+    //@endcond
+};
+}
+}
@@ -0,0 +1,550 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notedelta.h"
+#include "base64_p.h"
+#include "notediff.h"
+#include "varint_p.h"
+
+#include <QTimeZone>
+#include <QUrl>
+
+#include <algorithm>
+#include <vector>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+// "AKND" followed by the format version
+static constexpr char FormatMagic[] = {'A', 'K', 'N', 'D', 2};
+
+static constexpr quint64 AllFields = NoteDiff::UidField | NoteDiff::TitleField | NoteDiff::TextField | NoteDiff::FromField | NoteDiff::ClassificationField
+    | NoteDiff::CreationDateField | NoteDiff::LastModifiedField | NoteDiff::CustomField | NoteDiff::AttachmentsField;
+
+// Where the data of an added attachment comes from
+enum AttachmentSource : quint64 {
+    UrlSource = 0,
+    InlineDataSource = 1,
+    // The data of an attachment of the base with the given digest
+    BaseDataSource = 2,
+};
+
+enum AttachmentFlag : quint64 {
+    DataBase64EncodedFlag = 1,
+};
+
+static void writeString(QByteArray &data, QStringView text)
+{
+    Varint::writeBytes(data, text.toUtf8());
+}
+
+static QString readString(Varint::Reader &reader)
+{
+    return QString::fromUtf8(reader.bytes());
+}
+
+static void writeDate(QByteArray &data, const QDateTime &date)
+{
+    if (!date.isValid()) {
+        Varint::write(data, 0);
+        return;
+    }
+    Varint::write(data, Varint::zigzag(date.toMSecsSinceEpoch()) + 1);
+    Varint::write(data, Varint::zigzag(date.offsetFromUtc()));
+}
+
+static QDateTime readDate(Varint::Reader &reader)
+{
+    const quint64 msecs = reader.varint();
+    if (msecs == 0) {
+        return {};
+    }
+    const qint64 offset = Varint::unzigzag(reader.varint());
+    if (offset < QTimeZone::MinUtcOffsetSecs || offset > QTimeZone::MaxUtcOffsetSecs) {
+        reader.fail();
+        return {};
+    }
+    const QTimeZone zone = offset == 0 ? QTimeZone::utc() : QTimeZone::fromSecondsAheadOfUtc(int(offset));
+    return QDateTime::fromMSecsSinceEpoch(Varint::unzigzag(msecs - 1), zone);
+}
+
+// An attachment is referred to by its url or data digest and its metadata, like NoteDiff compares them
+struct AttachmentKey {
+    bool hasUrl = false;
+    QByteArray content;
+    QString mimetype;
+    QString label;
+    QString contentID;
+
+    [[nodiscard]] bool matches(const Attachment &a) const
+    {
+        if (a.url().isValid() != hasUrl || a.mimetype() != mimetype || a.label() != label || a.contentID() != contentID) {
+            return false;
+        }
+        return content == (hasUrl ? a.url().toString().toUtf8() : a.digest());
+    }
+};
+
+static void writeAttachmentKey(QByteArray &data, const Attachment &a)
+{
+    const bool hasUrl = a.url().isValid();
+    Varint::write(data, hasUrl);
+    Varint::writeBytes(data, hasUrl ? a.url().toString().toUtf8() : a.digest());
+    writeString(data, a.mimetype());
+    writeString(data, a.label());
+    writeString(data, a.contentID());
+}
+
+static AttachmentKey readAttachmentKey(Varint::Reader &reader)
+{
+    AttachmentKey key;
+    const quint64 hasUrl = reader.varint();
+    if (hasUrl > 1) {
+        reader.fail();
+    }
+    key.hasUrl = hasUrl;
+    key.content = reader.bytes().toByteArray();
+    key.mimetype = readString(reader);
+    key.label = readString(reader);
+    key.contentID = readString(reader);
+    return key;
+}
+
+// The decoded data of an attachment, also for data set with Attachment::setDataBase64Encoded()
+static QByteArray decodedData(const Attachment &a)
+{
+    return a.dataBase64Encoded() ? Base64::decode(a.data()) : a.data();
+}
+
+static const Attachment *findData(const QList<Attachment> &attachments, const QByteArray &digest)
+{
+    const auto it = std::find_if(attachments.cbegin(), attachments.cend(), [&digest](const Attachment &a) {
+        return !a.url().isValid() && a.digest() == digest;
+    });
+    return it == attachments.cend() ? nullptr : &*it;
+}
+
+// The text without trailing whitespace, like the fingerprint covers it. A parsed note loses the
+// trailing whitespace of the note it was written from, so only this part is the same on both ends.
+static QStringView canonicalText(QStringView text)
+{
+    while (!text.isEmpty() && text.back().isSpace()) {
+        text.chop(1);
+    }
+    return text;
+}
+
+// A range of base that is replaced in text, without splitting surrogate pairs
+struct TextEdit {
+    qsizetype start = 0;
+    qsizetype removed = 0;
+    QStringView inserted;
+};
+
+static TextEdit textEdit(QStringView base, QStringView text)
+{
+    qsizetype prefix = std::mismatch(base.begin(), base.end(), text.begin(), text.end()).first - base.begin();
+    if (prefix > 0 && base[prefix - 1].isHighSurrogate()) {
+        --prefix;
+    }
+    const qsizetype maxSuffix = std::min(base.size(), text.size()) - prefix;
+    qsizetype suffix = 0;
+    while (suffix < maxSuffix && base[base.size() - 1 - suffix] == text[text.size() - 1 - suffix]) {
+        ++suffix;
+    }
+    if (suffix > 0 && base[base.size() - suffix].isLowSurrogate()) {
+        --suffix;
+    }
+    return {prefix, base.size() - prefix - suffix, text.sliced(prefix, text.size() - prefix - suffix)};
+}
+
+// Beyond this many inserted and removed lines the changed part is stored as a single range
+static constexpr qsizetype MaxLineEdits = 256;
+
+// The offsets where the lines of text start, followed by the size of text
+static std::vector<qsizetype> lineOffsets(QStringView text)
+{
+    std::vector<qsizetype> offsets{0};
+    for (qsizetype i = text.indexOf(u'\n'); i >= 0; i = text.indexOf(u'\n', i + 1)) {
+        offsets.push_back(i + 1);
+    }
+    if (offsets.back() != text.size()) {
+        offsets.push_back(text.size());
+    }
+    return offsets;
+}
+
+static QStringView line(QStringView text, const std::vector<qsizetype> &offsets, qsizetype i)
+{
+    return text.sliced(offsets[i], offsets[i + 1] - offsets[i]);
+}
+
+// The pairs of lines of base and text that stay, by the Myers difference algorithm, or nothing if
+// more than MaxLineEdits lines are inserted and removed
+static std::optional<std::vector<std::pair<qsizetype, qsizetype>>>
+matchLines(QStringView base, const std::vector<qsizetype> &baseOffsets, QStringView text, const std::vector<qsizetype> &textOffsets)
+{
+    const qsizetype n = qsizetype(baseOffsets.size()) - 1;
+    const qsizetype m = qsizetype(textOffsets.size()) - 1;
+    const qsizetype maxEdits = std::min(n + m, MaxLineEdits);
+    const qsizetype offset = maxEdits + 1;
+    // The furthest line of base reached on each diagonal k = x - y, for each number of edits
+    std::vector<qsizetype> v(2 * offset + 1, 0);
+    std::vector<std::vector<qsizetype>> trace;
+    for (qsizetype d = 0; d <= maxEdits; ++d) {
+        trace.push_back(v);
+        for (qsizetype k = -d; k <= d; k += 2) {
+            qsizetype x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])) ? v[offset + k + 1] : v[offset + k - 1] + 1;
+            qsizetype y = x - k;
+            while (x < n && y < m && line(base, baseOffsets, x) == line(text, textOffsets, y)) {
+                ++x;
+                ++y;
+            }
+            v[offset + k] = x;
+            if (x < n || y < m) {
+                continue;
+            }
+
+            // Walks back the edits to collect the lines that stay
+            std::vector<std::pair<qsizetype, qsizetype>> matches;
+            for (qsizetype e = d; e >= 0; --e) {
+                const std::vector<qsizetype> &previous = trace[e];
+                const qsizetype diagonal = x - y;
+                const qsizetype previousDiagonal =
+                    (diagonal == -e || (diagonal != e && previous[offset + diagonal - 1] < previous[offset + diagonal + 1])) ? diagonal + 1 : diagonal - 1;
+                const qsizetype previousX = previous[offset + previousDiagonal];
+                const qsizetype previousY = previousX - previousDiagonal;
+                while (x > previousX && y > previousY) {
+                    --x;
+                    --y;
+                    matches.emplace_back(x, y);
+                }
+                if (e > 0) {
+                    x = previousX;
+                    y = previousY;
+                }
+            }
+            std::reverse(matches.begin(), matches.end());
+            return matches;
+        }
+    }
+    return std::nullopt;
+}
+
+// The ranges of base that are replaced in text, in order. The lines that changed are found first,
+// then each run of changed lines is narrowed to the characters that differ, so that two edits far
+// apart in a long text are stored as two small ranges instead of everything between them.
+static std::vector<TextEdit> textEdits(QStringView base, QStringView text)
+{
+    const TextEdit changed = textEdit(base, text);
+    if (changed.removed == 0 && changed.inserted.isEmpty()) {
+        return {};
+    }
+    const QStringView baseRange = base.sliced(changed.start, changed.removed);
+    const std::vector<qsizetype> baseOffsets = lineOffsets(baseRange);
+    const std::vector<qsizetype> textOffsets = lineOffsets(changed.inserted);
+    const auto matches = matchLines(baseRange, baseOffsets, changed.inserted, textOffsets);
+    if (!matches) {
+        return {changed};
+    }
+
+    std::vector<TextEdit> edits;
+    qsizetype baseLine = 0;
+    qsizetype textLine = 0;
+    const auto addEdit = [&](qsizetype baseEnd, qsizetype textEnd) {
+        if (baseLine == baseEnd && textLine == textEnd) {
+            return;
+        }
+        const qsizetype baseStart = baseOffsets[baseLine];
+        const qsizetype textStart = textOffsets[textLine];
+        TextEdit edit = textEdit(baseRange.sliced(baseStart, baseOffsets[baseEnd] - baseStart),
+                                 changed.inserted.sliced(textStart, textOffsets[textEnd] - textStart));
+        edit.start += changed.start + baseStart;
+        edits.push_back(edit);
+    };
+    for (const auto &[baseMatch, textMatch] : *matches) {
+        addEdit(baseMatch, textMatch);
+        baseLine = baseMatch + 1;
+        textLine = textMatch + 1;
+    }
+    addEdit(qsizetype(baseOffsets.size()) - 1, qsizetype(textOffsets.size()) - 1);
+    return edits;
+}
+
+// Copies the fields of note, strings and attachment data stay shared
+static void copyNote(const NoteMessageWrapper &note, NoteMessageWrapper &copy)
+{
+    copy.setUid(note.uid());
+    copy.setTitle(note.title());
+    copy.setText(note.text(), note.textFormat());
+    copy.setFrom(note.from());
+    copy.setClassification(note.classification());
+    copy.setCreationDate(note.creationDate());
+    copy.setLastModifiedDate(note.lastModifiedDate());
+    copy.custom() = note.custom();
+    copy.attachments() = note.attachments();
+}
+
+static std::optional<NoteDeltaBase> readBase(Varint::Reader &reader)
+{
+    if (reader.bytes(sizeof(FormatMagic)) != QByteArrayView(FormatMagic, sizeof(FormatMagic))) {
+        return std::nullopt;
+    }
+    NoteDeltaBase base;
+    base.uid = readString(reader);
+    base.fingerprint = reader.bytes().toByteArray();
+    if (reader.failed()) {
+        return std::nullopt;
+    }
+    return base;
+}
+
+// The format, all numbers are LEB128 varints and strings are UTF-8 bytes prefixed by their length:
+//   magic, base uid, base fingerprint, revision fingerprint, the NoteDiff::Fields that changed
+//   and the new value of each of them in the order of the flags:
+//   uid, title, text as format and the count of replaced ranges, each as its start after the
+//   end of the previous range, its length and its new text, in UTF-16 code units of the base
+//   text without trailing whitespace, from, classification, creation and last modified date
+//   as 0 if invalid or 1 + zigzag coded msecs since epoch and zigzag coded offset from UTC in
+//   seconds, custom values as the count and the removed keys, the count and the changed keys
+//   and values, attachments as the count and the keys of the removed ones, the count and the
+//   source, url, data or digest, flags and metadata of the added ones.
+QByteArray encodeNoteDelta(const NoteMessageWrapper &base, const NoteMessageWrapper &revision)
+{
+    const NoteDiff diff = NoteDiff::between(base, revision);
+    const NoteDiff::Fields fields = diff.changedFields();
+
+    QByteArray data;
+    data.append(FormatMagic, sizeof(FormatMagic));
+    writeString(data, base.uid());
+    Varint::writeBytes(data, base.fingerprint());
+    Varint::writeBytes(data, revision.fingerprint());
+    Varint::write(data, fields.toInt());
+
+    if (fields & NoteDiff::UidField) {
+        writeString(data, diff.uid());
+    }
+    if (fields & NoteDiff::TitleField) {
+        writeString(data, diff.title());
+    }
+    if (fields & NoteDiff::TextField) {
+        Varint::write(data, diff.textFormat());
+        const QString text = diff.text();
+        const QString baseText = base.text();
+        const std::vector<TextEdit> edits = textEdits(canonicalText(baseText), text);
+        Varint::write(data, edits.size());
+        qsizetype end = 0;
+        for (const TextEdit &edit : edits) {
+            Varint::write(data, edit.start - end);
+            Varint::write(data, edit.removed);
+            writeString(data, edit.inserted);
+            end = edit.start + edit.removed;
+        }
+    }
+    if (fields & NoteDiff::FromField) {
+        writeString(data, diff.from());
+    }
+    if (fields & NoteDiff::ClassificationField) {
+        Varint::write(data, diff.classification());
+    }
+    if (fields & NoteDiff::CreationDateField) {
+        writeDate(data, diff.creationDate());
+    }
+    if (fields & NoteDiff::LastModifiedField) {
+        writeDate(data, diff.lastModifiedDate());
+    }
+
+    if (fields & NoteDiff::CustomField) {
+        const QStringList removed = diff.removedCustomKeys();
+        Varint::write(data, removed.size());
+        for (const QString &key : removed) {
+            writeString(data, key);
+        }
+        const QMap<QString, QString> changed = diff.changedCustomValues();
+        Varint::write(data, changed.size());
+        for (auto it = changed.cbegin(), end = changed.cend(); it != end; ++it) {
+            writeString(data, it.key());
+            writeString(data, it.value());
+        }
+    }
+
+    if (fields & NoteDiff::AttachmentsField) {
+        const QList<Attachment> removed = diff.removedAttachments();
+        Varint::write(data, removed.size());
+        for (const Attachment &a : removed) {
+            writeAttachmentKey(data, a);
+        }
+        const QList<Attachment> added = diff.addedAttachments();
+        Varint::write(data, added.size());
+        for (const Attachment &a : added) {
+            if (a.url().isValid()) {
+                Varint::write(data, UrlSource);
+                writeString(data, a.url().toString());
+            } else if (!a.dataBase64Encoded() && findData(base.attachments(), a.digest())) {
+                Varint::write(data, BaseDataSource);
+                Varint::writeBytes(data, a.digest());
+            } else {
+                Varint::write(data, InlineDataSource);
+                Varint::writeBytes(data, a.data());
+            }
+            Varint::write(data, a.dataBase64Encoded() ? DataBase64EncodedFlag : 0);
+            writeString(data, a.mimetype());
+            writeString(data, a.label());
+            writeString(data, a.contentID());
+        }
+    }
+    return data;
+}
+
+std::optional<NoteDeltaBase> scanNoteDelta(QByteArrayView delta)
+{
+    Varint::Reader reader(delta);
+    return readBase(reader);
+}
+
+NoteDeltaStatus applyNoteDelta(QByteArrayView delta, NoteMessageWrapper &note)
+{
+    Varint::Reader reader(delta);
+    const std::optional<NoteDeltaBase> base = readBase(reader);
+    const QByteArray revisionFingerprint = reader.bytes().toByteArray();
+    const quint64 fields = reader.varint();
+    if (!base || reader.failed() || (fields & ~AllFields)) {
+        return NoteDeltaStatus::InvalidDelta;
+    }
+    if (note.uid() != base->uid || note.fingerprint() != base->fingerprint) {
+        return NoteDeltaStatus::BaseMismatch;
+    }
+
+    // Changes go to a copy, so note stays as it is if the delta turns out to be broken
+    NoteMessageWrapper result;
+    copyNote(note, result);
+
+    if (fields & NoteDiff::UidField) {
+        result.setUid(readString(reader));
+    }
+    if (fields & NoteDiff::TitleField) {
+        result.setTitle(readString(reader));
+    }
+    if (fields & NoteDiff::TextField) {
+        const quint64 format = reader.varint();
+        const quint64 editCount = reader.varint();
+        if (format > Qt::MarkdownText) {
+            return NoteDeltaStatus::InvalidDelta;
+        }
+        const QString baseText = result.text();
+        const QStringView base = canonicalText(baseText);
+        QString text;
+        quint64 end = 0;
+        for (quint64 i = 0; i < editCount && !reader.failed(); ++i) {
+            const quint64 skipped = reader.varint();
+            const quint64 removed = reader.varint();
+            const QString inserted = readString(reader);
+            // Ranges come in order and do not overlap
+            if (skipped > quint64(base.size()) - end || removed > quint64(base.size()) - end - skipped) {
+                return NoteDeltaStatus::InvalidDelta;
+            }
+            text += base.sliced(qsizetype(end), qsizetype(skipped));
+            text += inserted;
+            end += skipped + removed;
+        }
+        text += base.sliced(qsizetype(end));
+        result.setText(text, Qt::TextFormat(format));
+    }
+    if (fields & NoteDiff::FromField) {
+        result.setFrom(readString(reader));
+    }
+    if (fields & NoteDiff::ClassificationField) {
+        const quint64 classification = reader.varint();
+        if (classification > NoteMessageWrapper::Confidential) {
+            return NoteDeltaStatus::InvalidDelta;
+        }
+        result.setClassification(NoteMessageWrapper::Classification(classification));
+    }
+    if (fields & NoteDiff::CreationDateField) {
+        result.setCreationDate(readDate(reader));
+    }
+    if (fields & NoteDiff::LastModifiedField) {
+        result.setLastModifiedDate(readDate(reader));
+    }
+
+    if (fields & NoteDiff::CustomField) {
+        QMap<QString, QString> &custom = result.custom();
+        const quint64 removedCount = reader.varint();
+        for (quint64 i = 0; i < removedCount && !reader.failed(); ++i) {
+            custom.remove(readString(reader));
+        }
+        const quint64 changedCount = reader.varint();
+        for (quint64 i = 0; i < changedCount && !reader.failed(); ++i) {
+            const QString key = readString(reader);
+            custom.insert(key, readString(reader));
+        }
+    }
+
+    if (fields & NoteDiff::AttachmentsField) {
+        const QList<Attachment> &baseAttachments = std::as_const(note).attachments();
+        QList<Attachment> &attachments = result.attachments();
+        const quint64 removedCount = reader.varint();
+        for (quint64 i = 0; i < removedCount && !reader.failed(); ++i) {
+            const AttachmentKey key = readAttachmentKey(reader);
+            const auto it = std::find_if(attachments.begin(), attachments.end(), [&key](const Attachment &a) {
+                return key.matches(a);
+            });
+            if (it == attachments.end()) {
+                return NoteDeltaStatus::InvalidDelta;
+            }
+            attachments.erase(it);
+        }
+        // Each attachment takes at least a byte, so the count is checked before reserving space for it
+        const quint64 addedCount = reader.varint();
+        if (addedCount > quint64(delta.size())) {
+            return NoteDeltaStatus::InvalidDelta;
+        }
+        attachments.reserve(attachments.size() + qsizetype(addedCount));
+        for (quint64 i = 0; i < addedCount && !reader.failed(); ++i) {
+            const quint64 source = reader.varint();
+            const QByteArrayView content = reader.bytes();
+            const quint64 flags = reader.varint();
+            const QString mimetype = readString(reader);
+            Attachment attachment;
+            if (source == UrlSource) {
+                attachment = Attachment(QUrl(QString::fromUtf8(content)), mimetype);
+            } else if (source == InlineDataSource) {
+                attachment = Attachment(content.toByteArray(), mimetype);
+            } else if (source == BaseDataSource) {
+                const Attachment *existing = findData(baseAttachments, content.toByteArray());
+                if (!existing) {
+                    return NoteDeltaStatus::InvalidDelta;
+                }
+                // A copy of the base attachment shares its data, also when that is spilled to a
+                // file. The mimetype has no setter, so data under another mimetype or stored
+                // base64 encoded is decoded into a new attachment.
+                if (existing->mimetype() == mimetype && !existing->dataBase64Encoded()) {
+                    attachment = *existing;
+                } else {
+                    attachment = Attachment(decodedData(*existing), mimetype);
+                }
+            } else {
+                return NoteDeltaStatus::InvalidDelta;
+            }
+            attachment.setDataBase64Encoded(flags & DataBase64EncodedFlag);
+            attachment.setLabel(readString(reader));
+            attachment.setContentID(readString(reader));
+            attachments.append(std::move(attachment));
+        }
+    }
+
+    if (reader.failed() || !reader.atEnd()) {
+        return NoteDeltaStatus::InvalidDelta;
+    }
+    if (result.fingerprint() != revisionFingerprint) {
+        return NoteDeltaStatus::ResultMismatch;
+    }
+    note = std::move(result);
+    return NoteDeltaStatus::Applied;
+}
+}
+}
@@ -0,0 +1,78 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include "akonadi-notes_export.h"
+#include "noteutils.h"
+
+#include <optional>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+/**
+ * The revision of a note a delta applies to, see scanNoteDelta()
+ * @since 6.3
+ */
+struct NoteDeltaBase {
+    QString uid;
+    /**
+     * The NoteMessageWrapper::fingerprint() of the base revision
+     */
+    QByteArray fingerprint;
+};
+
+/**
+ * Outcome of applyNoteDelta()
+ * @since 6.3
+ */
+enum class NoteDeltaStatus {
+    Applied,
+    InvalidDelta, ///< the delta is damaged or has an unknown format version
+    BaseMismatch, ///< the note is not the revision the delta was made from
+    ResultMismatch, ///< the result does not have the fingerprint of the revision the delta was made for
+};
+
+/**
+ * Encodes the changes from @p base to @p revision in a compact binary delta
+ *
+ * The delta holds the uid and fingerprint of @p base, the fingerprint of
+ * @p revision and the changes as NoteDiff::between() finds them. A changed
+ * text is stored as the replaced ranges and the new characters in them, one
+ * range for each run of changed lines, the other changed fields with their
+ * new value. Beyond 256 changed lines the text is stored as a single range
+ * from the first to the last change. Removed attachments, and added ones
+ * whose data is already in @p base, are referred to by their
+ * Attachment::digest(), only new data is included. Fixing a typo in a note
+ * with large attachments gives a delta of a few dozen bytes.
+ *
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT QByteArray encodeNoteDelta(const NoteMessageWrapper &base, const NoteMessageWrapper &revision);
+
+/**
+ * Reads the revision @p delta applies to, without decoding the changes
+ *
+ * @return nothing if @p delta is not a note delta
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT std::optional<NoteDeltaBase> scanNoteDelta(QByteArrayView delta);
+
+/**
+ * Applies @p delta to @p note, which must be the base revision of the delta
+ *
+ * The result is the revision the delta was made for, with the same field
+ * values, dates, custom values, attachments and attachment order. It is
+ * checked against the fingerprint in the delta. @p note is only changed if
+ * NoteDeltaStatus::Applied is returned.
+ *
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT NoteDeltaStatus applyNoteDelta(QByteArrayView delta, NoteMessageWrapper &note);
+}
+}
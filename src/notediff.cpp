@@ -0,0 +1,431 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notediff.h"
+
+#include <algorithm>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+class NoteDiffPrivate : public QSharedData
+{
+public:
+    NoteDiff::Fields fields;
+    QString uid;
+    QString title;
+    QString text;
+    Qt::TextFormat textFormat = Qt::PlainText;
+    QString from;
+    NoteMessageWrapper::Classification classification = NoteMessageWrapper::Public;
+    QDateTime creationDate;
+    QDateTime lastModifiedDate;
+    QMap<QString, QString> changedCustom;
+    QStringList removedCustom;
+    QList<Attachment> removedAttachments;
+    QList<Attachment> addedAttachments;
+};
+
+// Equal strings, without reading them if they share their data
+static bool sameString(const QString &a, const QString &b)
+{
+    return (a.constData() == b.constData() && a.size() == b.size()) || a == b;
+}
+
+// Attachments with the same content, the data is compared by digest
+static bool sameAttachment(const Attachment &a, const Attachment &b)
+{
+    return a.url() == b.url() && a.mimetype() == b.mimetype() && a.label() == b.label() && a.contentID() == b.contentID() && a.digest() == b.digest();
+}
+
+static bool containsAttachment(const QList<Attachment> &attachments, const Attachment &attachment)
+{
+    return std::any_of(attachments.cbegin(), attachments.cend(), [&attachment](const Attachment &a) {
+        return sameAttachment(a, attachment);
+    });
+}
+
+// Walks both sorted maps together, so equal values shared by both are not read
+static void diffCustom(const QMap<QString, QString> &base, const QMap<QString, QString> &revision, NoteDiffPrivate *d)
+{
+    if (base.isSharedWith(revision)) {
+        return;
+    }
+    auto b = base.cbegin();
+    auto r = revision.cbegin();
+    while (b != base.cend() || r != revision.cend()) {
+        if (r == revision.cend() || (b != base.cend() && b.key() < r.key())) {
+            d->removedCustom.append(b.key());
+            ++b;
+        } else if (b == base.cend() || r.key() < b.key()) {
+            d->changedCustom.insert(r.key(), r.value());
+            ++r;
+        } else {
+            if (!sameString(b.value(), r.value())) {
+                d->changedCustom.insert(r.key(), r.value());
+            }
+            ++b;
+            ++r;
+        }
+    }
+    if (!d->changedCustom.isEmpty() || !d->removedCustom.isEmpty()) {
+        d->fields |= NoteDiff::CustomField;
+    }
+}
+
+// Matches each attachment of the revision with an unused equal one of the base, returns the index
+// of that one for each attachment of the revision, or -1 for an added one
+static QList<qsizetype> matchAttachments(const QList<Attachment> &base, const QList<Attachment> &revision)
+{
+    QList<bool> used(base.size(), false);
+    QList<qsizetype> matches;
+    matches.reserve(revision.size());
+    for (const Attachment &a : revision) {
+        qsizetype match = -1;
+        for (qsizetype i = 0; i < base.size(); ++i) {
+            if (!used[i] && sameAttachment(base[i], a)) {
+                match = i;
+                used[i] = true;
+                break;
+            }
+        }
+        matches.append(match);
+    }
+    return matches;
+}
+
+// Marks the attachments of the base that are matched by an attachment of the revision
+static QList<bool> keptAttachments(qsizetype baseSize, const QList<qsizetype> &matches)
+{
+    QList<bool> kept(baseSize, false);
+    for (const qsizetype match : matches) {
+        if (match >= 0) {
+            kept[match] = true;
+        }
+    }
+    return kept;
+}
+
+static void diffAttachments(const QList<Attachment> &base, const QList<Attachment> &revision, NoteDiffPrivate *d)
+{
+    const QList<qsizetype> matches = matchAttachments(base, revision);
+    qsizetype lastKept = -1;
+    bool appendable = true;
+    for (qsizetype i = 0; i < revision.size(); ++i) {
+        const qsizetype match = matches[i];
+        if (match < 0) {
+            d->addedAttachments.append(revision[i]);
+            continue;
+        }
+        // apply() appends the added attachments after the kept ones, which keep their order
+        if (match < lastKept || !d->addedAttachments.isEmpty()) {
+            appendable = false;
+        }
+        lastKept = match;
+    }
+    const QList<bool> kept = keptAttachments(base.size(), matches);
+    for (qsizetype i = 0; i < base.size(); ++i) {
+        if (!kept[i]) {
+            d->removedAttachments.append(base[i]);
+        }
+    }
+    if (!appendable) {
+        d->removedAttachments = base;
+        d->addedAttachments = revision;
+    }
+    if (!d->removedAttachments.isEmpty() || !d->addedAttachments.isEmpty()) {
+        d->fields |= NoteDiff::AttachmentsField;
+    }
+}
+
+// Merges the attachments changed on both sides per attachment of the base: one that either side
+// removed is dropped once, the ones added on either side are added once. The kept attachments
+// take the order of the side that reordered them, if only one did.
+static QList<Attachment>
+mergeAttachments(const QList<Attachment> &base, const QList<Attachment> &local, const QList<Attachment> &remote, NoteDiff::Fields &conflicts)
+{
+    const QList<qsizetype> localMatches = matchAttachments(base, local);
+    const QList<qsizetype> remoteMatches = matchAttachments(base, remote);
+    const QList<bool> keptLocal = keptAttachments(base.size(), localMatches);
+    const QList<bool> keptRemote = keptAttachments(base.size(), remoteMatches);
+
+    // The order of the attachments of the base that both sides kept
+    auto keptOrder = [](const QList<qsizetype> &matches, const QList<bool> &keptOther) {
+        QList<qsizetype> order;
+        for (const qsizetype match : matches) {
+            if (match >= 0 && keptOther[match]) {
+                order.append(match);
+            }
+        }
+        return order;
+    };
+    const QList<qsizetype> localOrder = keptOrder(localMatches, keptRemote);
+    const QList<qsizetype> remoteOrder = keptOrder(remoteMatches, keptLocal);
+    const bool localReordered = !std::is_sorted(localOrder.cbegin(), localOrder.cend());
+    const bool remoteReordered = !std::is_sorted(remoteOrder.cbegin(), remoteOrder.cend());
+    if (localReordered && remoteReordered && localOrder != remoteOrder) {
+        conflicts |= NoteDiff::AttachmentsField;
+    }
+
+    // Walks the side whose order is taken, then appends what only the other side added
+    auto merge = [](const QList<Attachment> &first,
+                    const QList<qsizetype> &firstMatches,
+                    const QList<bool> &keptSecond,
+                    const QList<Attachment> &second,
+                    const QList<qsizetype> &secondMatches) {
+        QList<Attachment> merged;
+        QList<Attachment> firstAdded;
+        for (qsizetype i = 0; i < first.size(); ++i) {
+            if (firstMatches[i] < 0) {
+                firstAdded.append(first[i]);
+                merged.append(first[i]);
+            } else if (keptSecond[firstMatches[i]]) {
+                merged.append(first[i]);
+            }
+        }
+        for (qsizetype i = 0; i < second.size(); ++i) {
+            if (secondMatches[i] < 0 && !containsAttachment(firstAdded, second[i])) {
+                merged.append(second[i]);
+            }
+        }
+        return merged;
+    };
+    if (remoteReordered && !localReordered) {
+        return merge(remote, remoteMatches, keptLocal, local, localMatches);
+    }
+    return merge(local, localMatches, keptRemote, remote, remoteMatches);
+}
+
+NoteDiff::NoteDiff()
+    : d(new NoteDiffPrivate)
+{
+}
+
+NoteDiff::NoteDiff(const NoteDiff &other) = default;
+
+NoteDiff::~NoteDiff() = default;
+
+NoteDiff &NoteDiff::operator=(const NoteDiff &other) = default;
+
+NoteDiff NoteDiff::between(const NoteMessageWrapper &base, const NoteMessageWrapper &revision)
+{
+    NoteDiff diff;
+    NoteDiffPrivate *d = diff.d.data();
+    auto diffString = [d](Field field, const QString &baseValue, const QString &value, QString &target) {
+        if (!sameString(baseValue, value)) {
+            d->fields |= field;
+            target = value;
+        }
+    };
+    diffString(UidField, base.uid(), revision.uid(), d->uid);
+    diffString(TitleField, base.title(), revision.title(), d->title);
+    diffString(FromField, base.from(), revision.from(), d->from);
+    diffString(TextField, base.text(), revision.text(), d->text);
+    if (base.textFormat() != revision.textFormat()) {
+        d->fields |= TextField;
+        d->text = revision.text();
+    }
+    d->textFormat = revision.textFormat();
+    if (base.classification() != revision.classification()) {
+        d->fields |= ClassificationField;
+        d->classification = revision.classification();
+    }
+    if (base.creationDate() != revision.creationDate()) {
+        d->fields |= CreationDateField;
+        d->creationDate = revision.creationDate();
+    }
+    if (base.lastModifiedDate() != revision.lastModifiedDate()) {
+        d->fields |= LastModifiedField;
+        d->lastModifiedDate = revision.lastModifiedDate();
+    }
+    diffCustom(base.custom(), revision.custom(), d);
+    diffAttachments(base.attachments(), revision.attachments(), d);
+    return diff;
+}
+
+bool NoteDiff::isEmpty() const
+{
+    return !d->fields;
+}
+
+NoteDiff::Fields NoteDiff::changedFields() const
+{
+    return d->fields;
+}
+
+QString NoteDiff::uid() const
+{
+    return d->uid;
+}
+
+QString NoteDiff::title() const
+{
+    return d->title;
+}
+
+QString NoteDiff::text() const
+{
+    return d->text;
+}
+
+Qt::TextFormat NoteDiff::textFormat() const
+{
+    return d->textFormat;
+}
+
+QString NoteDiff::from() const
+{
+    return d->from;
+}
+
+NoteMessageWrapper::Classification NoteDiff::classification() const
+{
+    return d->classification;
+}
+
+QDateTime NoteDiff::creationDate() const
+{
+    return d->creationDate;
+}
+
+QDateTime NoteDiff::lastModifiedDate() const
+{
+    return d->lastModifiedDate;
+}
+
+QMap<QString, QString> NoteDiff::changedCustomValues() const
+{
+    return d->changedCustom;
+}
+
+QStringList NoteDiff::removedCustomKeys() const
+{
+    return d->removedCustom;
+}
+
+QList<Attachment> NoteDiff::removedAttachments() const
+{
+    return d->removedAttachments;
+}
+
+QList<Attachment> NoteDiff::addedAttachments() const
+{
+    return d->addedAttachments;
+}
+
+void NoteDiff::apply(NoteMessageWrapper &note) const
+{
+    if (d->fields & UidField) {
+        note.setUid(d->uid);
+    }
+    if (d->fields & TitleField) {
+        note.setTitle(d->title);
+    }
+    if (d->fields & TextField) {
+        note.setText(d->text, d->textFormat);
+    }
+    if (d->fields & FromField) {
+        note.setFrom(d->from);
+    }
+    if (d->fields & ClassificationField) {
+        note.setClassification(d->classification);
+    }
+    if (d->fields & CreationDateField) {
+        note.setCreationDate(d->creationDate);
+    }
+    if (d->fields & LastModifiedField) {
+        note.setLastModifiedDate(d->lastModifiedDate);
+    }
+    if (d->fields & CustomField) {
+        QMap<QString, QString> &custom = note.custom();
+        for (const QString &key : std::as_const(d->removedCustom)) {
+            custom.remove(key);
+        }
+        for (auto it = d->changedCustom.cbegin(), end = d->changedCustom.cend(); it != end; ++it) {
+            custom.insert(it.key(), it.value());
+        }
+    }
+    if (d->fields & AttachmentsField) {
+        QList<Attachment> &attachments = note.attachments();
+        for (const Attachment &removed : std::as_const(d->removedAttachments)) {
+            const auto it = std::find_if(attachments.begin(), attachments.end(), [&removed](const Attachment &a) {
+                return sameAttachment(a, removed);
+            });
+            if (it != attachments.end()) {
+                attachments.erase(it);
+            }
+        }
+        attachments.append(d->addedAttachments);
+    }
+}
+
+NoteDiff::Fields NoteDiff::merge(const NoteMessageWrapper &base, NoteMessageWrapper &local, const NoteMessageWrapper &remote)
+{
+    const NoteDiff ours = between(base, local);
+    NoteDiff theirs = between(base, remote);
+    const NoteDiffPrivate *o = ours.d.constData();
+    NoteDiffPrivate *t = theirs.d.data();
+    const Fields both = o->fields & t->fields;
+    Fields conflicts;
+
+    // A field changed on both sides is left as local has it
+    auto resolve = [&](Field field, bool same) {
+        if (both & field) {
+            t->fields.setFlag(field, false);
+            if (!same) {
+                conflicts |= field;
+            }
+        }
+    };
+    resolve(UidField, sameString(o->uid, t->uid));
+    resolve(TitleField, sameString(o->title, t->title));
+    resolve(TextField, o->textFormat == t->textFormat && sameString(o->text, t->text));
+    resolve(FromField, sameString(o->from, t->from));
+    resolve(ClassificationField, o->classification == t->classification);
+    resolve(CreationDateField, o->creationDate == t->creationDate);
+    if (both & LastModifiedField) {
+        // The later date wins, that is not a conflict
+        if (!t->lastModifiedDate.isValid() || (o->lastModifiedDate.isValid() && t->lastModifiedDate <= o->lastModifiedDate)) {
+            t->fields.setFlag(LastModifiedField, false);
+        }
+    }
+
+    if (both & CustomField) {
+        for (auto it = t->changedCustom.begin(); it != t->changedCustom.end();) {
+            const auto ourValue = o->changedCustom.constFind(it.key());
+            if (ourValue != o->changedCustom.cend()) {
+                if (!sameString(*ourValue, it.value())) {
+                    conflicts |= CustomField;
+                }
+                it = t->changedCustom.erase(it);
+            } else if (o->removedCustom.contains(it.key())) {
+                conflicts |= CustomField;
+                it = t->changedCustom.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        t->removedCustom.removeIf([o, &conflicts](const QString &key) {
+            if (o->changedCustom.contains(key)) {
+                conflicts |= CustomField;
+                return true;
+            }
+            return o->removedCustom.contains(key);
+        });
+    }
+
+    if (both & AttachmentsField) {
+        // The diffs may replace all attachments after a reorder, so they are merged from the lists
+        t->fields.setFlag(AttachmentsField, false);
+        local.attachments() = mergeAttachments(base.attachments(), local.attachments(), remote.attachments(), conflicts);
+    }
+
+    theirs.apply(local);
+    return conflicts;
+}
+}
+}
@@ -0,0 +1,159 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include "akonadi-notes_export.h"
+#include "noteutils.h"
+
+#include <QSharedDataPointer>
+#include <QStringList>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+class NoteDiffPrivate;
+
+/**
+ * @short The changes between two revisions of a note
+ *
+ * A diff holds the new values of the fields that differ between a base
+ * revision and a later one: the values of the changed custom keys and the
+ * removed keys, and the attachments added and removed. Applying it to the
+ * base gives a note with the content of the later revision.
+ *
+ * Computing a diff compares every field. A string that the revisions share
+ * through implicit sharing, e.g. because one is an edited copy of the other,
+ * is recognized without reading it, any other string is compared in full.
+ * Comparing two independently parsed revisions therefore reads all of their
+ * text and custom values, whatever changed. Attachments are compared by
+ * Attachment::digest(), which reads the data once per payload and is shared
+ * by the copies of an attachment, so diffing again later does not read the
+ * attachment data again.
+ *
+ * merge() combines the changes of two revisions made from the same base.
+ *
+ * @code
+ * const NoteUtils::NoteDiff::Fields conflicts = NoteUtils::NoteDiff::merge(base, local, remote);
+ * if (conflicts) {
+ *     // local kept its value for the conflicting fields
+ * }
+ * @endcode
+ *
+ * @since 6.3
+ */
+class AKONADI_NOTES_EXPORT NoteDiff
+{
+public:
+    enum Field {
+        NoFields = 0x000,
+        UidField = 0x001,
+        TitleField = 0x002,
+        TextField = 0x004, ///< the text and its format
+        FromField = 0x008,
+        ClassificationField = 0x010,
+        CreationDateField = 0x020,
+        LastModifiedField = 0x040,
+        CustomField = 0x080,
+        AttachmentsField = 0x100,
+    };
+    Q_DECLARE_FLAGS(Fields, Field)
+
+    /**
+     * Creates an empty diff
+     */
+    NoteDiff();
+    NoteDiff(const NoteDiff &other);
+    ~NoteDiff();
+    NoteDiff &operator=(const NoteDiff &other);
+
+    /**
+     * Returns the changes from @p base to @p revision
+     */
+    [[nodiscard]] static NoteDiff between(const NoteMessageWrapper &base, const NoteMessageWrapper &revision);
+
+    /**
+     * Returns true if there are no changes
+     */
+    [[nodiscard]] bool isEmpty() const;
+
+    /**
+     * Returns the fields that changed
+     */
+    [[nodiscard]] Fields changedFields() const;
+
+    /**
+     * The new values of the changed fields, the values are undefined for the others
+     */
+    [[nodiscard]] QString uid() const;
+    [[nodiscard]] QString title() const;
+    [[nodiscard]] QString text() const;
+    [[nodiscard]] Qt::TextFormat textFormat() const;
+    [[nodiscard]] QString from() const;
+    [[nodiscard]] NoteMessageWrapper::Classification classification() const;
+    [[nodiscard]] QDateTime creationDate() const;
+    [[nodiscard]] QDateTime lastModifiedDate() const;
+
+    /**
+     * Returns the custom values that were added or changed
+     */
+    [[nodiscard]] QMap<QString, QString> changedCustomValues() const;
+
+    /**
+     * Returns the custom keys that were removed
+     */
+    [[nodiscard]] QStringList removedCustomKeys() const;
+
+    /**
+     * Returns the attachments of the base that are not in the revision
+     *
+     * An attachment with changed data or metadata is removed and added again.
+     */
+    [[nodiscard]] QList<Attachment> removedAttachments() const;
+
+    /**
+     * Returns the attachments of the revision that are not in the base
+     *
+     * Applying the diff appends them after the remaining attachments. If the
+     * order of the remaining attachments changed, all attachments of the base
+     * are removed and all attachments of the revision are added.
+     */
+    [[nodiscard]] QList<Attachment> addedAttachments() const;
+
+    /**
+     * Applies the changes to @p note
+     *
+     * For each removed attachment the first equal one is removed from @p note,
+     * if there is one.
+     */
+    void apply(NoteMessageWrapper &note) const;
+
+    /**
+     * Merges the changes from @p base to @p remote into @p local, which was also made from @p base
+     *
+     * A field changed on one side takes the value of that side. Custom values
+     * are merged per key, the last modified date becomes the later one.
+     * Attachments are merged per attachment of @p base: one removed on either
+     * side is removed once, ones added on either side are added once, and the
+     * order of a side that only reordered them is kept. A field changed on
+     * both sides to different values is a conflict, as are attachments
+     * reordered differently on both sides. @p local keeps its value then.
+     * Swap @p local and @p remote to resolve conflicts the other way.
+     *
+     * @return the conflicting fields
+     */
+    static Fields merge(const NoteMessageWrapper &base, NoteMessageWrapper &local, const NoteMessageWrapper &remote);
+
+private:
+    //@cond PRIVATE
+    QSharedDataPointer<NoteDiffPrivate> d;
+    //@endcond
+};
+}
+}
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(Akonadi::NoteUtils::NoteDiff::Fields)
@@ -0,0 +1,453 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "noteindex.h"
+#include "varint_p.h"
+
+#include <KMime/Message>
+#include <QHash>
+#include <QIODevice>
+#include <QMap>
+#include <QSet>
+#include <QTimeZone>
+
+#include <algorithm>
+#include <iterator>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+static constexpr qsizetype MaxTermLength = 64;
+
+// "AKNI" followed by the format version
+static constexpr char FormatMagic[] = {'A', 'K', 'N', 'I', 1};
+
+class NoteIndexPrivate
+{
+public:
+    struct Document {
+        // Empty for ids on the free list
+        QString uid;
+        QDateTime lastModifiedDate;
+        QStringList terms;
+    };
+    // Ascending document ids
+    using Postings = QList<quint32>;
+
+    void addDocument(const QString &uid, const QDateTime &lastModifiedDate, const QSet<QString> &terms);
+    void removeDocument(quint32 id);
+    [[nodiscard]] Postings prefixPostings(const QString &prefix) const;
+    [[nodiscard]] QStringList uidsOf(const Postings &ids) const;
+    void clear();
+
+    QList<Document> documents;
+    QList<quint32> freeIds;
+    QHash<QString, quint32> ids;
+    QMap<QString, Postings> postings;
+};
+
+static bool isWordChar(QChar c)
+{
+    // Surrogates are kept so characters outside the BMP do not split words
+    return c.isLetterOrNumber() || c.isMark() || c.isSurrogate();
+}
+
+// Calls fn(start, end) for each word of text that is not too long, or for each word at all if
+// longWords is true
+template<typename Function>
+static void forEachWord(QStringView text, Function fn, bool longWords = false)
+{
+    qsizetype start = -1;
+    for (qsizetype i = 0; i <= text.size(); ++i) {
+        if (i < text.size() && isWordChar(text[i])) {
+            if (start < 0) {
+                start = i;
+            }
+        } else if (start >= 0) {
+            if (longWords || i - start <= MaxTermLength) {
+                fn(start, i);
+            }
+            start = -1;
+        }
+    }
+}
+
+static QString foldTerm(QStringView term)
+{
+    return term.toString().toCaseFolded();
+}
+
+static void insertSorted(NoteIndexPrivate::Postings &ids, quint32 id)
+{
+    ids.insert(std::lower_bound(ids.begin(), ids.end(), id), id);
+}
+
+void NoteIndexPrivate::addDocument(const QString &uid, const QDateTime &lastModifiedDate, const QSet<QString> &terms)
+{
+    quint32 id;
+    if (freeIds.isEmpty()) {
+        id = quint32(documents.size());
+        documents.append({});
+    } else {
+        id = freeIds.takeLast();
+    }
+    Document &document = documents[id];
+    document.uid = uid;
+    document.lastModifiedDate = lastModifiedDate;
+    document.terms.reserve(terms.size());
+    for (const QString &term : terms) {
+        auto it = postings.find(term);
+        if (it == postings.end()) {
+            it = postings.insert(term, {});
+        }
+        insertSorted(*it, id);
+        // Shares the string with the key
+        document.terms.append(it.key());
+    }
+    ids.insert(uid, id);
+}
+
+void NoteIndexPrivate::removeDocument(quint32 id)
+{
+    Document &document = documents[id];
+    for (const QString &term : std::as_const(document.terms)) {
+        const auto it = postings.find(term);
+        if (it == postings.end()) {
+            continue;
+        }
+        const auto pos = std::lower_bound(it->begin(), it->end(), id);
+        if (pos != it->end() && *pos == id) {
+            it->erase(pos);
+        }
+        if (it->isEmpty()) {
+            postings.erase(it);
+        }
+    }
+    ids.remove(document.uid);
+    document = {};
+    freeIds.append(id);
+}
+
+NoteIndexPrivate::Postings NoteIndexPrivate::prefixPostings(const QString &prefix) const
+{
+    Postings result;
+    if (prefix.isEmpty()) {
+        return result;
+    }
+    for (auto it = postings.lowerBound(prefix); it != postings.cend() && it.key().startsWith(prefix); ++it) {
+        result += *it;
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+QStringList NoteIndexPrivate::uidsOf(const Postings &ids) const
+{
+    QStringList uids;
+    uids.reserve(ids.size());
+    for (quint32 id : ids) {
+        uids.append(documents.at(id).uid);
+    }
+    uids.sort();
+    return uids;
+}
+
+void NoteIndexPrivate::clear()
+{
+    documents.clear();
+    freeIds.clear();
+    ids.clear();
+    postings.clear();
+}
+
+NoteIndex::NoteIndex()
+    : d_ptr(new NoteIndexPrivate)
+{
+}
+
+NoteIndex::~NoteIndex() = default;
+
+bool NoteIndex::addNote(const NoteMessageWrapper &note)
+{
+    Q_D(NoteIndex);
+    const QString uid = note.uid();
+    const QDateTime lastModifiedDate = note.lastModifiedDate();
+    if (uid.isEmpty() || !needsUpdate(uid, lastModifiedDate)) {
+        return false;
+    }
+
+    QSet<QString> terms;
+    auto addText = [&terms](QStringView text) {
+        forEachWord(text, [&terms, text](qsizetype start, qsizetype end) {
+            terms.insert(foldTerm(text.sliced(start, end - start)));
+        });
+    };
+    addText(note.title());
+    addText(note.toPlainText());
+    for (const QString &value : note.custom()) {
+        addText(value);
+    }
+
+    const auto it = d->ids.constFind(uid);
+    if (it != d->ids.cend()) {
+        d->removeDocument(*it);
+    }
+    d->addDocument(uid, lastModifiedDate, terms);
+    return true;
+}
+
+bool NoteIndex::addNote(const KMime::MessagePtr &msg)
+{
+    if (!msg) {
+        return false;
+    }
+    // The body is only decoded if the note has to be indexed
+    return addNote(NoteMessageWrapper(msg, NoteMessageWrapper::LazyParsing));
+}
+
+bool NoteIndex::removeNote(const QString &uid)
+{
+    Q_D(NoteIndex);
+    const auto it = d->ids.constFind(uid);
+    if (it == d->ids.cend()) {
+        return false;
+    }
+    d->removeDocument(*it);
+    return true;
+}
+
+bool NoteIndex::needsUpdate(const QString &uid, const QDateTime &lastModifiedDate) const
+{
+    Q_D(const NoteIndex);
+    if (!lastModifiedDate.isValid()) {
+        // Without a date revisions cannot be told apart
+        return true;
+    }
+    const auto it = d->ids.constFind(uid);
+    return it == d->ids.cend() || d->documents.at(*it).lastModifiedDate != lastModifiedDate;
+}
+
+bool NoteIndex::contains(const QString &uid) const
+{
+    Q_D(const NoteIndex);
+    return d->ids.contains(uid);
+}
+
+QDateTime NoteIndex::lastModifiedDate(const QString &uid) const
+{
+    Q_D(const NoteIndex);
+    const auto it = d->ids.constFind(uid);
+    return it == d->ids.cend() ? QDateTime() : d->documents.at(*it).lastModifiedDate;
+}
+
+QStringList NoteIndex::uids() const
+{
+    Q_D(const NoteIndex);
+    QStringList uids = d->ids.keys();
+    uids.sort();
+    return uids;
+}
+
+qsizetype NoteIndex::count() const
+{
+    Q_D(const NoteIndex);
+    return d->ids.size();
+}
+
+qsizetype NoteIndex::termCount() const
+{
+    Q_D(const NoteIndex);
+    return d->postings.size();
+}
+
+void NoteIndex::clear()
+{
+    Q_D(NoteIndex);
+    d->clear();
+}
+
+QStringList NoteIndex::find(const QString &term) const
+{
+    Q_D(const NoteIndex);
+    return d->uidsOf(d->postings.value(foldTerm(term)));
+}
+
+QStringList NoteIndex::findPrefix(const QString &prefix) const
+{
+    Q_D(const NoteIndex);
+    return d->uidsOf(d->prefixPostings(foldTerm(prefix)));
+}
+
+QStringList NoteIndex::search(const QString &query) const
+{
+    Q_D(const NoteIndex);
+    QList<NoteIndexPrivate::Postings> lists;
+    forEachWord(
+        query,
+        [&](qsizetype start, qsizetype end) {
+            if (end - start > MaxTermLength) {
+                // Not indexed, so no note matches it
+                lists.append(NoteIndexPrivate::Postings());
+                return;
+            }
+            const QString term = foldTerm(QStringView(query).sliced(start, end - start));
+            const bool prefix = end < query.size() && query.at(end) == QLatin1Char('*');
+            lists.append(prefix ? d->prefixPostings(term) : d->postings.value(term));
+        },
+        true);
+    if (lists.isEmpty()) {
+        return {};
+    }
+
+    // Starting with the shortest list keeps the intersections small
+    std::sort(lists.begin(), lists.end(), [](const auto &a, const auto &b) {
+        return a.size() < b.size();
+    });
+    NoteIndexPrivate::Postings result = lists.takeFirst();
+    for (const NoteIndexPrivate::Postings &ids : std::as_const(lists)) {
+        if (result.isEmpty()) {
+            break;
+        }
+        NoteIndexPrivate::Postings intersection;
+        std::set_intersection(result.cbegin(), result.cend(), ids.cbegin(), ids.cend(), std::back_inserter(intersection));
+        result = std::move(intersection);
+    }
+    return d->uidsOf(result);
+}
+
+QStringList NoteIndex::tokenize(QStringView text)
+{
+    QStringList words;
+    forEachWord(text, [&words, text](qsizetype start, qsizetype end) {
+        words.append(foldTerm(text.sliced(start, end - start)));
+    });
+    return words;
+}
+
+// The format, all numbers are LEB128 varints:
+//   magic, document count, per document: uid as UTF-8 bytes and 0 or 1 + zigzag coded
+//   msecs since epoch of the last modified date,
+//   term count, per term in ascending order: bytes shared with the previous term,
+//   the UTF-8 bytes that follow them, posting count and the deltas of the document
+//   numbers, the first one relative to 0.
+bool NoteIndex::writeTo(QIODevice *device) const
+{
+    Q_D(const NoteIndex);
+    QByteArray data;
+    data.append(FormatMagic, sizeof(FormatMagic));
+
+    // Documents are numbered without the free ids, in the same order
+    QList<quint32> numbers(d->documents.size());
+    Varint::write(data, d->ids.size());
+    quint32 number = 0;
+    for (qsizetype id = 0; id < d->documents.size(); ++id) {
+        const NoteIndexPrivate::Document &document = d->documents.at(id);
+        if (document.uid.isEmpty()) {
+            continue;
+        }
+        numbers[id] = number++;
+        Varint::writeBytes(data, document.uid.toUtf8());
+        if (document.lastModifiedDate.isValid()) {
+            Varint::write(data, Varint::zigzag(document.lastModifiedDate.toMSecsSinceEpoch()) + 1);
+        } else {
+            Varint::write(data, 0);
+        }
+    }
+
+    Varint::write(data, d->postings.size());
+    QByteArray previous;
+    for (auto it = d->postings.cbegin(), end = d->postings.cend(); it != end; ++it) {
+        const QByteArray term = it.key().toUtf8();
+        const qsizetype shared = std::mismatch(previous.cbegin(), previous.cend(), term.cbegin(), term.cend()).first - previous.cbegin();
+        Varint::write(data, shared);
+        Varint::writeBytes(data, QByteArrayView(term).sliced(shared));
+        Varint::write(data, it->size());
+        quint32 last = 0;
+        for (quint32 id : *it) {
+            Varint::write(data, numbers.at(id) - last);
+            last = numbers.at(id);
+        }
+        previous = term;
+    }
+    return device->write(data) == data.size();
+}
+
+bool NoteIndex::readFrom(QIODevice *device)
+{
+    Q_D(NoteIndex);
+    d->clear();
+    const QByteArray data = device->readAll();
+    Varint::Reader reader(data);
+    auto fail = [d] {
+        d->clear();
+        return false;
+    };
+    if (reader.bytes(sizeof(FormatMagic)).compare(QByteArrayView(FormatMagic, sizeof(FormatMagic))) != 0) {
+        return fail();
+    }
+
+    // Each document takes at least two bytes, which bounds the count before anything is allocated
+    const quint64 documentCount = reader.varint();
+    if (documentCount > quint64(data.size()) / 2) {
+        return fail();
+    }
+    d->documents.reserve(qsizetype(documentCount));
+    for (quint64 i = 0; i < documentCount; ++i) {
+        const QString uid = QString::fromUtf8(reader.bytes());
+        const quint64 date = reader.varint();
+        if (reader.failed() || uid.isEmpty() || d->ids.contains(uid)) {
+            return fail();
+        }
+        QDateTime lastModifiedDate;
+        if (date > 0) {
+            lastModifiedDate = QDateTime::fromMSecsSinceEpoch(Varint::unzigzag(date - 1), QTimeZone::utc());
+        }
+        d->ids.insert(uid, quint32(i));
+        d->documents.append({uid, lastModifiedDate, {}});
+    }
+
+    const quint64 termCount = reader.varint();
+    if (termCount > quint64(data.size())) {
+        return fail();
+    }
+    QByteArray previous;
+    QString previousTerm;
+    for (quint64 i = 0; i < termCount; ++i) {
+        const quint64 shared = reader.varint();
+        if (shared > quint64(previous.size())) {
+            return fail();
+        }
+        const QByteArray bytes = previous.first(qsizetype(shared)) + reader.bytes();
+        const QString term = QString::fromUtf8(bytes);
+        const quint64 postingCount = reader.varint();
+        if (reader.failed() || term.isEmpty() || (i > 0 && !(previousTerm < term)) || postingCount == 0 || postingCount > documentCount) {
+            return fail();
+        }
+        NoteIndexPrivate::Postings ids;
+        ids.reserve(qsizetype(postingCount));
+        quint64 id = 0;
+        for (quint64 j = 0; j < postingCount; ++j) {
+            const quint64 delta = reader.varint();
+            id += delta;
+            if (reader.failed() || (j > 0 && delta == 0) || id >= documentCount) {
+                return fail();
+            }
+            ids.append(quint32(id));
+            d->documents[qsizetype(id)].terms.append(term);
+        }
+        d->postings.insert(d->postings.cend(), term, ids);
+        previous = bytes;
+        previousTerm = term;
+    }
+    if (!reader.atEnd()) {
+        return fail();
+    }
+    return true;
+}
+}
+}
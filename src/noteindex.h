@@ -0,0 +1,156 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include "akonadi-notes_export.h"
+#include "noteutils.h"
+
+#include <QStringList>
+
+#include <memory>
+
+class QIODevice;
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+class NoteIndexPrivate;
+
+/**
+ * @short Full-text index over a collection of notes
+ *
+ * Maps the words of the title, the plain text and the custom values of each
+ * note to the uids of the notes containing them, so a search does not have to
+ * parse and scan every note. Words are runs of letters and digits compared
+ * case-insensitively, see tokenize().
+ *
+ * A note is indexed under its uid, adding a revision with another last
+ * modified date replaces the words of the previous one. needsUpdate() tells
+ * whether a note has to be read at all. A note without a last modified date
+ * is indexed again each time it is added. The index can be saved with writeTo()
+ * and loaded with readFrom() instead of being built again at startup.
+ *
+ * Const methods may be called from several threads at once, the others need
+ * exclusive access.
+ *
+ * @code
+ * NoteUtils::NoteIndex index;
+ * for (const Akonadi::Item &item : items) {
+ *     index.addNote(item.payload<KMime::MessagePtr>());
+ * }
+ * const QStringList uids = index.search(QStringLiteral("shopping lis*"));
+ * @endcode
+ *
+ * @since 6.3
+ */
+class AKONADI_NOTES_EXPORT NoteIndex
+{
+public:
+    NoteIndex();
+    ~NoteIndex();
+
+    /**
+     * Indexes @p note under its uid, replacing the revision indexed before
+     *
+     * @return false if the note has no uid, or if the indexed revision has the
+     *         same valid last modified date and nothing was changed
+     */
+    bool addNote(const NoteMessageWrapper &note);
+
+    /**
+     * Indexes the note in @p msg
+     *
+     * Only the headers are decoded if the indexed revision is up to date. As
+     * KMime creates missing headers on access, @p msg must not be used by
+     * another thread meanwhile.
+     */
+    bool addNote(const KMime::MessagePtr &msg);
+
+    /**
+     * Removes the note with @p uid, returns false if it is not indexed
+     */
+    bool removeNote(const QString &uid);
+
+    /**
+     * Returns true if the note with @p uid is not indexed, or indexed with
+     * another last modified date than @p lastModifiedDate, or if
+     * @p lastModifiedDate is invalid
+     */
+    [[nodiscard]] bool needsUpdate(const QString &uid, const QDateTime &lastModifiedDate) const;
+
+    [[nodiscard]] bool contains(const QString &uid) const;
+
+    /**
+     * Returns the last modified date of the indexed revision of the note with @p uid
+     */
+    [[nodiscard]] QDateTime lastModifiedDate(const QString &uid) const;
+
+    /**
+     * Returns the uids of all indexed notes
+     */
+    [[nodiscard]] QStringList uids() const;
+
+    /**
+     * Returns the number of indexed notes
+     */
+    [[nodiscard]] qsizetype count() const;
+
+    /**
+     * Returns the number of distinct words
+     */
+    [[nodiscard]] qsizetype termCount() const;
+
+    void clear();
+
+    /**
+     * Returns the uids of the notes containing the word @p term, sorted
+     */
+    [[nodiscard]] QStringList find(const QString &term) const;
+
+    /**
+     * Returns the uids of the notes containing a word that starts with @p prefix, sorted
+     */
+    [[nodiscard]] QStringList findPrefix(const QString &prefix) const;
+
+    /**
+     * Returns the uids of the notes containing all words of @p query, sorted
+     *
+     * A word directly followed by '*' matches as a prefix. An empty query
+     * matches nothing.
+     */
+    [[nodiscard]] QStringList search(const QString &query) const;
+
+    /**
+     * Splits @p text into the words the index is made of
+     *
+     * A word is a run of letters, marks and digits, case folded. Words longer
+     * than 64 characters are dropped.
+     */
+    [[nodiscard]] static QStringList tokenize(QStringView text);
+
+    /**
+     * Writes the index in a compact binary form to @p device
+     */
+    bool writeTo(QIODevice *device) const;
+
+    /**
+     * Replaces the index with the one read from @p device
+     *
+     * @return false and leaves the index empty if the data is not a valid index
+     */
+    bool readFrom(QIODevice *device);
+
+private:
+    //@cond PRIVATE
+    Q_DISABLE_COPY(NoteIndex)
+    std::unique_ptr<NoteIndexPrivate> const d_ptr;
+    Q_DECLARE_PRIVATE(NoteIndex)
+    //@endcond
+};
+}
+}
@@ -0,0 +1,654 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "notesnapshot.h"
+
+#include <KLocalizedString>
+#include <QBuffer>
+#include <QFile>
+#include <QSysInfo>
+#include <QTimeZone>
+#include <QUrl>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+// The file is a header followed by the note, custom value and attachment
+// records, the UTF-16 strings and the attachment data. Offsets are counted
+// from the start of the file, all values are little-endian.
+static constexpr char FormatMagic[4] = {'A', 'K', 'N', 'S'};
+static constexpr quint32 FormatVersion = 1;
+
+struct FileHeader {
+    char magic[4];
+    quint32 version;
+    quint64 fileSize;
+    quint32 noteCount;
+    quint32 reserved;
+    quint64 notesOffset;
+};
+
+struct StringRef {
+    quint64 offset;
+    // In UTF-16 code units
+    quint32 length;
+    quint32 reserved;
+};
+
+struct DateRecord {
+    qint64 msecsSinceEpoch;
+    qint32 offsetFromUtc;
+    quint32 valid;
+};
+
+struct NoteRecord {
+    StringRef uid;
+    StringRef title;
+    StringRef text;
+    StringRef from;
+    DateRecord creationDate;
+    DateRecord lastModifiedDate;
+    quint64 customOffset;
+    quint32 customCount;
+    quint32 attachmentCount;
+    quint64 attachmentsOffset;
+    quint8 classification;
+    quint8 textFormat;
+    quint8 reserved[6];
+};
+
+struct CustomRecord {
+    StringRef key;
+    StringRef value;
+};
+
+struct AttachmentRecord {
+    enum Flags : quint32 {
+        HasData = 1,
+        DataBase64Encoded = 2,
+    };
+
+    StringRef url;
+    StringRef mimetype;
+    StringRef label;
+    StringRef contentID;
+    quint64 dataOffset;
+    quint64 dataSize;
+    quint32 flags;
+    quint32 reserved;
+};
+
+static_assert(sizeof(FileHeader) == 32);
+static_assert(sizeof(NoteRecord) == 128);
+static_assert(sizeof(CustomRecord) == 32);
+static_assert(sizeof(AttachmentRecord) == 80);
+
+class NoteSnapshotPrivate
+{
+public:
+    [[nodiscard]] bool validate();
+    void reset();
+
+    template<typename Record>
+    [[nodiscard]] Record record(quint64 offset) const
+    {
+        Record r;
+        memcpy(&r, base + offset, sizeof(Record));
+        return r;
+    }
+
+    [[nodiscard]] NoteRecord note(qsizetype index) const
+    {
+        Q_ASSERT(index >= 0 && index < noteCount);
+        return record<NoteRecord>(notesOffset + quint64(index) * sizeof(NoteRecord));
+    }
+
+    [[nodiscard]] QStringView string(const StringRef &ref) const
+    {
+        return QStringView(reinterpret_cast<const char16_t *>(base + ref.offset), ref.length);
+    }
+
+    [[nodiscard]] bool isValid(const StringRef &ref) const;
+
+    std::unique_ptr<QFile> file;
+    QByteArray data;
+    const uchar *base = nullptr;
+    quint64 size = 0;
+    quint64 notesOffset = 0;
+    qsizetype noteCount = 0;
+    QString errorString;
+};
+
+static bool inRange(quint64 offset, quint64 length, quint64 size)
+{
+    return offset <= size && length <= size - offset;
+}
+
+static bool recordsInRange(quint64 offset, quint64 count, quint64 recordSize, quint64 size)
+{
+    return offset % 8 == 0 && offset <= size && count <= (size - offset) / recordSize;
+}
+
+bool NoteSnapshotPrivate::isValid(const StringRef &ref) const
+{
+    return ref.offset % 2 == 0 && inRange(ref.offset, quint64(ref.length) * 2, size);
+}
+
+static DateRecord toRecord(const QDateTime &date)
+{
+    DateRecord r{};
+    if (date.isValid()) {
+        r.msecsSinceEpoch = date.toMSecsSinceEpoch();
+        r.offsetFromUtc = date.offsetFromUtc();
+        r.valid = 1;
+    }
+    return r;
+}
+
+static QDateTime fromRecord(const DateRecord &r)
+{
+    if (!r.valid) {
+        return {};
+    }
+    const QTimeZone zone = r.offsetFromUtc == 0 ? QTimeZone::utc() : QTimeZone::fromSecondsAheadOfUtc(r.offsetFromUtc);
+    return QDateTime::fromMSecsSinceEpoch(r.msecsSinceEpoch, zone);
+}
+
+bool NoteSnapshotPrivate::validate()
+{
+    auto fail = [this](const QString &reason) {
+        errorString = reason;
+        return false;
+    };
+
+    if (QSysInfo::ByteOrder != QSysInfo::LittleEndian) {
+        return fail(i18n("Snapshots are only supported on little-endian hosts"));
+    }
+    if (size < sizeof(FileHeader)) {
+        return fail(i18n("Snapshot is truncated"));
+    }
+    if (quintptr(base) % 8 != 0) {
+        return fail(i18n("Snapshot data is not aligned"));
+    }
+    const auto header = record<FileHeader>(0);
+    if (memcmp(header.magic, FormatMagic, sizeof(FormatMagic)) != 0) {
+        return fail(i18n("Not a note snapshot"));
+    }
+    if (header.version != FormatVersion) {
+        return fail(i18n("Unsupported snapshot version"));
+    }
+    if (header.fileSize != size) {
+        return fail(i18n("Snapshot is truncated"));
+    }
+    if (!recordsInRange(header.notesOffset, header.noteCount, sizeof(NoteRecord), size)) {
+        return fail(i18n("Note records out of range"));
+    }
+    notesOffset = header.notesOffset;
+    noteCount = header.noteCount;
+
+    // Check everything the accessors rely on, so they do not have to
+    QStringView previousUid;
+    for (qsizetype i = 0; i < noteCount; ++i) {
+        const NoteRecord r = note(i);
+        if (!isValid(r.uid) || !isValid(r.title) || !isValid(r.text) || !isValid(r.from)) {
+            return fail(i18n("Note string out of range"));
+        }
+        if (r.classification > NoteMessageWrapper::Confidential || r.textFormat > Qt::MarkdownText) {
+            return fail(i18n("Invalid note field"));
+        }
+        const QStringView uid = string(r.uid);
+        if (i > 0 && previousUid.compare(uid) > 0) {
+            return fail(i18n("Notes are not sorted"));
+        }
+        previousUid = uid;
+
+        if (!recordsInRange(r.customOffset, r.customCount, sizeof(CustomRecord), size)) {
+            return fail(i18n("Custom records out of range"));
+        }
+        for (quint32 j = 0; j < r.customCount; ++j) {
+            const auto custom = record<CustomRecord>(r.customOffset + quint64(j) * sizeof(CustomRecord));
+            if (!isValid(custom.key) || !isValid(custom.value)) {
+                return fail(i18n("Custom string out of range"));
+            }
+        }
+
+        if (!recordsInRange(r.attachmentsOffset, r.attachmentCount, sizeof(AttachmentRecord), size)) {
+            return fail(i18n("Attachment records out of range"));
+        }
+        for (quint32 j = 0; j < r.attachmentCount; ++j) {
+            const auto a = record<AttachmentRecord>(r.attachmentsOffset + quint64(j) * sizeof(AttachmentRecord));
+            if (!isValid(a.url) || !isValid(a.mimetype) || !isValid(a.label) || !isValid(a.contentID)) {
+                return fail(i18n("Attachment string out of range"));
+            }
+            if ((a.flags & AttachmentRecord::HasData) && !inRange(a.dataOffset, a.dataSize, size)) {
+                return fail(i18n("Attachment data out of range"));
+            }
+        }
+    }
+    errorString.clear();
+    return true;
+}
+
+void NoteSnapshotPrivate::reset()
+{
+    base = nullptr;
+    size = 0;
+    notesOffset = 0;
+    noteCount = 0;
+    data.clear();
+    file.reset();
+}
+
+// Assigns the offsets of the variable sized parts while the records are built
+class SnapshotLayout
+{
+public:
+    StringRef addString(const QString &s)
+    {
+        StringRef ref{};
+        ref.offset = stringsSize;
+        ref.length = quint32(s.size());
+        stringsSize += quint64(s.size()) * 2;
+        strings.append(s);
+        return ref;
+    }
+
+    quint64 addData(qsizetype size)
+    {
+        const quint64 offset = dataSize;
+        dataSize += quint64(size);
+        return offset;
+    }
+
+    QList<QString> strings;
+    quint64 stringsSize = 0;
+    quint64 dataSize = 0;
+};
+
+static bool writeRecord(QIODevice *device, const void *record, qint64 size)
+{
+    return size == 0 || device->write(static_cast<const char *>(record), size) == size;
+}
+
+static bool writePadding(QIODevice *device, quint64 size)
+{
+    static constexpr char zeros[8] = {};
+    Q_ASSERT(size < sizeof(zeros));
+    return writeRecord(device, zeros, qint64(size));
+}
+
+static quint64 padding(quint64 offset)
+{
+    return (8 - offset % 8) % 8;
+}
+
+// Reads the data of an attachment as data() returns it, without copying or decoding all of it at once
+static std::unique_ptr<QIODevice> openData(const Attachment &a)
+{
+    if (!a.dataBase64Encoded()) {
+        return a.open();
+    }
+    // open() would decode data set with Attachment::setDataBase64Encoded(), which is stored as it is
+    auto buffer = std::make_unique<QBuffer>();
+    buffer->setData(a.data());
+    buffer->open(QIODevice::ReadOnly);
+    return buffer;
+}
+
+// Copies exactly size bytes from source to device
+static bool copyData(QIODevice *device, QIODevice *source, quint64 size)
+{
+    QByteArray chunk(64 * 1024, Qt::Uninitialized);
+    quint64 copied = 0;
+    qint64 read;
+    while ((read = source->read(chunk.data(), chunk.size())) > 0) {
+        copied += quint64(read);
+        if (copied > size || !writeRecord(device, chunk.constData(), read)) {
+            return false;
+        }
+    }
+    return read == 0 && copied == size;
+}
+
+NoteSnapshot::NoteSnapshot()
+    : d_ptr(new NoteSnapshotPrivate)
+{
+}
+
+NoteSnapshot::~NoteSnapshot() = default;
+
+bool NoteSnapshot::write(QIODevice *device, const QList<const NoteMessageWrapper *> &notes, AttachmentDataMode mode)
+{
+    if (QSysInfo::ByteOrder != QSysInfo::LittleEndian || !device || !device->isWritable() || notes.size() > std::numeric_limits<quint32>::max()) {
+        return false;
+    }
+
+    QList<QString> uids;
+    uids.reserve(notes.size());
+    for (const NoteMessageWrapper *note : notes) {
+        uids.append(note->uid());
+    }
+    QList<qsizetype> order(notes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&uids](qsizetype a, qsizetype b) {
+        return uids[a] < uids[b];
+    });
+
+    // Build all records, with string and data offsets relative to their section
+    SnapshotLayout layout;
+    QList<NoteRecord> noteRecords;
+    QList<CustomRecord> customRecords;
+    QList<AttachmentRecord> attachmentRecords;
+    // The payloads are read again when the data section is written, one at a time
+    QList<std::pair<const Attachment *, quint64>> attachmentData;
+    noteRecords.reserve(notes.size());
+    for (const qsizetype index : std::as_const(order)) {
+        const NoteMessageWrapper &note = *notes[index];
+        NoteRecord r{};
+        r.uid = layout.addString(uids[index]);
+        r.title = layout.addString(note.title());
+        r.text = layout.addString(note.text());
+        r.from = layout.addString(note.from());
+        r.creationDate = toRecord(note.creationDate());
+        r.lastModifiedDate = toRecord(note.lastModifiedDate());
+        r.classification = quint8(note.classification());
+        r.textFormat = quint8(note.textFormat());
+
+        r.customOffset = quint64(customRecords.size()) * sizeof(CustomRecord);
+        const QMap<QString, QString> &custom = note.custom();
+        r.customCount = quint32(custom.size());
+        for (auto it = custom.cbegin(); it != custom.cend(); ++it) {
+            customRecords.append({layout.addString(it.key()), layout.addString(it.value())});
+        }
+
+        r.attachmentsOffset = quint64(attachmentRecords.size()) * sizeof(AttachmentRecord);
+        r.attachmentCount = quint32(note.attachments().size());
+        for (const Attachment &a : note.attachments()) {
+            AttachmentRecord ar{};
+            ar.url = layout.addString(a.url().isValid() ? a.url().toString() : QString());
+            ar.mimetype = layout.addString(a.mimetype());
+            ar.label = layout.addString(a.label());
+            ar.contentID = layout.addString(a.contentID());
+            if (!a.url().isValid() && mode == WithAttachmentData) {
+                // Known without decoding the data, which is only read when it is copied
+                const qint64 size = openData(a)->size();
+                ar.flags |= AttachmentRecord::HasData;
+                ar.dataSize = quint64(size);
+                ar.dataOffset = layout.addData(size);
+                attachmentData.append({&a, quint64(size)});
+            }
+            if (a.dataBase64Encoded()) {
+                ar.flags |= AttachmentRecord::DataBase64Encoded;
+            }
+            attachmentRecords.append(ar);
+        }
+        noteRecords.append(r);
+    }
+
+    FileHeader header{};
+    memcpy(header.magic, FormatMagic, sizeof(FormatMagic));
+    header.version = FormatVersion;
+    header.noteCount = quint32(noteRecords.size());
+    header.notesOffset = sizeof(FileHeader);
+    const quint64 customOffset = header.notesOffset + quint64(noteRecords.size()) * sizeof(NoteRecord);
+    const quint64 attachmentsOffset = customOffset + quint64(customRecords.size()) * sizeof(CustomRecord);
+    const quint64 stringsOffset = attachmentsOffset + quint64(attachmentRecords.size()) * sizeof(AttachmentRecord);
+    const quint64 stringsPadding = padding(layout.stringsSize);
+    const quint64 dataOffset = stringsOffset + layout.stringsSize + stringsPadding;
+    header.fileSize = dataOffset + layout.dataSize;
+
+    auto relocate = [stringsOffset](StringRef &ref) {
+        ref.offset += stringsOffset;
+    };
+    for (NoteRecord &r : noteRecords) {
+        relocate(r.uid);
+        relocate(r.title);
+        relocate(r.text);
+        relocate(r.from);
+        r.customOffset += customOffset;
+        r.attachmentsOffset += attachmentsOffset;
+    }
+    for (CustomRecord &r : customRecords) {
+        relocate(r.key);
+        relocate(r.value);
+    }
+    for (AttachmentRecord &r : attachmentRecords) {
+        relocate(r.url);
+        relocate(r.mimetype);
+        relocate(r.label);
+        relocate(r.contentID);
+        if (r.flags & AttachmentRecord::HasData) {
+            r.dataOffset += dataOffset;
+        }
+    }
+
+    if (!writeRecord(device, &header, sizeof(header)) || !writeRecord(device, noteRecords.constData(), noteRecords.size() * qint64(sizeof(NoteRecord)))
+        || !writeRecord(device, customRecords.constData(), customRecords.size() * qint64(sizeof(CustomRecord)))
+        || !writeRecord(device, attachmentRecords.constData(), attachmentRecords.size() * qint64(sizeof(AttachmentRecord)))) {
+        return false;
+    }
+    for (const QString &s : std::as_const(layout.strings)) {
+        if (!writeRecord(device, s.utf16(), s.size() * 2)) {
+            return false;
+        }
+    }
+    if (!writePadding(device, stringsPadding)) {
+        return false;
+    }
+    for (const auto &[attachment, size] : std::as_const(attachmentData)) {
+        if (!copyData(device, openData(*attachment).get(), size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NoteSnapshot::load(const QString &fileName)
+{
+    Q_D(NoteSnapshot);
+    d->reset();
+    auto file = std::make_unique<QFile>(fileName);
+    if (!file->open(QIODevice::ReadOnly)) {
+        d->errorString = file->errorString();
+        return false;
+    }
+    d->size = quint64(file->size());
+    if (d->size > 0) {
+        d->base = file->map(0, file->size());
+        if (!d->base) {
+            d->errorString = file->errorString();
+            d->reset();
+            return false;
+        }
+    }
+    d->file = std::move(file);
+    if (!d->validate()) {
+        d->reset();
+        return false;
+    }
+    return true;
+}
+
+bool NoteSnapshot::load(const QByteArray &data)
+{
+    Q_D(NoteSnapshot);
+    d->reset();
+    d->data = data;
+    d->base = reinterpret_cast<const uchar *>(d->data.constData());
+    d->size = quint64(d->data.size());
+    if (!d->validate()) {
+        d->reset();
+        return false;
+    }
+    return true;
+}
+
+bool NoteSnapshot::isValid() const
+{
+    Q_D(const NoteSnapshot);
+    return d->base != nullptr;
+}
+
+QString NoteSnapshot::errorString() const
+{
+    Q_D(const NoteSnapshot);
+    return d->errorString;
+}
+
+qsizetype NoteSnapshot::count() const
+{
+    Q_D(const NoteSnapshot);
+    return d->noteCount;
+}
+
+qsizetype NoteSnapshot::indexOf(QStringView uid) const
+{
+    Q_D(const NoteSnapshot);
+    qsizetype low = 0;
+    qsizetype high = d->noteCount;
+    while (low < high) {
+        const qsizetype mid = low + (high - low) / 2;
+        if (d->string(d->note(mid).uid).compare(uid) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < d->noteCount && d->string(d->note(low).uid).compare(uid) == 0) {
+        return low;
+    }
+    return -1;
+}
+
+QStringView NoteSnapshot::uid(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return d->string(d->note(index).uid);
+}
+
+QStringView NoteSnapshot::title(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return d->string(d->note(index).title);
+}
+
+QStringView NoteSnapshot::text(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return d->string(d->note(index).text);
+}
+
+Qt::TextFormat NoteSnapshot::textFormat(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return Qt::TextFormat(d->note(index).textFormat);
+}
+
+QStringView NoteSnapshot::from(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return d->string(d->note(index).from);
+}
+
+QDateTime NoteSnapshot::creationDate(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return fromRecord(d->note(index).creationDate);
+}
+
+QDateTime NoteSnapshot::lastModifiedDate(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return fromRecord(d->note(index).lastModifiedDate);
+}
+
+NoteMessageWrapper::Classification NoteSnapshot::classification(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return NoteMessageWrapper::Classification(d->note(index).classification);
+}
+
+qsizetype NoteSnapshot::attachmentCount(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    return d->note(index).attachmentCount;
+}
+
+bool NoteSnapshot::hasAttachmentData(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    const NoteRecord r = d->note(index);
+    for (quint32 j = 0; j < r.attachmentCount; ++j) {
+        const auto a = d->record<AttachmentRecord>(r.attachmentsOffset + quint64(j) * sizeof(AttachmentRecord));
+        if (a.url.length == 0 && !(a.flags & AttachmentRecord::HasData)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QByteArrayView NoteSnapshot::attachmentData(qsizetype index, qsizetype attachment) const
+{
+    Q_D(const NoteSnapshot);
+    const NoteRecord r = d->note(index);
+    Q_ASSERT(attachment >= 0 && attachment < qsizetype(r.attachmentCount));
+    const auto a = d->record<AttachmentRecord>(r.attachmentsOffset + quint64(attachment) * sizeof(AttachmentRecord));
+    if (!(a.flags & AttachmentRecord::HasData)) {
+        return {};
+    }
+    return QByteArrayView(d->base + a.dataOffset, qsizetype(a.dataSize));
+}
+
+NoteMessageWrapper NoteSnapshot::note(qsizetype index) const
+{
+    Q_D(const NoteSnapshot);
+    const NoteRecord r = d->note(index);
+    NoteMessageWrapper wrapper;
+    wrapper.setUid(d->string(r.uid).toString());
+    wrapper.setTitle(d->string(r.title).toString());
+    wrapper.setText(d->string(r.text).toString(), Qt::TextFormat(r.textFormat));
+    wrapper.setFrom(d->string(r.from).toString());
+    wrapper.setCreationDate(fromRecord(r.creationDate));
+    wrapper.setLastModifiedDate(fromRecord(r.lastModifiedDate));
+    wrapper.setClassification(NoteMessageWrapper::Classification(r.classification));
+
+    QMap<QString, QString> &custom = wrapper.custom();
+    for (quint32 j = 0; j < r.customCount; ++j) {
+        const auto c = d->record<CustomRecord>(r.customOffset + quint64(j) * sizeof(CustomRecord));
+        custom.insert(d->string(c.key).toString(), d->string(c.value).toString());
+    }
+
+    QList<Attachment> &attachments = wrapper.attachments();
+    attachments.reserve(r.attachmentCount);
+    for (quint32 j = 0; j < r.attachmentCount; ++j) {
+        const auto a = d->record<AttachmentRecord>(r.attachmentsOffset + quint64(j) * sizeof(AttachmentRecord));
+        const QString mimetype = d->string(a.mimetype).toString();
+        Attachment attachment;
+        if (a.url.length > 0) {
+            attachment = Attachment(QUrl(d->string(a.url).toString()), mimetype);
+        } else {
+            QByteArray data;
+            if (a.flags & AttachmentRecord::HasData) {
+                data = QByteArray(reinterpret_cast<const char *>(d->base + a.dataOffset), qsizetype(a.dataSize));
+            }
+            attachment = Attachment(std::move(data), mimetype);
+            attachment.setDataBase64Encoded(a.flags & AttachmentRecord::DataBase64Encoded);
+        }
+        attachment.setLabel(d->string(a.label).toString());
+        attachment.setContentID(d->string(a.contentID).toString());
+        attachments.append(std::move(attachment));
+    }
+    return wrapper;
+}
+}
+}
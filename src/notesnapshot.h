@@ -0,0 +1,152 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include "akonadi-notes_export.h"
+#include "noteutils.h"
+
+#include <QByteArrayView>
+#include <QStringView>
+
+#include <memory>
+
+class QIODevice;
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+class NoteSnapshotPrivate;
+
+/**
+ * @short Read-only binary snapshot of a collection of notes
+ *
+ * A snapshot holds the fields of many notes in one file: uid, title, text
+ * and its format, from, the dates, the classification, the custom values,
+ * the attachment metadata and optionally the attachment data. Loading it
+ * maps the file and only checks that its offsets are sane, the strings and
+ * the attachment data are read straight from the mapping. A collection of
+ * tens of thousands of notes is ready in milliseconds, without the KMime and
+ * custom values parse. Parsing the messages is only needed if load() fails,
+ * for example after the format version changed.
+ *
+ * Notes are sorted by uid. The format is little-endian, snapshots cannot be
+ * loaded on big-endian hosts.
+ *
+ * @code
+ * NoteUtils::NoteSnapshot snapshot;
+ * if (!snapshot.load(cacheFile)) {
+ *     // parse the messages, then write a new snapshot
+ * }
+ * for (qsizetype i = 0; i < snapshot.count(); ++i) {
+ *     model->addNote(snapshot.uid(i).toString(), snapshot.title(i).toString());
+ * }
+ * @endcode
+ *
+ * @since 6.3
+ */
+class AKONADI_NOTES_EXPORT NoteSnapshot
+{
+public:
+    enum AttachmentDataMode {
+        WithAttachmentData, ///< store the data of inline attachments
+        WithoutAttachmentData ///< store only the metadata of the attachments
+    };
+
+    NoteSnapshot();
+    ~NoteSnapshot();
+
+    /**
+     * Writes a snapshot of @p notes to @p device
+     *
+     * The notes are stored sorted by uid and must not be modified meanwhile.
+     * The attachment data is read through Attachment::open() a chunk at a time,
+     * so it is never held in memory all at once.
+     */
+    static bool write(QIODevice *device, const QList<const NoteMessageWrapper *> &notes, AttachmentDataMode mode = WithAttachmentData);
+
+    /**
+     * Maps the snapshot file @p fileName, the file stays open until another
+     * snapshot is loaded or this one is destroyed
+     *
+     * @return false if the file cannot be mapped or is not a valid snapshot
+     */
+    bool load(const QString &fileName);
+
+    /**
+     * Uses the snapshot in @p data, which is shared, not copied
+     */
+    bool load(const QByteArray &data);
+
+    /**
+     * Returns true if a valid snapshot is loaded
+     */
+    [[nodiscard]] bool isValid() const;
+
+    /**
+     * Returns why the last load() failed
+     */
+    [[nodiscard]] QString errorString() const;
+
+    /**
+     * Returns the number of notes
+     */
+    [[nodiscard]] qsizetype count() const;
+
+    /**
+     * Returns the index of the note with @p uid, or -1
+     */
+    [[nodiscard]] qsizetype indexOf(QStringView uid) const;
+
+    /**
+     * The fields of the note at @p index
+     *
+     * The strings point into the snapshot and are valid as long as it stays loaded.
+     */
+    [[nodiscard]] QStringView uid(qsizetype index) const;
+    [[nodiscard]] QStringView title(qsizetype index) const;
+    [[nodiscard]] QStringView text(qsizetype index) const;
+    [[nodiscard]] Qt::TextFormat textFormat(qsizetype index) const;
+    [[nodiscard]] QStringView from(qsizetype index) const;
+    [[nodiscard]] QDateTime creationDate(qsizetype index) const;
+    [[nodiscard]] QDateTime lastModifiedDate(qsizetype index) const;
+    [[nodiscard]] NoteMessageWrapper::Classification classification(qsizetype index) const;
+    [[nodiscard]] qsizetype attachmentCount(qsizetype index) const;
+
+    /**
+     * Returns true if the data of all inline attachments of the note at @p index is stored
+     */
+    [[nodiscard]] bool hasAttachmentData(qsizetype index) const;
+
+    /**
+     * Returns the stored data of attachment @p attachment of the note at @p index
+     *
+     * The data points into the snapshot and is valid as long as it stays
+     * loaded. It is empty for url attachments and if the data was not stored.
+     * Data that was set with Attachment::setDataBase64Encoded() is returned as
+     * it was set.
+     */
+    [[nodiscard]] QByteArrayView attachmentData(qsizetype index, qsizetype attachment) const;
+
+    /**
+     * Returns the note at @p index with all its fields copied
+     *
+     * Inline attachments without stored data are returned empty. The
+     * attachment data is copied as well, use attachmentData() to read it
+     * without a copy.
+     */
+    [[nodiscard]] NoteMessageWrapper note(qsizetype index) const;
+
+private:
+    //@cond PRIVATE
+    Q_DISABLE_COPY(NoteSnapshot)
+    std::unique_ptr<NoteSnapshotPrivate> const d_ptr;
+    Q_DECLARE_PRIVATE(NoteSnapshot)
+    //@endcond
+};
+}
+}
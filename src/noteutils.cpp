@@ -7,14 +7,41 @@
 #include "noteutils.h"
 
 #include "akonadi_notes_debug.h"
+#include "attachmentstore_p.h"
+#include "base64_p.h"
+#include "customxml_p.h"
+#include "htmltoplaintext_p.h"
+#include "rfc2822date_p.h"
 #include <KLocalizedString>
 #include <KMime/Message>
+#include <QBuffer>
+#include <QCryptographicHash>
 #include <QDateTime>
+#include <QDir>
+#include <QHash>
+#include <QIODevice>
+#include <QMutex>
+#include <QSet>
 
-#include <QRegularExpression>
 #include <QString>
+#include <QStringDecoder>
+#include <QTemporaryFile>
+#include <QThreadPool>
+#include <QTimeZone>
+#include <QtEndian>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
 #include <QUuid>
-#include <qdom.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
 
 namespace Akonadi
 {
@@ -37,7 +64,247 @@ namespace NoteUtils
 
 #define ENCODING "utf-8"
 
-class AttachmentPrivate
+static std::atomic<qsizetype> s_attachmentSpillThreshold = 0;
+
+namespace
+{
+struct SpillDirectory {
+    QMutex mutex;
+    QString path;
+};
+}
+Q_GLOBAL_STATIC(SpillDirectory, s_spillDirectory)
+
+// Payload of an attachment in a memory mapped temporary file
+//
+// On Unix the file is closed and removed once it is mapped, the mapping keeps
+// the data alive, so spilled attachments do not use up file descriptors.
+class SpilledData
+{
+public:
+    SpilledData() = default;
+    ~SpilledData();
+
+    // Writes everything read from source to the file, returns null if nothing
+    // was read or the file cannot be written or mapped
+    static QSharedPointer<const SpilledData> create(QIODevice *source);
+
+    QByteArrayView data() const
+    {
+        return {reinterpret_cast<const char *>(mMap), mSize};
+    }
+
+private:
+    Q_DISABLE_COPY(SpilledData)
+#ifndef Q_OS_UNIX
+    QTemporaryFile mFile;
+#endif
+    uchar *mMap = nullptr;
+    qsizetype mSize = 0;
+};
+
+SpilledData::~SpilledData()
+{
+#ifdef Q_OS_UNIX
+    if (mMap) {
+        munmap(mMap, size_t(mSize));
+    }
+#endif
+}
+
+QSharedPointer<const SpilledData> SpilledData::create(QIODevice *source)
+{
+    auto spilled = QSharedPointer<SpilledData>::create();
+#ifdef Q_OS_UNIX
+    QTemporaryFile file;
+#else
+    QTemporaryFile &file = spilled->mFile;
+#endif
+    file.setFileTemplate(attachmentSpillDirectory() + QLatin1StringView("/akonadi-notes-XXXXXX"));
+    if (!file.open()) {
+        qCWarning(AKONADINOTES_LOG) << "Failed to create" << file.fileName() << file.errorString();
+        return {};
+    }
+    QByteArray chunk(64 * 1024, Qt::Uninitialized);
+    qint64 size = 0;
+    qint64 read;
+    while ((read = source->read(chunk.data(), chunk.size())) > 0) {
+        if (file.write(chunk.constData(), read) != read) {
+            qCWarning(AKONADINOTES_LOG) << "Failed to write attachment to" << file.fileName() << file.errorString();
+            return {};
+        }
+        size += read;
+    }
+    if (read < 0 || size == 0 || !file.flush()) {
+        return {};
+    }
+#ifdef Q_OS_UNIX
+    void *map = mmap(nullptr, size_t(size), PROT_READ, MAP_SHARED, file.handle(), 0);
+    if (map == MAP_FAILED) {
+        qCWarning(AKONADINOTES_LOG) << "Failed to map" << file.fileName() << qt_error_string();
+        return {};
+    }
+    spilled->mMap = static_cast<uchar *>(map);
+    spilled->mSize = size;
+    // Closes and removes the file, the mapping stays valid until it is unmapped
+    file.remove();
+#else
+    spilled->mMap = file.map(0, size);
+    if (!spilled->mMap) {
+        qCWarning(AKONADINOTES_LOG) << "Failed to map" << file.fileName() << file.errorString();
+        return {};
+    }
+    spilled->mSize = size;
+#endif
+    return spilled;
+}
+
+// Reads the payload of a file backed attachment, keeping the mapping alive
+class SpilledDataDevice : public QBuffer
+{
+public:
+    explicit SpilledDataDevice(const QSharedPointer<const SpilledData> &spilled)
+        : mSpilled(spilled)
+    {
+        setData(QByteArray::fromRawData(spilled->data().data(), spilled->data().size()));
+    }
+
+private:
+    const QSharedPointer<const SpilledData> mSpilled;
+};
+
+// Base64 encoded payload of a parsed attachment, decoded the first time the data is needed
+class EncodedPayload
+{
+public:
+    explicit EncodedPayload(const QByteArray &encoded)
+        : mEncoded(encoded)
+    {
+    }
+
+    const QByteArray &encoded() const
+    {
+        return mEncoded;
+    }
+
+    // The result stays valid as long as the payload
+    const QByteArray &decoded() const
+    {
+        const QMutexLocker locker(&mMutex);
+        if (!mIsDecoded) {
+            mDecoded = Base64::decode(mEncoded);
+            mIsDecoded = true;
+        }
+        return mDecoded;
+    }
+
+    bool isDecoded() const
+    {
+        const QMutexLocker locker(&mMutex);
+        return mIsDecoded;
+    }
+
+private:
+    const QByteArray mEncoded;
+    mutable QMutex mMutex;
+    mutable QByteArray mDecoded;
+    mutable bool mIsDecoded = false;
+};
+
+// Decodes base64 text a chunk at a time while it is read
+class Base64DecodingDevice : public QIODevice
+{
+public:
+    explicit Base64DecodingDevice(const QByteArray &encoded)
+        : mInput(encoded)
+        , mInputEnd(encoded.size())
+    {
+        // Trailing line breaks and padding must not keep atEnd() from becoming true
+        while (mInputEnd > 0 && !isBase64Char(mInput[mInputEnd - 1])) {
+            --mInputEnd;
+        }
+    }
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+
+    bool atEnd() const override
+    {
+        return mPendingPos == mPending.size() && mInputPos == mInputEnd && QIODevice::bytesAvailable() == 0;
+    }
+
+    qint64 bytesAvailable() const override
+    {
+        return mPending.size() - mPendingPos + QIODevice::bytesAvailable();
+    }
+
+    // The size of the whole decoded data, counted without decoding it. Like the decoder, it skips
+    // characters outside the alphabet and turns each of the others into 6 bits.
+    qint64 size() const override
+    {
+        if (mSize < 0) {
+            const qint64 characters = std::count_if(mInput.cbegin(), mInput.cbegin() + mInputEnd, isBase64Char);
+            mSize = characters * 6 / 8;
+        }
+        return mSize;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        qint64 read = 0;
+        while (read < maxSize) {
+            if (mPendingPos == mPending.size() && !decodeChunk()) {
+                break;
+            }
+            const qint64 length = std::min<qint64>(maxSize - read, mPending.size() - mPendingPos);
+            std::memcpy(data + read, mPending.constData() + mPendingPos, length);
+            read += length;
+            mPendingPos += length;
+        }
+        return read;
+    }
+
+    qint64 writeData(const char *, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    static bool isBase64Char(char c)
+    {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '+' || c == '/';
+    }
+
+    // Decodes the next chunk of the input, returns false at the end of the input
+    bool decodeChunk()
+    {
+        constexpr qsizetype ChunkSize = 4 * 1024;
+        while (mInputPos < mInputEnd) {
+            const qsizetype length = std::min(ChunkSize, mInputEnd - mInputPos);
+            mPending.resize(Base64::Decoder::maxDecodedSize(length));
+            mPending.truncate(mDecoder.decode(QByteArrayView(mInput).sliced(mInputPos, length), mPending.data()));
+            mPendingPos = 0;
+            mInputPos += length;
+            if (!mPending.isEmpty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const QByteArray mInput;
+    qsizetype mInputPos = 0;
+    qsizetype mInputEnd;
+    Base64::Decoder mDecoder;
+    QByteArray mPending;
+    qsizetype mPendingPos = 0;
+    mutable qint64 mSize = -1;
+};
+
+class AttachmentPrivate : public QSharedData
 {
 public:
     AttachmentPrivate(const QUrl &url, const QString &mimetype)
@@ -52,210 +319,946 @@ public:
     {
     }
 
+    AttachmentPrivate(QByteArray &&data, const QString &mimetype)
+        : mData(std::move(data))
+        , mMimetype(mimetype)
+    {
+    }
+
     AttachmentPrivate(const AttachmentPrivate &other)
+        : mUrl(other.mUrl)
+        , mData(other.mData)
+        , mSpilled(other.mSpilled)
+        , mEncoded(other.mEncoded)
+        , mStored(other.mStored)
+        , mDataBase64Encoded(other.mDataBase64Encoded)
+        , mMimetype(other.mMimetype)
+        , mLabel(other.mLabel)
+        , mContentID(other.mContentID)
+    {
+        const QMutexLocker locker(&other.mDigestMutex);
+        mDigest = other.mDigest;
+    }
+
+    // The inline data, from the mapped file if mSpilled is set or decoded from mEncoded.
+    // If mStored is set mData shares its buffer.
+    QByteArrayView payload() const
     {
-        *this = other;
+        if (mSpilled) {
+            return mSpilled->data();
+        }
+        return mEncoded ? QByteArrayView(mEncoded->decoded()) : QByteArrayView(mData);
+    }
+
+    // BLAKE2b-256 of the decoded inline data, also for data set with setDataBase64Encoded()
+    QByteArray digest() const
+    {
+        if (mStored && !mDataBase64Encoded) {
+            return mStored->digest;
+        }
+        {
+            const QMutexLocker locker(&mDigestMutex);
+            if (!mDigest.isEmpty()) {
+                return mDigest;
+            }
+        }
+        const QByteArray digest = QCryptographicHash::hash(mDataBase64Encoded ? QByteArrayView(Base64::decode(payload())) : payload(),
+                                                           QCryptographicHash::Blake2b_256);
+        const QMutexLocker locker(&mDigestMutex);
+        mDigest = digest;
+        return digest;
     }
 
     QUrl mUrl;
     QByteArray mData;
+    QSharedPointer<const SpilledData> mSpilled;
+    QSharedPointer<const EncodedPayload> mEncoded;
+    QSharedPointer<const StoredPayload> mStored;
     bool mDataBase64Encoded = false;
     QString mMimetype;
     QString mLabel;
     QString mContentID;
+
+    // Computed by digest(), the data is immutable so only setDataBase64Encoded() invalidates it.
+    // Guarded by the mutex, as copies of an attachment may be read from several threads.
+    mutable QMutex mDigestMutex;
+    mutable QByteArray mDigest;
+};
+
+// Sums up the heap blocks of implicitly shared containers, counting each block once
+class MemoryCounter
+{
+public:
+    // Raw and static data has no capacity and is not counted
+    qsizetype add(const QByteArray &array)
+    {
+        return array.capacity() ? addBlock(array.constData(), array.capacity() + 1) : 0;
+    }
+
+    qsizetype add(const QString &string)
+    {
+        return string.capacity() ? addBlock(string.constData(), (string.capacity() + 1) * qsizetype(sizeof(QChar))) : 0;
+    }
+
+private:
+    qsizetype addBlock(const void *block, qsizetype size)
+    {
+        if (mBlocks.contains(block)) {
+            return 0;
+        }
+        mBlocks.insert(block);
+        return qsizetype(sizeof(QArrayData)) + size + MallocOverhead;
+    }
+
+    static constexpr qsizetype MallocOverhead = 16;
+    QSet<const void *> mBlocks;
 };
 
+// The data of a file backed attachment is not on the heap
+static qsizetype countAttachment(MemoryCounter &counter, const AttachmentPrivate &attachment)
+{
+    qsizetype size = sizeof(AttachmentPrivate);
+    if (attachment.mSpilled) {
+        size += sizeof(SpilledData);
+    }
+    if (attachment.mStored) {
+        size += sizeof(StoredPayload) + counter.add(attachment.mStored->digest);
+    }
+    if (attachment.mEncoded) {
+        size += sizeof(EncodedPayload) + counter.add(attachment.mEncoded->encoded());
+        if (attachment.mEncoded->isDecoded()) {
+            size += counter.add(attachment.mEncoded->decoded());
+        }
+    }
+    if (attachment.mUrl.isValid()) {
+        size += 64 + attachment.mUrl.toString().size() * qsizetype(sizeof(QChar));
+    }
+    return size + counter.add(attachment.mData) + counter.add(attachment.mMimetype) + counter.add(attachment.mLabel) + counter.add(attachment.mContentID);
+}
+
 Attachment::Attachment()
-    : d_ptr(new AttachmentPrivate(QUrl(), QString()))
+    : d(new AttachmentPrivate(QUrl(), QString()))
 {
 }
 
 Attachment::Attachment(const QUrl &url, const QString &mimetype)
-    : d_ptr(new AttachmentPrivate(url, mimetype))
+    : d(new AttachmentPrivate(url, mimetype))
 {
 }
 
 Attachment::Attachment(const QByteArray &data, const QString &mimetype)
-    : d_ptr(new AttachmentPrivate(data, mimetype))
+    : d(new AttachmentPrivate(data, mimetype))
 {
 }
 
-Attachment::Attachment(const Attachment &other)
-    : d_ptr(new AttachmentPrivate(*other.d_func()))
+Attachment::Attachment(QByteArray &&data, const QString &mimetype)
+    : d(new AttachmentPrivate(std::move(data), mimetype))
 {
 }
 
+Attachment::Attachment(const Attachment &other) = default;
+
+Attachment::Attachment(Attachment &&other) noexcept = default;
+
 Attachment::~Attachment() = default;
 
 bool Attachment::operator==(const Attachment &a) const
 {
-    Q_D(const Attachment);
-    if (d->mUrl.isEmpty()) {
-        return d->mUrl == a.d_func()->mUrl && d->mDataBase64Encoded == a.d_func()->mDataBase64Encoded && d->mMimetype == a.d_func()->mMimetype
-            && d->mContentID == a.d_func()->mContentID && d->mLabel == a.d_func()->mLabel;
+    if (d == a.d) {
+        return true;
     }
-    return d->mData == a.d_func()->mData && d->mDataBase64Encoded == a.d_func()->mDataBase64Encoded && d->mMimetype == a.d_func()->mMimetype
-        && d->mContentID == a.d_func()->mContentID && d->mLabel == a.d_func()->mLabel;
+    if (!d->mUrl.isValid()) {
+        // Shared payloads are compared by their hash instead of their data
+        const bool samePayload = d->mStored && a.d->mStored ? d->mStored->digest == a.d->mStored->digest : d->payload() == a.d->payload();
+        return samePayload && d->mDataBase64Encoded == a.d->mDataBase64Encoded && d->mMimetype == a.d->mMimetype
+            && d->mContentID == a.d->mContentID && d->mLabel == a.d->mLabel;
+    }
+    return d->mUrl == a.d->mUrl && d->mDataBase64Encoded == a.d->mDataBase64Encoded && d->mMimetype == a.d->mMimetype && d->mContentID == a.d->mContentID
+        && d->mLabel == a.d->mLabel;
 }
 
-void Attachment::operator=(const Attachment &a)
-{
-    *d_ptr = *a.d_ptr;
-}
+Attachment &Attachment::operator=(const Attachment &a) = default;
+
+Attachment &Attachment::operator=(Attachment &&a) noexcept = default;
 
 QUrl Attachment::url() const
 {
-    Q_D(const Attachment);
     return d->mUrl;
 }
 
 QByteArray Attachment::data() const
 {
-    Q_D(const Attachment);
+    if (d->mSpilled) {
+        return d->mSpilled->data().toByteArray();
+    }
+    if (d->mEncoded) {
+        return d->mEncoded->decoded();
+    }
     return d->mData;
 }
 
+bool Attachment::isFileBacked() const
+{
+    return !d->mSpilled.isNull();
+}
+
+std::unique_ptr<QIODevice> Attachment::open() const
+{
+    if (d->mUrl.isValid()) {
+        return {};
+    }
+    std::unique_ptr<QIODevice> device;
+    if (d->mSpilled) {
+        device = std::make_unique<SpilledDataDevice>(d->mSpilled);
+    } else if (d->mEncoded && !d->mEncoded->isDecoded()) {
+        device = std::make_unique<Base64DecodingDevice>(d->mEncoded->encoded());
+    } else if (d->mDataBase64Encoded) {
+        device = std::make_unique<Base64DecodingDevice>(d->mData);
+    } else {
+        auto buffer = std::make_unique<QBuffer>();
+        buffer->setData(data());
+        device = std::move(buffer);
+    }
+    device->open(QIODevice::ReadOnly);
+    return device;
+}
+
 void Attachment::setDataBase64Encoded(bool encoded)
 {
-    Q_D(Attachment);
-    d->mDataBase64Encoded = true;
+    d->mDataBase64Encoded = encoded;
+    d->mDigest.clear();
 }
 
 bool Attachment::dataBase64Encoded() const
 {
-    Q_D(const Attachment);
     return d->mDataBase64Encoded;
 }
 
 void Attachment::setContentID(const QString &contentID)
 {
-    Q_D(Attachment);
     d->mContentID = contentID;
 }
 
 QString Attachment::contentID() const
 {
-    Q_D(const Attachment);
     return d->mContentID;
 }
 
 QString Attachment::mimetype() const
 {
-    Q_D(const Attachment);
     return d->mMimetype;
 }
 
 void Attachment::setLabel(const QString &label)
 {
-    Q_D(Attachment);
     d->mLabel = label;
 }
 
 QString Attachment::label() const
 {
-    Q_D(const Attachment);
     return d->mLabel;
 }
 
-class NoteMessageWrapperPrivate
+QByteArray Attachment::digest() const
+{
+    if (d->mUrl.isValid()) {
+        return {};
+    }
+    return d->digest();
+}
+
+qsizetype Attachment::estimatedMemoryUsage() const
+{
+    MemoryCounter counter;
+    return countAttachment(counter, *d);
+}
+
+static NoteMessageWrapper::Classification parseClassification(const QString &c)
+{
+    if (c == CLASSIFICATION_PRIVATE) {
+        return NoteMessageWrapper::Private;
+    } else if (c == CLASSIFICATION_CONFIDENTIAL) {
+        return NoteMessageWrapper::Confidential;
+    }
+    return NoteMessageWrapper::Public;
+}
+
+static QDateTime parseLastModifiedDate(QByteArrayView date)
+{
+    QDateTime lastModifiedDate = Rfc2822Date::parse(date);
+    if (!lastModifiedDate.isValid()) {
+        // Formats the fast parser does not handle, such as asctime() style dates
+        lastModifiedDate = QDateTime::fromString(QString::fromLatin1(date).simplified(), Qt::RFC2822Date);
+    }
+    if (!lastModifiedDate.isValid()) {
+        qCWarning(AKONADINOTES_LOG) << "failed to parse lastModifiedDate";
+    }
+    return lastModifiedDate;
+}
+
+class NoteMessageWrapperPrivate
+{
+public:
+    enum Field {
+        TitleField = 0x001,
+        TextField = 0x002,
+        TextFormatField = 0x004,
+        FromField = 0x008,
+        CreationDateField = 0x010,
+        LastModifiedField = 0x020,
+        UidField = 0x040,
+        ClassificationField = 0x080,
+        CustomField = 0x100,
+        AttachmentsField = 0x200,
+        AllFields = 0x3ff
+    };
+
+    NoteMessageWrapperPrivate() = default;
+
+    NoteMessageWrapperPrivate(const KMime::MessagePtr &msg)
+    {
+        readMimeMessage(msg);
+    }
+
+    void readMimeMessage(const KMime::MessagePtr &msg);
+
+    // Decodes the given fields from the pending message, unless that already happened
+    void load(uint fields) const
+    {
+        if (pendingFields & fields) {
+            const_cast<NoteMessageWrapperPrivate *>(this)->decodeFields(fields);
+        }
+    }
+    void decodeFields(uint fields, const std::function<bool()> &isCanceled = {});
+
+    // A field that is explicitly set must not be overwritten by a later load()
+    void markSet(uint fields)
+    {
+        pendingFields &= ~fields;
+        if (!pendingFields) {
+            pendingMessage.reset();
+        }
+    }
+
+    QString previewFromMessage(int maxChars) const;
+    NoteMemoryUsage estimatedMemoryUsage() const;
+    // Decodes the base64 payloads of parsed attachments, which are otherwise decoded on first use
+    void decodeAttachmentPayloads(const std::function<bool()> &isCanceled = {}) const;
+
+    // The values written to the message, with defaults filled in for empty fields unless canonical
+    struct MessageValues {
+        QString subject;
+        QString body;
+        QDateTime date;
+        QDateTime lastModified;
+        QString uid;
+    };
+    MessageValues messageValues(bool canonical = false) const;
+
+    // Assembles the message, all fields must be loaded. Returns null if isCanceled() returns true.
+    KMime::MessagePtr createMessage(const std::function<bool()> &isCanceled = {}) const;
+    bool writeTo(QIODevice *device, NoteMessageWrapper::SerializationMode mode) const;
+    // All fields must be loaded
+    QByteArray fingerprint() const;
+
+    // Records a problem found while decoding the message, reported by parseNotes()
+    void addError(const QString &error)
+    {
+        if (!errorString.isEmpty()) {
+            errorString += QLatin1StringView("; ");
+        }
+        errorString += error;
+    }
+
+    // Base64 body of an inline attachment, keyed by the address of its data. The entry shares the
+    // data, so the address cannot be reused by other data while the entry exists, and data that was
+    // changed or detached since has another address and is simply encoded again.
+    struct EncodedAttachment {
+        QByteArray data;
+        QByteArray body;
+    };
+    using EncodedAttachments = QHash<const char *, EncodedAttachment>;
+
+    // Bytes of base64 bodies kept for the next message(), further attachments are encoded each time
+    static constexpr qsizetype MaxKeptEncodedSize = 4 * 1024 * 1024;
+
+    KMime::Content *createCustomPart() const;
+    void parseCustomPart(KMime::Content *);
+
+    // Adds the encoded body to encoded if it is not null and fits into keptSize, to be reused from
+    // previous by the next message
+    KMime::Content *
+    createAttachmentPart(const Attachment &, const EncodedAttachments &previous, EncodedAttachments *encoded, qsizetype &keptSize) const;
+    void parseAttachmentPart(KMime::Content *);
+
+    QString uid;
+    QString title;
+    QString text;
+    QString from;
+    QDateTime creationDate;
+    QDateTime lastModifiedDate;
+    QMap<QString, QString> custom;
+    QList<Attachment> attachments;
+    NoteMessageWrapper::Classification classification = NoteMessageWrapper::Public;
+    Qt::TextFormat textFormat = Qt::PlainText;
+
+    // Message of a lazily parsed note, kept until all fields are decoded
+    KMime::MessagePtr pendingMessage;
+    uint pendingFields = 0;
+    QString errorString;
+
+    // Encoded parts of the last parsed message, and of the last assembled one if reuseEncodedParts
+    // is set. The cached copies keep the data shared, so any change to an attachment or the custom
+    // values detaches it from them. They are guarded by the mutex, as message() may be called on a
+    // note shared between threads.
+    struct EncodedParts {
+        EncodedParts() = default;
+        EncodedParts(const EncodedParts &other)
+        {
+            const QMutexLocker locker(&other.mutex);
+            attachments = other.attachments;
+            customValues = other.customValues;
+            custom = other.custom;
+        }
+
+        mutable QMutex mutex;
+        EncodedAttachments attachments;
+        QMap<QString, QString> customValues;
+        QByteArray custom;
+    };
+    mutable EncodedParts encodedParts;
+    bool reuseEncodedParts = true;
+};
+
+void NoteMessageWrapperPrivate::readMimeMessage(const KMime::MessagePtr &msg)
+{
+    if (!msg.data()) {
+        qCWarning(AKONADINOTES_LOG) << "Empty message";
+        addError(i18n("Empty message"));
+        return;
+    }
+    pendingMessage = msg;
+    pendingFields = AllFields;
+    decodeFields(AllFields);
+}
+
+void NoteMessageWrapperPrivate::decodeFields(uint fields, const std::function<bool()> &isCanceled)
+{
+    fields &= pendingFields;
+    const KMime::MessagePtr msg = pendingMessage;
+    markSet(fields);
+
+    if (fields & TitleField) {
+        title = msg->subject(true)->asUnicodeString();
+    }
+    if (fields & TextField) {
+        text = msg->mainBodyPart()->decodedText(true); // remove trailing whitespace, so we get rid of "  " in empty notes
+    }
+    if ((fields & FromField) && msg->from(false)) {
+        from = msg->from(false)->asUnicodeString();
+    }
+    if (fields & CreationDateField) {
+        creationDate = msg->date(true)->dateTime();
+    }
+    if (fields & TextFormatField) {
+        if (msg->mainBodyPart()->contentType(false) && msg->mainBodyPart()->contentType()->mimeType() == "text/html") {
+            textFormat = Qt::RichText;
+        }
+    }
+
+    if (fields & LastModifiedField) {
+        if (KMime::Headers::Base *lastmod = msg->headerByType(X_NOTES_LASTMODIFIED_HEADER)) {
+            lastModifiedDate = parseLastModifiedDate(lastmod->as7BitString(false));
+            if (!lastModifiedDate.isValid()) {
+                addError(i18n("Invalid last modified date"));
+            }
+        }
+    }
+
+    if (fields & UidField) {
+        if (KMime::Headers::Base *uidHeader = msg->headerByType(X_NOTES_UID_HEADER)) {
+            uid = uidHeader->asUnicodeString();
+        }
+    }
+
+    if (fields & ClassificationField) {
+        if (KMime::Headers::Base *classificationHeader = msg->headerByType(X_NOTES_CLASSIFICATION_HEADER)) {
+            classification = parseClassification(classificationHeader->asUnicodeString());
+        }
+    }
+
+    if (!(fields & (CustomField | AttachmentsField))) {
+        return;
+    }
+    const auto list = msg->contents();
+    for (KMime::Content *c : list) {
+        if (isCanceled && isCanceled()) {
+            return;
+        }
+        if (KMime::Headers::Base *typeHeader = c->headerByType(X_NOTES_CONTENTTYPE_HEADER)) {
+            const QString &type = typeHeader->asUnicodeString();
+            if (type == CONTENT_TYPE_CUSTOM) {
+                if (fields & CustomField) {
+                    parseCustomPart(c);
+                }
+            } else if (type == CONTENT_TYPE_ATTACHMENT) {
+                if (fields & AttachmentsField) {
+                    parseAttachmentPart(c);
+                }
+            } else {
+                qCWarning(AKONADINOTES_LOG) << "unknown type " << type;
+            }
+        }
+    }
+}
+
+static QByteArray formatLastModifiedDate(const QDateTime &lastModifiedDate)
+{
+    char buffer[Rfc2822Date::MaxFormattedLength];
+    const qsizetype length = Rfc2822Date::format(lastModifiedDate, buffer);
+    if (length == 0) {
+        return (QLocale::c().toString(lastModifiedDate, QStringLiteral("ddd, ")) + lastModifiedDate.toString(Qt::RFC2822Date)).toLatin1();
+    }
+    return QByteArray(buffer, length);
+}
+
+static QString classificationName(NoteMessageWrapper::Classification classification)
+{
+    switch (classification) {
+    case NoteMessageWrapper::Private:
+        return CLASSIFICATION_PRIVATE;
+    case NoteMessageWrapper::Confidential:
+        return CLASSIFICATION_CONFIDENTIAL;
+    default:
+        return CLASSIFICATION_PUBLIC;
+    }
+}
+
+// The text without the trailing whitespace that does not survive a round trip through a message
+static QStringView canonicalText(QStringView text)
+{
+    while (!text.isEmpty() && text.back().isSpace()) {
+        text.chop(1);
+    }
+    return text;
+}
+
+// The date as written to a message, in UTC and to the second
+static QDateTime canonicalDate(const QDateTime &date)
+{
+    if (!date.isValid()) {
+        return {};
+    }
+    return QDateTime::fromSecsSinceEpoch(date.toSecsSinceEpoch(), QTimeZone::utc());
+}
+
+NoteMessageWrapperPrivate::MessageValues NoteMessageWrapperPrivate::messageValues(bool canonical) const
+{
+    MessageValues values;
+    if (canonical) {
+        values.subject = title;
+        values.body = canonicalText(text).toString();
+        values.date = canonicalDate(creationDate);
+        values.lastModified = canonicalDate(lastModifiedDate);
+        values.uid = uid;
+        return values;
+    }
+    values.subject = i18nc("The default name for new notes.", "New Note");
+    if (!title.isEmpty()) {
+        values.subject = title;
+    }
+    // Need a non-empty body part so that the serializer regards this as a valid message.
+    values.body = QStringLiteral("  ");
+    if (!text.isEmpty()) {
+        values.body = text;
+    }
+
+    values.date = QDateTime::currentDateTime();
+    if (creationDate.isValid()) {
+        values.date = creationDate;
+    }
+
+    values.lastModified = QDateTime::currentDateTime();
+    if (lastModifiedDate.isValid()) {
+        values.lastModified = lastModifiedDate;
+    }
+
+    if (!uid.isEmpty()) {
+        values.uid = uid;
+    } else {
+        values.uid = QUuid::createUuid().toString().mid(1, 36);
+    }
+    return values;
+}
+
+KMime::MessagePtr NoteMessageWrapperPrivate::createMessage(const std::function<bool()> &isCanceled) const
+{
+    KMime::MessagePtr msg = KMime::MessagePtr(new KMime::Message());
+    const MessageValues values = messageValues();
+
+    msg->subject(true)->fromUnicodeString(values.subject);
+    msg->date(true)->setDateTime(values.date);
+    msg->from(true)->fromUnicodeString(from);
+
+    auto header = new KMime::Headers::Generic(X_NOTES_LASTMODIFIED_HEADER);
+    header->from7BitString(formatLastModifiedDate(values.lastModified));
+    msg->appendHeader(header);
+    header = new KMime::Headers::Generic(X_NOTES_UID_HEADER);
+    header->fromUnicodeString(values.uid);
+    msg->appendHeader(header);
+    header = new KMime::Headers::Generic(X_NOTES_CLASSIFICATION_HEADER);
+    header->fromUnicodeString(classificationName(classification));
+    msg->appendHeader(header);
+
+    EncodedAttachments previous;
+    if (reuseEncodedParts) {
+        const QMutexLocker locker(&encodedParts.mutex);
+        previous = encodedParts.attachments;
+    }
+    EncodedAttachments encoded;
+    qsizetype keptSize = 0;
+    for (const Attachment &a : std::as_const(attachments)) {
+        if (isCanceled && isCanceled()) {
+            return {};
+        }
+        msg->appendContent(createAttachmentPart(a, previous, reuseEncodedParts ? &encoded : nullptr, keptSize));
+    }
+    if (reuseEncodedParts) {
+        // Only the attachments of this message are kept
+        const QMutexLocker locker(&encodedParts.mutex);
+        encodedParts.attachments = std::move(encoded);
+    }
+
+    if (!custom.isEmpty()) {
+        msg->appendContent(createCustomPart());
+    }
+
+    msg->mainBodyPart()->contentType(true)->setCharset(ENCODING);
+    msg->mainBodyPart()->fromUnicodeString(values.body);
+    msg->mainBodyPart()->contentType(true)->setMimeType(textFormat == Qt::RichText ? "text/html" : "text/plain");
+
+    msg->assemble();
+    return msg;
+}
+
+// Size of a KMime content tree, the headers are estimated
+static qsizetype countContent(MemoryCounter &counter, const KMime::Content *content)
+{
+    constexpr qsizetype ContentSize = 256;
+    constexpr qsizetype HeaderSize = 128;
+    qsizetype size = ContentSize + content->headers().size() * HeaderSize + counter.add(content->body());
+    const auto contents = content->contents();
+    for (const KMime::Content *child : contents) {
+        size += countContent(counter, child);
+    }
+    return size;
+}
+
+NoteMemoryUsage NoteMessageWrapperPrivate::estimatedMemoryUsage() const
+{
+    MemoryCounter counter;
+    NoteMemoryUsage usage;
+    usage.other = qsizetype(sizeof(NoteMessageWrapper) + sizeof(NoteMessageWrapperPrivate)) + counter.add(errorString);
+    usage.text = counter.add(uid) + counter.add(title) + counter.add(text) + counter.add(from);
+
+    // A std::map node per value
+    constexpr qsizetype MapNodeSize = 32 + 2 * sizeof(QString) + 16;
+    auto countMap = [&counter](const QMap<QString, QString> &map) {
+        qsizetype size = map.isEmpty() ? 0 : 64;
+        for (auto it = map.cbegin(), end = map.cend(); it != end; ++it) {
+            size += MapNodeSize + counter.add(it.key()) + counter.add(it.value());
+        }
+        return size;
+    };
+    usage.custom = countMap(custom);
+
+    usage.attachments = attachments.capacity() * qsizetype(sizeof(Attachment));
+    for (const Attachment &a : attachments) {
+        usage.attachments += countAttachment(counter, *a.d);
+    }
+
+    if (pendingMessage) {
+        usage.message += countContent(counter, pendingMessage.data());
+    }
+    const QMutexLocker locker(&encodedParts.mutex);
+    usage.message += encodedParts.attachments.capacity() * qsizetype(sizeof(EncodedAttachment) + sizeof(void *) + 16);
+    for (const EncodedAttachment &encoded : encodedParts.attachments) {
+        usage.message += counter.add(encoded.data) + counter.add(encoded.body);
+    }
+    usage.message += counter.add(encodedParts.custom);
+    if (!custom.isSharedWith(encodedParts.customValues)) {
+        usage.message += countMap(encodedParts.customValues);
+    }
+    return usage;
+}
+
+// Writes the header line of h, or nothing if it is empty
+static bool writeHeader(QIODevice *device, const KMime::Headers::Base &h)
+{
+    if (h.isEmpty()) {
+        return true;
+    }
+    return device->write(h.as7BitString(true) + '\n') >= 0;
+}
+
+// Writes data base64-encoded in lines of 76 characters, one chunk at a time
+static bool writeBase64(QIODevice *device, QByteArrayView data)
+{
+    constexpr qsizetype ChunkSize = 57 * 64; // whole lines of 76 characters, no padding inside the data
+    for (qsizetype pos = 0; pos < data.size(); pos += ChunkSize) {
+        if (device->write(Base64::encode(data.sliced(pos, std::min(ChunkSize, data.size() - pos)))) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NoteMessageWrapperPrivate::writeTo(QIODevice *device, NoteMessageWrapper::SerializationMode mode) const
+{
+    const bool canonical = mode == NoteMessageWrapper::CanonicalSerialization;
+    const MessageValues values = messageValues(canonical);
+    const bool multipart = !attachments.isEmpty() || !custom.isEmpty();
+    QByteArray boundary;
+    if (multipart) {
+        // The canonical boundary only depends on the content, like the rest of the message
+        boundary = "nextPart" + (canonical ? fingerprint().toHex() : QUuid::createUuid().toByteArray(QUuid::Id128));
+    }
+
+    KMime::Headers::From fromHeader;
+    fromHeader.fromUnicodeString(from);
+    KMime::Headers::Subject subjectHeader;
+    subjectHeader.fromUnicodeString(values.subject);
+    KMime::Headers::Date dateHeader;
+    KMime::Headers::Generic lastModifiedHeader(X_NOTES_LASTMODIFIED_HEADER);
+    // Only empty in canonical mode
+    if (values.date.isValid()) {
+        dateHeader.setDateTime(values.date);
+    }
+    if (values.lastModified.isValid()) {
+        lastModifiedHeader.from7BitString(formatLastModifiedDate(values.lastModified));
+    }
+    KMime::Headers::Generic uidHeader(X_NOTES_UID_HEADER);
+    uidHeader.fromUnicodeString(values.uid);
+    KMime::Headers::Generic classificationHeader(X_NOTES_CLASSIFICATION_HEADER);
+    classificationHeader.fromUnicodeString(classificationName(classification));
+
+    KMime::Headers::ContentType textType;
+    textType.setMimeType(textFormat == Qt::RichText ? "text/html" : "text/plain");
+    textType.setCharset(ENCODING);
+    KMime::Headers::ContentTransferEncoding textEncoding;
+    textEncoding.setEncoding(KMime::Headers::CE8Bit);
+
+    bool ok = writeHeader(device, fromHeader) && writeHeader(device, subjectHeader) && (!values.date.isValid() || writeHeader(device, dateHeader))
+        && writeHeader(device, lastModifiedHeader) && writeHeader(device, uidHeader) && writeHeader(device, classificationHeader)
+        && device->write("MIME-Version: 1.0\n") >= 0;
+    if (multipart) {
+        KMime::Headers::ContentType messageType;
+        messageType.setMimeType("multipart/mixed");
+        messageType.setBoundary(boundary);
+        ok = ok && writeHeader(device, messageType) && device->write("\n--" + boundary + '\n') >= 0;
+    }
+    ok = ok && writeHeader(device, textType) && writeHeader(device, textEncoding) && device->write("\n") >= 0
+        && device->write(values.body.toUtf8() + '\n') >= 0;
+    if (!multipart) {
+        return ok;
+    }
+
+    for (const Attachment &a : std::as_const(attachments)) {
+        if (!ok) {
+            return false;
+        }
+        KMime::Headers::Generic typeHeader(X_NOTES_CONTENTTYPE_HEADER);
+        typeHeader.fromUnicodeString(CONTENT_TYPE_ATTACHMENT);
+        KMime::Headers::Generic urlHeader(X_NOTES_URL_HEADER);
+        if (a.url().isValid()) {
+            urlHeader.fromUnicodeString(a.url().toString());
+        }
+        KMime::Headers::ContentType contentType;
+        contentType.setMimeType(a.mimetype().toLatin1());
+        KMime::Headers::Generic labelHeader(X_NOTES_LABEL_HEADER);
+        if (!a.label().isEmpty()) {
+            labelHeader.fromUnicodeString(a.label());
+        }
+        KMime::Headers::ContentTransferEncoding encoding;
+        encoding.setEncoding(KMime::Headers::CEbase64);
+        KMime::Headers::ContentDisposition disposition;
+        disposition.setDisposition(KMime::Headers::CDattachment);
+        disposition.setFilename(QStringLiteral("attachment"));
+        KMime::Headers::ContentID contentID;
+        if (!a.contentID().isEmpty()) {
+            contentID.setIdentifier(a.contentID().toLatin1());
+        }
+
+        ok = device->write("--" + boundary + '\n') >= 0 && writeHeader(device, typeHeader) && writeHeader(device, urlHeader)
+            && writeHeader(device, contentType) && writeHeader(device, labelHeader) && writeHeader(device, encoding)
+            && writeHeader(device, disposition) && writeHeader(device, contentID) && device->write("\n") >= 0;
+        if (ok && !a.url().isValid()) {
+            if (canonical) {
+                // Encoded again, the line length and padding of the source must not matter
+                ok = a.dataBase64Encoded() ? writeBase64(device, Base64::decode(a.d->payload())) : writeBase64(device, a.d->payload());
+            } else if (a.d->mEncoded && !a.dataBase64Encoded()) {
+                // Written as parsed, without decoding it
+                const QByteArray &encoded = a.d->mEncoded->encoded();
+                ok = device->write(encoded) >= 0 && (encoded.endsWith('\n') || device->write("\n") >= 0);
+            } else if (a.dataBase64Encoded()) {
+                const QByteArrayView data = a.d->payload();
+                ok = device->write(data.data(), data.size()) >= 0 && device->write("\n") >= 0;
+            } else {
+                ok = writeBase64(device, a.d->payload());
+            }
+        }
+    }
+
+    if (ok && !custom.isEmpty()) {
+        KMime::Headers::Generic typeHeader(X_NOTES_CONTENTTYPE_HEADER);
+        typeHeader.fromUnicodeString(CONTENT_TYPE_CUSTOM);
+        ok = device->write("--" + boundary + '\n') >= 0 && writeHeader(device, typeHeader) && device->write("\n") >= 0;
+        ok = ok && CustomXml::write(device, custom) && device->write("\n") >= 0;
+    }
+    return ok && device->write("--" + boundary + "--\n") >= 0;
+}
+
+// Feeds length prefixed fields into a hash, so that moving text from one field to the next changes it
+class FingerprintHash
 {
 public:
-    NoteMessageWrapperPrivate() = default;
+    void add(QByteArrayView data)
+    {
+        addNumber(data.size());
+        mHash.addData(data);
+    }
 
-    NoteMessageWrapperPrivate(const KMime::MessagePtr &msg)
+    void add(QStringView text)
     {
-        readMimeMessage(msg);
+        add(QByteArrayView(text.toUtf8()));
     }
 
-    void readMimeMessage(const KMime::MessagePtr &msg);
+    void addNumber(qint64 value)
+    {
+        const qint64 littleEndian = qToLittleEndian(value);
+        mHash.addData(QByteArrayView(reinterpret_cast<const char *>(&littleEndian), sizeof(littleEndian)));
+    }
 
-    KMime::Content *createCustomPart() const;
-    void parseCustomPart(KMime::Content *);
+    void addDate(const QDateTime &date)
+    {
+        addNumber(date.isValid());
+        addNumber(date.isValid() ? date.toSecsSinceEpoch() : 0);
+    }
 
-    KMime::Content *createAttachmentPart(const Attachment &) const;
-    void parseAttachmentPart(KMime::Content *);
+    [[nodiscard]] QByteArray result() const
+    {
+        return mHash.result();
+    }
 
-    QString uid;
-    QString title;
-    QString text;
-    QString from;
-    QDateTime creationDate;
-    QDateTime lastModifiedDate;
-    QMap<QString, QString> custom;
-    QList<Attachment> attachments;
-    NoteMessageWrapper::Classification classification = NoteMessageWrapper::Public;
-    Qt::TextFormat textFormat = Qt::PlainText;
+private:
+    QCryptographicHash mHash{QCryptographicHash::Blake2s_128};
 };
 
-void NoteMessageWrapperPrivate::readMimeMessage(const KMime::MessagePtr &msg)
+// Changes whenever the set of hashed fields or their encoding changes
+static constexpr qint64 FingerprintVersion = 1;
+
+QByteArray NoteMessageWrapperPrivate::fingerprint() const
 {
-    if (!msg.data()) {
-        qCWarning(AKONADINOTES_LOG) << "Empty message";
-        return;
-    }
-    title = msg->subject(true)->asUnicodeString();
-    text = msg->mainBodyPart()->decodedText(true); // remove trailing whitespace, so we get rid of "  " in empty notes
-    if (msg->from(false)) {
-        from = msg->from(false)->asUnicodeString();
-    }
-    creationDate = msg->date(true)->dateTime();
-    if (msg->mainBodyPart()->contentType(false) && msg->mainBodyPart()->contentType()->mimeType() == "text/html") {
-        textFormat = Qt::RichText;
+    // Only what survives a round trip through a message is hashed
+    FingerprintHash hash;
+    hash.addNumber(FingerprintVersion);
+    hash.add(uid);
+    hash.add(title);
+    hash.add(canonicalText(text));
+    hash.addNumber(textFormat == Qt::RichText);
+    hash.add(from);
+    hash.addNumber(classification);
+    hash.addDate(creationDate);
+    hash.addDate(lastModifiedDate);
+
+    hash.addNumber(custom.size());
+    for (auto it = custom.cbegin(), end = custom.cend(); it != end; ++it) {
+        hash.add(it.key());
+        hash.add(it.value());
     }
 
-    if (KMime::Headers::Base *lastmod = msg->headerByType(X_NOTES_LASTMODIFIED_HEADER)) {
-        lastModifiedDate = QDateTime::fromString(lastmod->asUnicodeString(), Qt::RFC2822Date);
-        if (!lastModifiedDate.isValid()) {
-            qCWarning(AKONADINOTES_LOG) << "failed to parse lastModifiedDate";
+    hash.addNumber(attachments.size());
+    for (const Attachment &a : attachments) {
+        const bool hasUrl = a.url().isValid();
+        hash.addNumber(hasUrl);
+        if (hasUrl) {
+            hash.add(a.url().toString());
+        } else {
+            hash.add(a.digest());
         }
+        hash.add(a.mimetype());
+        hash.add(a.label());
+        hash.add(a.contentID());
     }
+    return hash.result();
+}
 
-    if (KMime::Headers::Base *uidHeader = msg->headerByType(X_NOTES_UID_HEADER)) {
-        uid = uidHeader->asUnicodeString();
+// Returns the first maxChars characters of text that is plain or rich text as a whole or just its beginning
+static bool plainTextPrefix(QStringView text, Qt::TextFormat format, int maxChars, bool complete, QString &result)
+{
+    if (format == Qt::RichText) {
+        return htmlToPlainTextPrefix(text, maxChars, complete, result);
     }
-
-    if (KMime::Headers::Base *classificationHeader = msg->headerByType(X_NOTES_CLASSIFICATION_HEADER)) {
-        const QString &c = classificationHeader->asUnicodeString();
-        if (c == CLASSIFICATION_PRIVATE) {
-            classification = NoteMessageWrapper::Private;
-        } else if (c == CLASSIFICATION_CONFIDENTIAL) {
-            classification = NoteMessageWrapper::Confidential;
-        }
+    while (!text.isEmpty() && text.front().isSpace()) {
+        text = text.sliced(1);
     }
-
-    const auto list = msg->contents();
-    for (KMime::Content *c : list) {
-        if (KMime::Headers::Base *typeHeader = c->headerByType(X_NOTES_CONTENTTYPE_HEADER)) {
-            const QString &type = typeHeader->asUnicodeString();
-            if (type == CONTENT_TYPE_CUSTOM) {
-                parseCustomPart(c);
-            } else if (type == CONTENT_TYPE_ATTACHMENT) {
-                parseAttachmentPart(c);
-            } else {
-                qCWarning(AKONADINOTES_LOG) << "unknown type " << type;
-            }
-        }
+    if (!complete && text.size() < maxChars) {
+        return false;
+    }
+    qsizetype length = std::min<qsizetype>(text.size(), maxChars);
+    if (length > 0 && length < text.size() && text[length - 1].isHighSurrogate()) {
+        --length;
     }
+    result = text.first(length).trimmed().toString();
+    return true;
 }
 
-QDomDocument createXMLDocument()
+QString NoteMessageWrapperPrivate::previewFromMessage(int maxChars) const
 {
-    QDomDocument document;
-    const QString p = QStringLiteral("version=\"1.0\" encoding=\"UTF-8\"");
-    document.appendChild(document.createProcessingInstruction(QStringLiteral("xml"), p));
-    return document;
+    KMime::Content *body = pendingMessage->mainBodyPart();
+    const KMime::Headers::ContentTransferEncoding *encoding = body->contentTransferEncoding(false);
+    const bool identityEncoding = !encoding || encoding->encoding() == KMime::Headers::CE7Bit || encoding->encoding() == KMime::Headers::CE8Bit
+        || encoding->encoding() == KMime::Headers::CEbinary;
+    QByteArray charset = body->contentType(false) ? body->contentType(false)->charset() : QByteArray();
+    if (charset.isEmpty()) {
+        charset = ENCODING;
+    }
+    QStringDecoder decoder(charset.constData());
+    if (!identityEncoding || !decoder.isValid()) {
+        load(TextField);
+        QString result;
+        (void)plainTextPrefix(text, textFormat, maxChars, true, result);
+        return result;
+    }
+
+    // Decode a growing prefix of the body until it yields enough text
+    const QByteArray raw = body->body();
+    QString decoded;
+    QString result;
+    qsizetype pos = 0;
+    qsizetype chunkSize = std::max<qsizetype>(4096, qsizetype(maxChars) * 8);
+    while (true) {
+        const qsizetype length = std::min(chunkSize, raw.size() - pos);
+        const QString chunk = decoder.decode(QByteArrayView(raw).sliced(pos, length));
+        decoded += chunk;
+        pos += length;
+        if (plainTextPrefix(decoded, textFormat, maxChars, pos == raw.size(), result)) {
+            return result;
+        }
+        chunkSize *= 2;
+    }
 }
 
-QDomDocument loadDocument(KMime::Content *part)
+void NoteMessageWrapperPrivate::decodeAttachmentPayloads(const std::function<bool()> &isCanceled) const
 {
-    QDomDocument document;
-    const QDomDocument::ParseResult parseResult = document.setContent(part->body());
-    if (!parseResult) {
-        qCWarning(AKONADINOTES_LOG) << part->body();
-        qWarning("Error loading document: %s, line %lld, column %lld", qPrintable(parseResult.errorMessage), parseResult.errorLine, parseResult.errorColumn);
-        return {};
+    for (const Attachment &a : attachments) {
+        if (isCanceled && isCanceled()) {
+            return;
+        }
+        if (a.d->mEncoded) {
+            (void)a.d->mEncoded->decoded();
+        }
     }
-    return document;
 }
 
 KMime::Content *NoteMessageWrapperPrivate::createCustomPart() const
@@ -264,45 +1267,60 @@ KMime::Content *NoteMessageWrapperPrivate::createCustomPart() const
     auto header = new KMime::Headers::Generic(X_NOTES_CONTENTTYPE_HEADER);
     header->fromUnicodeString(CONTENT_TYPE_CUSTOM);
     content->appendHeader(header);
-    QDomDocument document = createXMLDocument();
-    QDomElement element = document.createElement(QStringLiteral("custom"));
-    element.setAttribute(QStringLiteral("version"), QStringLiteral("1.0"));
-    QMap<QString, QString>::const_iterator end = custom.end();
-    for (QMap<QString, QString>::const_iterator it = custom.begin(); it != end; ++it) {
-        QDomElement e = element.ownerDocument().createElement(it.key());
-        QDomText t = element.ownerDocument().createTextNode(it.value());
-        e.appendChild(t);
-        element.appendChild(e);
-        document.appendChild(element);
-    }
-    content->setBody(document.toString().toLatin1());
+    QByteArray xml;
+    {
+        const QMutexLocker locker(&encodedParts.mutex);
+        if (custom.isSharedWith(encodedParts.customValues)) {
+            xml = encodedParts.custom;
+        }
+    }
+    if (xml.isNull()) {
+        xml = CustomXml::write(custom);
+        if (reuseEncodedParts) {
+            const QMutexLocker locker(&encodedParts.mutex);
+            encodedParts.custom = xml;
+            encodedParts.customValues = custom;
+        }
+    }
+    content->setBody(xml);
     return content;
 }
 
-void NoteMessageWrapperPrivate::parseCustomPart(KMime::Content *part)
+static QString customXmlErrorString(const CustomXml::ReadError &error)
 {
-    QDomDocument document = loadDocument(part);
-    if (document.isNull()) {
-        return;
-    }
-    QDomElement top = document.documentElement();
-    if (top.tagName() != QLatin1StringView("custom")) {
-        qWarning("XML error: Top tag was %s instead of the expected custom", top.tagName().toLatin1().data());
-        return;
+    switch (error.kind) {
+    case CustomXml::ReadError::NoError:
+        break;
+    case CustomXml::ReadError::EmptyDocument:
+        return i18n("Empty document");
+    case CustomXml::ReadError::WrongRootElement:
+        return i18n("Top tag was %1 instead of the expected custom", error.detail);
+    case CustomXml::ReadError::TrailingContent:
+        return i18n("Unexpected content after the custom element, line %1, column %2", error.line, error.column);
+    case CustomXml::ReadError::SyntaxError:
+        return i18n("%1, line %2, column %3", error.detail, error.line, error.column);
     }
+    return {};
+}
 
-    for (QDomNode n = top.firstChild(); !n.isNull(); n = n.nextSibling()) {
-        if (n.isElement()) {
-            QDomElement e = n.toElement();
-            custom.insert(e.tagName(), e.text());
-        } else {
-            qCDebug(AKONADINOTES_LOG) << "Node is not an element";
-            Q_ASSERT(false);
-        }
+void NoteMessageWrapperPrivate::parseCustomPart(KMime::Content *part)
+{
+    CustomXml::ReadError error;
+    const bool wasEmpty = custom.isEmpty();
+    if (!CustomXml::read(part->body(), custom, &error)) {
+        const QString errorString = customXmlErrorString(error);
+        qCWarning(AKONADINOTES_LOG) << part->body();
+        qCWarning(AKONADINOTES_LOG) << "Error loading custom values:" << errorString;
+        addError(i18n("Invalid custom values: %1", errorString));
+    } else if (wasEmpty) {
+        const QMutexLocker locker(&encodedParts.mutex);
+        encodedParts.custom = part->body();
+        encodedParts.customValues = custom;
     }
 }
 
-KMime::Content *NoteMessageWrapperPrivate::createAttachmentPart(const Attachment &a) const
+KMime::Content *
+NoteMessageWrapperPrivate::createAttachmentPart(const Attachment &a, const EncodedAttachments &previous, EncodedAttachments *encoded, qsizetype &keptSize) const
 {
     auto content = new KMime::Content();
     auto header = new KMime::Headers::Generic(X_NOTES_CONTENTTYPE_HEADER);
@@ -312,11 +1330,28 @@ KMime::Content *NoteMessageWrapperPrivate::createAttachmentPart(const Attachment
         header = new KMime::Headers::Generic(X_NOTES_URL_HEADER);
         header->fromUnicodeString(a.url().toString());
         content->appendHeader(header);
+    } else if (a.dataBase64Encoded()) {
+        content->setEncodedBody(a.data());
+    } else if (a.d->mEncoded) {
+        content->setEncodedBody(a.d->mEncoded->encoded());
+    } else if (!encoded || a.d->mSpilled || a.d->mData.isEmpty()) {
+        // The data of a file backed attachment is encoded for each message, it is not worth keeping
+        content->setEncodedBody(Base64::encode(a.d->payload()));
     } else {
-        if (a.dataBase64Encoded()) {
-            content->setEncodedBody(a.data());
+        // Parsed attachments keep their encoded form themselves, the others are
+        // kept for the next message while they fit
+        const QByteArray &data = a.d->mData;
+        const auto it = previous.constFind(data.constData());
+        EncodedAttachment entry;
+        if (it != previous.cend() && it->data.isSharedWith(data)) {
+            entry = *it;
         } else {
-            content->setBody(a.data());
+            entry = {data, Base64::encode(data)};
+        }
+        content->setEncodedBody(entry.body);
+        if (!encoded->contains(data.constData()) && keptSize + entry.body.size() <= MaxKeptEncodedSize) {
+            keptSize += entry.body.size();
+            encoded->insert(data.constData(), std::move(entry));
         }
     }
     content->contentType()->setMimeType(a.mimetype().toLatin1());
@@ -344,12 +1379,46 @@ void NoteMessageWrapperPrivate::parseAttachmentPart(KMime::Content *part)
         Attachment attachment(QUrl(header->asUnicodeString()), QLatin1StringView(part->contentType()->mimeType()));
         attachment.setLabel(label);
         attachment.setContentID(QString::fromLatin1(part->contentID()->identifier()));
-        attachments.append(attachment);
+        attachments.append(std::move(attachment));
     } else {
-        Attachment attachment(part->decodedContent(), QLatin1StringView(part->contentType()->mimeType()));
+        Attachment attachment(QByteArray(), QLatin1StringView(part->contentType()->mimeType()));
+        AttachmentPrivate *a = attachment.d.data();
+        const qsizetype spillThreshold = attachmentSpillThreshold();
+        const bool deduplicate = attachmentDeduplicationEnabled();
+        if (part->contentTransferEncoding()->encoding() == KMime::Headers::CEbase64) {
+            // Kept encoded, the data is decoded when it is first needed or streamed by open()
+            const QByteArray encoded = part->encodedBody();
+            if (spillThreshold > 0 && encoded.size() / 4 * 3 > spillThreshold) {
+                Base64DecodingDevice decoder(encoded);
+                decoder.open(QIODevice::ReadOnly);
+                a->mSpilled = SpilledData::create(&decoder);
+            }
+            if (!a->mSpilled) {
+                if (deduplicate) {
+                    // Looking up the data needs it decoded
+                    a->mData = Base64::decode(encoded);
+                } else {
+                    a->mEncoded = QSharedPointer<EncodedPayload>::create(encoded);
+                }
+            }
+        } else {
+            QByteArray data = part->decodedContent();
+            if (spillThreshold > 0 && data.size() > spillThreshold) {
+                QBuffer buffer(&data);
+                buffer.open(QIODevice::ReadOnly);
+                a->mSpilled = SpilledData::create(&buffer);
+            }
+            if (!a->mSpilled) {
+                a->mData = std::move(data);
+            }
+        }
+        if (deduplicate && !a->mData.isEmpty()) {
+            a->mStored = AttachmentStore::intern(a->mData, a->mMimetype);
+            a->mData = a->mStored->data;
+        }
         attachment.setLabel(label);
         attachment.setContentID(QString::fromLatin1(part->contentID()->identifier()));
-        attachments.append(attachment);
+        attachments.append(std::move(attachment));
     }
 }
 
@@ -363,93 +1432,129 @@ NoteMessageWrapper::NoteMessageWrapper(const KMime::MessagePtr &msg)
 {
 }
 
+NoteMessageWrapper::NoteMessageWrapper(const KMime::MessagePtr &msg, ParseMode mode)
+    : d_ptr(new NoteMessageWrapperPrivate())
+{
+    Q_D(NoteMessageWrapper);
+    if (mode == EagerParsing || !msg.data()) {
+        d->readMimeMessage(msg);
+        return;
+    }
+    d->pendingMessage = msg;
+    d->pendingFields = NoteMessageWrapperPrivate::AllFields;
+}
+
+NoteMessageWrapper::NoteMessageWrapper(NoteMessageWrapper &&other) noexcept = default;
+
 NoteMessageWrapper::~NoteMessageWrapper() = default;
 
+NoteMessageWrapper &NoteMessageWrapper::operator=(NoteMessageWrapper &&other) noexcept = default;
+
 KMime::MessagePtr NoteMessageWrapper::message() const
 {
     Q_D(const NoteMessageWrapper);
-    KMime::MessagePtr msg = KMime::MessagePtr(new KMime::Message());
-
-    QString title = i18nc("The default name for new notes.", "New Note");
-    if (!d->title.isEmpty()) {
-        title = d->title;
-    }
-    // Need a non-empty body part so that the serializer regards this as a valid message.
-    QString text = QStringLiteral("  ");
-    if (!d->text.isEmpty()) {
-        text = d->text;
-    }
-
-    QDateTime creationDate = QDateTime::currentDateTime();
-    if (d->creationDate.isValid()) {
-        creationDate = d->creationDate;
-    }
-
-    QDateTime lastModifiedDate = QDateTime::currentDateTime();
-    if (d->lastModifiedDate.isValid()) {
-        lastModifiedDate = d->lastModifiedDate;
-    }
+    d->load(NoteMessageWrapperPrivate::AllFields);
+    return d->createMessage();
+}
 
-    QString uid;
-    if (!d->uid.isEmpty()) {
-        uid = d->uid;
-    } else {
-        uid = QUuid::createUuid().toString().mid(1, 36);
+void NoteMessageWrapper::setReuseEncodedParts(bool reuse)
+{
+    Q_D(NoteMessageWrapper);
+    d->reuseEncodedParts = reuse;
+    if (!reuse) {
+        const QMutexLocker locker(&d->encodedParts.mutex);
+        d->encodedParts.attachments.clear();
     }
+}
 
-    msg->subject(true)->fromUnicodeString(title);
-    msg->date(true)->setDateTime(creationDate);
-    msg->from(true)->fromUnicodeString(d->from);
-    const QString formatDate = QLocale::c().toString(lastModifiedDate, QStringLiteral("ddd, ")) + lastModifiedDate.toString(Qt::RFC2822Date);
-
-    auto header = new KMime::Headers::Generic(X_NOTES_LASTMODIFIED_HEADER);
-    header->fromUnicodeString(formatDate);
-    msg->appendHeader(header);
-    header = new KMime::Headers::Generic(X_NOTES_UID_HEADER);
-    header->fromUnicodeString(uid);
-    msg->appendHeader(header);
+bool NoteMessageWrapper::reuseEncodedParts() const
+{
+    Q_D(const NoteMessageWrapper);
+    return d->reuseEncodedParts;
+}
 
-    QString classification = CLASSIFICATION_PUBLIC;
-    switch (d->classification) {
-    case Private:
-        classification = CLASSIFICATION_PRIVATE;
-        break;
-    case Confidential:
-        classification = CLASSIFICATION_CONFIDENTIAL;
-        break;
-    default:
-        // do nothing
-        break;
+bool NoteMessageWrapper::writeTo(QIODevice *device, SerializationMode mode) const
+{
+    Q_D(const NoteMessageWrapper);
+    if (!device || !device->isWritable()) {
+        qCWarning(AKONADINOTES_LOG) << "Device is not writable";
+        return false;
     }
-    header = new KMime::Headers::Generic(X_NOTES_CLASSIFICATION_HEADER);
-    header->fromUnicodeString(classification);
-    msg->appendHeader(header);
+    d->load(NoteMessageWrapperPrivate::AllFields);
+    return d->writeTo(device, mode);
+}
 
-    for (const Attachment &a : std::as_const(d->attachments)) {
-        msg->appendContent(d->createAttachmentPart(a));
-    }
+void NoteMessageWrapper::loadAll() const
+{
+    Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::AllFields);
+    d->decodeAttachmentPayloads();
+}
 
-    if (!d->custom.isEmpty()) {
-        msg->appendContent(d->createCustomPart());
-    }
+QByteArray NoteMessageWrapper::fingerprint() const
+{
+    Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::AllFields);
+    return d->fingerprint();
+}
 
-    msg->mainBodyPart()->contentType(true)->setCharset(ENCODING);
-    msg->mainBodyPart()->fromUnicodeString(text);
-    msg->mainBodyPart()->contentType(true)->setMimeType(d->textFormat == Qt::RichText ? "text/html" : "text/plain");
+QFuture<QSharedPointer<NoteMessageWrapper>> NoteMessageWrapper::parseAsync(const KMime::MessagePtr &msg, QThreadPool *pool)
+{
+    return QtConcurrent::run(pool ? pool : QThreadPool::globalInstance(), [msg](QPromise<QSharedPointer<NoteMessageWrapper>> &promise) {
+        auto note = QSharedPointer<NoteMessageWrapper>::create(msg, LazyParsing);
+        NoteMessageWrapperPrivate *d = note->d_func();
+        const uint parts = NoteMessageWrapperPrivate::CustomField | NoteMessageWrapperPrivate::AttachmentsField;
+        d->decodeFields(NoteMessageWrapperPrivate::AllFields & ~parts);
+        if (promise.isCanceled()) {
+            return;
+        }
+        const auto isCanceled = [&promise] {
+            return promise.isCanceled();
+        };
+        d->decodeFields(parts, isCanceled);
+        // Otherwise the first data() call, usually on the thread waiting for the note, would decode them
+        d->decodeAttachmentPayloads(isCanceled);
+        if (promise.isCanceled()) {
+            return;
+        }
+        promise.addResult(note);
+    });
+}
 
-    msg->assemble();
-    return msg;
+QFuture<KMime::MessagePtr> NoteMessageWrapper::serializeAsync(QThreadPool *pool) const
+{
+    Q_D(const NoteMessageWrapper);
+    // Pending fields are decoded here, so the copy does not share the message with this note
+    d->load(NoteMessageWrapperPrivate::AllFields);
+    auto values = std::make_shared<const NoteMessageWrapperPrivate>(*d);
+    return QtConcurrent::run(pool ? pool : QThreadPool::globalInstance(), [values](QPromise<KMime::MessagePtr> &promise) {
+        const KMime::MessagePtr msg = values->createMessage([&promise] {
+            return promise.isCanceled();
+        });
+        if (msg) {
+            promise.addResult(msg);
+        }
+    });
 }
 
 void NoteMessageWrapper::setUid(const QString &uid)
 {
     Q_D(NoteMessageWrapper);
     d->uid = uid;
+    d->markSet(NoteMessageWrapperPrivate::UidField);
+}
+
+void NoteMessageWrapper::setUid(QString &&uid)
+{
+    Q_D(NoteMessageWrapper);
+    d->uid = std::move(uid);
+    d->markSet(NoteMessageWrapperPrivate::UidField);
 }
 
 QString NoteMessageWrapper::uid() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::UidField);
     return d->uid;
 }
 
@@ -457,11 +1562,13 @@ void NoteMessageWrapper::setClassification(NoteMessageWrapper::Classification cl
 {
     Q_D(NoteMessageWrapper);
     d->classification = classification;
+    d->markSet(NoteMessageWrapperPrivate::ClassificationField);
 }
 
 NoteMessageWrapper::Classification NoteMessageWrapper::classification() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::ClassificationField);
     return d->classification;
 }
 
@@ -469,11 +1576,13 @@ void NoteMessageWrapper::setLastModifiedDate(const QDateTime &lastModifiedDate)
 {
     Q_D(NoteMessageWrapper);
     d->lastModifiedDate = lastModifiedDate;
+    d->markSet(NoteMessageWrapperPrivate::LastModifiedField);
 }
 
 QDateTime NoteMessageWrapper::lastModifiedDate() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::LastModifiedField);
     return d->lastModifiedDate;
 }
 
@@ -481,11 +1590,13 @@ void NoteMessageWrapper::setCreationDate(const QDateTime &creationDate)
 {
     Q_D(NoteMessageWrapper);
     d->creationDate = creationDate;
+    d->markSet(NoteMessageWrapperPrivate::CreationDateField);
 }
 
 QDateTime NoteMessageWrapper::creationDate() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::CreationDateField);
     return d->creationDate;
 }
 
@@ -493,11 +1604,20 @@ void NoteMessageWrapper::setFrom(const QString &from)
 {
     Q_D(NoteMessageWrapper);
     d->from = from;
+    d->markSet(NoteMessageWrapperPrivate::FromField);
+}
+
+void NoteMessageWrapper::setFrom(QString &&from)
+{
+    Q_D(NoteMessageWrapper);
+    d->from = std::move(from);
+    d->markSet(NoteMessageWrapperPrivate::FromField);
 }
 
 QString NoteMessageWrapper::from() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::FromField);
     return d->from;
 }
 
@@ -505,11 +1625,20 @@ void NoteMessageWrapper::setTitle(const QString &title)
 {
     Q_D(NoteMessageWrapper);
     d->title = title;
+    d->markSet(NoteMessageWrapperPrivate::TitleField);
+}
+
+void NoteMessageWrapper::setTitle(QString &&title)
+{
+    Q_D(NoteMessageWrapper);
+    d->title = std::move(title);
+    d->markSet(NoteMessageWrapperPrivate::TitleField);
 }
 
 QString NoteMessageWrapper::title() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::TitleField);
     return d->title;
 }
 
@@ -518,46 +1647,359 @@ void NoteMessageWrapper::setText(const QString &text, Qt::TextFormat format)
     Q_D(NoteMessageWrapper);
     d->text = text;
     d->textFormat = format;
+    d->markSet(NoteMessageWrapperPrivate::TextField | NoteMessageWrapperPrivate::TextFormatField);
+}
+
+void NoteMessageWrapper::setText(QString &&text, Qt::TextFormat format)
+{
+    Q_D(NoteMessageWrapper);
+    d->text = std::move(text);
+    d->textFormat = format;
+    d->markSet(NoteMessageWrapperPrivate::TextField | NoteMessageWrapperPrivate::TextFormatField);
 }
 
 QString NoteMessageWrapper::text() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::TextField);
     return d->text;
 }
 
+QString NoteMessageWrapper::takeText()
+{
+    Q_D(NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::TextField);
+    return std::exchange(d->text, QString());
+}
+
 Qt::TextFormat NoteMessageWrapper::textFormat() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::TextFormatField);
     return d->textFormat;
 }
 
 QString NoteMessageWrapper::toPlainText() const
 {
     Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::TextField | NoteMessageWrapperPrivate::TextFormatField);
     if (d->textFormat == Qt::PlainText) {
         return d->text;
     }
 
-    // From cleanHtml in kdepimlibs/kcalutils/incidenceformatter.cpp
-    const QRegularExpression rx(QStringLiteral("<body[^>]*>(.*)</body>"), QRegularExpression::CaseInsensitiveOption);
-    QString body = rx.match(d->text).captured(1);
+    return htmlToPlainText(d->text);
+}
+
+QString NoteMessageWrapper::preview(int maxChars) const
+{
+    Q_D(const NoteMessageWrapper);
+    maxChars = std::max(maxChars, 0);
+    d->load(NoteMessageWrapperPrivate::TextFormatField);
+    if (d->pendingFields & NoteMessageWrapperPrivate::TextField) {
+        return d->previewFromMessage(maxChars);
+    }
+    QString result;
+    (void)plainTextPrefix(d->text, d->textFormat, maxChars, true, result);
+    return result;
+}
+
+NoteMemoryUsage NoteMessageWrapper::estimatedMemoryUsage() const
+{
+    Q_D(const NoteMessageWrapper);
+    return d->estimatedMemoryUsage();
+}
 
-    return body.remove(QRegularExpression(QStringLiteral("<[^>]*>"))).trimmed().toHtmlEscaped();
+QString NoteMessageWrapper::errorString() const
+{
+    Q_D(const NoteMessageWrapper);
+    return d->errorString;
 }
 
 QList<Attachment> &NoteMessageWrapper::attachments()
 {
     Q_D(NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::AttachmentsField);
+    return d->attachments;
+}
+
+const QList<Attachment> &NoteMessageWrapper::attachments() const
+{
+    Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::AttachmentsField);
     return d->attachments;
 }
 
 QMap<QString, QString> &NoteMessageWrapper::custom()
 {
     Q_D(NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::CustomField);
     return d->custom;
 }
 
+const QMap<QString, QString> &NoteMessageWrapper::custom() const
+{
+    Q_D(const NoteMessageWrapper);
+    d->load(NoteMessageWrapperPrivate::CustomField);
+    return d->custom;
+}
+
+// Same unfolding as KMime: whitespace around a line break collapses into a single space
+static QByteArray unfoldHeaderValue(QByteArrayView value)
+{
+    QByteArray result;
+    result.reserve(value.size());
+    qsizetype pos = 0;
+    qsizetype lineBreak;
+    while ((lineBreak = value.indexOf('\n', pos)) >= 0) {
+        qsizetype foldBegin = lineBreak;
+        while (foldBegin > pos && QChar::isSpace(uchar(value[foldBegin - 1]))) {
+            --foldBegin;
+        }
+        qsizetype foldEnd = lineBreak;
+        while (foldEnd < value.size() && QChar::isSpace(uchar(value[foldEnd]))) {
+            ++foldEnd;
+        }
+        result.append(value.sliced(pos, foldBegin - pos));
+        if (foldEnd < value.size()) {
+            result += ' ';
+        }
+        pos = foldEnd;
+    }
+    result.append(value.sliced(pos));
+    return result;
+}
+
+static bool isHeader(QByteArrayView name, const char *header)
+{
+    return name.compare(QByteArrayView(header), Qt::CaseInsensitive) == 0;
+}
+
+// A field of the header block of a raw message
+struct HeaderField {
+    QByteArrayView name;
+    QByteArrayView value;
+    // Range of the field in the message, including folded lines and the final line break
+    qsizetype begin = 0;
+    qsizetype end = 0;
+};
+
+// Calls fn for each field of the top-level header block of message until it returns false.
+// Returns the position of the empty line that ends the header block.
+template<typename Function>
+static qsizetype forEachHeaderField(QByteArrayView message, Function fn)
+{
+    const qsizetype size = message.size();
+    qsizetype pos = 0;
+    while (pos < size) {
+        // A field ends at the first line break that is not followed by folding whitespace
+        qsizetype fieldEnd = pos;
+        qsizetype next = pos;
+        do {
+            const qsizetype lineBreak = message.indexOf('\n', next);
+            fieldEnd = lineBreak < 0 ? size : lineBreak;
+            next = lineBreak < 0 ? size : lineBreak + 1;
+        } while (next < size && (message[next] == ' ' || message[next] == '\t'));
+
+        QByteArrayView field = message.sliced(pos, fieldEnd - pos);
+        if (field.endsWith('\r')) {
+            field.chop(1);
+        }
+        if (field.isEmpty()) {
+            return pos; // end of the header block
+        }
+        const qsizetype begin = pos;
+        pos = next;
+
+        const qsizetype colon = field.indexOf(':');
+        if (colon <= 0) {
+            continue;
+        }
+        QByteArrayView value = field.sliced(colon + 1);
+        while (!value.isEmpty() && (value.front() == ' ' || value.front() == '\t')) {
+            value = value.sliced(1);
+        }
+        if (!fn(HeaderField{field.first(colon), value, begin, next})) {
+            break;
+        }
+    }
+    return pos;
+}
+
+NoteHeaderSummary scanNoteHeaders(QByteArrayView message)
+{
+    NoteHeaderSummary summary;
+    bool haveUid = false;
+    bool haveTitle = false;
+    bool haveCreationDate = false;
+    bool haveLastModified = false;
+    bool haveClassification = false;
+
+    forEachHeaderField(message, [&](const HeaderField &field) {
+        const QByteArrayView name = field.name;
+        const QByteArrayView value = field.value;
+        if (!haveTitle && isHeader(name, "Subject")) {
+            KMime::Headers::Subject subject;
+            subject.from7BitString(unfoldHeaderValue(value));
+            summary.title = subject.asUnicodeString();
+            haveTitle = true;
+        } else if (!haveCreationDate && isHeader(name, "Date")) {
+            KMime::Headers::Date date;
+            date.from7BitString(unfoldHeaderValue(value));
+            summary.creationDate = date.dateTime();
+            haveCreationDate = true;
+        } else if (!haveUid && isHeader(name, X_NOTES_UID_HEADER)) {
+            KMime::Headers::Generic uid(X_NOTES_UID_HEADER);
+            uid.from7BitString(unfoldHeaderValue(value));
+            summary.uid = uid.asUnicodeString();
+            haveUid = true;
+        } else if (!haveLastModified && isHeader(name, X_NOTES_LASTMODIFIED_HEADER)) {
+            // Dates are plain ASCII and the parser skips the line breaks of folded values
+            summary.lastModifiedDate = parseLastModifiedDate(value);
+            haveLastModified = true;
+        } else if (!haveClassification && isHeader(name, X_NOTES_CLASSIFICATION_HEADER)) {
+            KMime::Headers::Generic classification(X_NOTES_CLASSIFICATION_HEADER);
+            classification.from7BitString(unfoldHeaderValue(value));
+            summary.classification = parseClassification(classification.asUnicodeString());
+            haveClassification = true;
+        }
+        return !(haveUid && haveTitle && haveCreationDate && haveLastModified && haveClassification);
+    });
+    return summary;
+}
+
+QByteArray patchNoteHeaders(QByteArrayView message, const NoteHeaderChanges &changes)
+{
+    if (message.isEmpty()) {
+        return {};
+    }
+    const qsizetype firstLineBreak = message.indexOf('\n');
+    const QByteArray lineBreak = firstLineBreak > 0 && message[firstLineBreak - 1] == '\r' ? QByteArrayLiteral("\r\n") : QByteArrayLiteral("\n");
+
+    struct Patch {
+        const char *name;
+        QByteArray field;
+        bool written = false;
+    };
+    Patch patches[3] = {{"Subject", {}}, {X_NOTES_LASTMODIFIED_HEADER, {}}, {X_NOTES_CLASSIFICATION_HEADER, {}}};
+    if (changes.title) {
+        KMime::Headers::Subject header;
+        header.fromUnicodeString(changes.title->isEmpty() ? i18nc("The default name for new notes.", "New Note") : *changes.title);
+        patches[0].field = header.as7BitString(true) + lineBreak;
+    }
+    if (changes.lastModifiedDate) {
+        KMime::Headers::Generic header(X_NOTES_LASTMODIFIED_HEADER);
+        header.from7BitString(formatLastModifiedDate(changes.lastModifiedDate->isValid() ? *changes.lastModifiedDate : QDateTime::currentDateTime()));
+        patches[1].field = header.as7BitString(true) + lineBreak;
+    }
+    if (changes.classification) {
+        KMime::Headers::Generic header(X_NOTES_CLASSIFICATION_HEADER);
+        header.fromUnicodeString(classificationName(*changes.classification));
+        patches[2].field = header.as7BitString(true) + lineBreak;
+    }
+
+    QByteArray result;
+    result.reserve(message.size() + 256);
+    qsizetype copied = 0;
+    const qsizetype headerEnd = forEachHeaderField(message, [&](const HeaderField &field) {
+        for (Patch &patch : patches) {
+            if (patch.field.isNull() || !isHeader(field.name, patch.name)) {
+                continue;
+            }
+            // The first occurrence is replaced, later ones are dropped
+            result.append(message.sliced(copied, field.begin - copied));
+            if (!patch.written) {
+                result.append(patch.field);
+                patch.written = true;
+            }
+            copied = field.end;
+            break;
+        }
+        return true;
+    });
+    result.append(message.sliced(copied, headerEnd - copied));
+    for (const Patch &patch : patches) {
+        if (!patch.field.isNull() && !patch.written) {
+            if (!result.isEmpty() && !result.endsWith('\n')) {
+                result.append(lineBreak);
+            }
+            result.append(patch.field);
+        }
+    }
+    result.append(message.sliced(headerEnd));
+    return result;
+}
+
+static NoteParseResult parseNote(const KMime::MessagePtr &msg, NoteMessageWrapper::ParseMode mode)
+{
+    NoteParseResult result;
+    if (!msg.data()) {
+        result.errorString = i18n("Empty message");
+        return result;
+    }
+    try {
+        auto note = QSharedPointer<NoteMessageWrapper>::create(msg, mode);
+        result.errorString = note->errorString();
+        result.note = std::move(note);
+    } catch (const std::exception &e) {
+        result.errorString = QString::fromLocal8Bit(e.what());
+    }
+    return result;
+}
+
+QList<NoteParseResult> parseNotes(const QList<KMime::MessagePtr> &messages, QThreadPool *pool, NoteMessageWrapper::ParseMode mode)
+{
+    QList<NoteParseResult> results(messages.size());
+    NoteParseResult *const first = results.data();
+    QtConcurrent::blockingMap(pool ? pool : QThreadPool::globalInstance(), results.begin(), results.end(), [&](NoteParseResult &result) {
+        result = parseNote(messages.at(&result - first), mode);
+    });
+    return results;
+}
+
+QList<NoteParseResult> parseNotes(const QList<QByteArray> &rawMessages, QThreadPool *pool)
+{
+    QList<NoteParseResult> results(rawMessages.size());
+    NoteParseResult *const first = results.data();
+    QtConcurrent::blockingMap(pool ? pool : QThreadPool::globalInstance(), results.begin(), results.end(), [&](NoteParseResult &result) {
+        const QByteArray &raw = rawMessages.at(&result - first);
+        if (raw.isEmpty()) {
+            result.errorString = i18n("Empty message");
+            return;
+        }
+        try {
+            auto msg = KMime::MessagePtr(new KMime::Message);
+            msg->setContent(raw);
+            msg->parse();
+            result = parseNote(msg, NoteMessageWrapper::EagerParsing);
+        } catch (const std::exception &e) {
+            result.errorString = QString::fromLocal8Bit(e.what());
+        }
+    });
+    return results;
+}
+
+void setAttachmentSpillThreshold(qsizetype bytes)
+{
+    s_attachmentSpillThreshold.store(std::max<qsizetype>(bytes, 0), std::memory_order_relaxed);
+}
+
+qsizetype attachmentSpillThreshold()
+{
+    return s_attachmentSpillThreshold.load(std::memory_order_relaxed);
+}
+
+void setAttachmentSpillDirectory(const QString &path)
+{
+    const QMutexLocker locker(&s_spillDirectory->mutex);
+    s_spillDirectory->path = path;
+}
+
+QString attachmentSpillDirectory()
+{
+    const QMutexLocker locker(&s_spillDirectory->mutex);
+    return s_spillDirectory->path.isEmpty() ? QDir::tempPath() : s_spillDirectory->path;
+}
+
 QString noteIconName()
 {
     return QStringLiteral("text-plain");
@@ -8,16 +8,21 @@
 
 #include "akonadi-notes_export.h"
 
+#include <QByteArrayView>
+#include <QDateTime>
+#include <QFuture>
+#include <QList>
 #include <QMap>
+#include <QSharedDataPointer>
+#include <QSharedPointer>
 #include <QUrl>
 
 #include <memory>
+#include <optional>
 
-class QDateTime;
+class QIODevice;
 class QString;
-
-template<typename T>
-class QSharedPointer;
+class QThreadPool;
 
 namespace KMime
 {
@@ -40,10 +45,96 @@ AKONADI_NOTES_EXPORT QString noteMimeType();
  */
 AKONADI_NOTES_EXPORT QString noteIconName();
 
+/**
+ * Sets the size in bytes above which the decoded data of inline attachments is
+ * moved to a memory mapped temporary file when a note is parsed
+ *
+ * This keeps notes with large attachments like scans or photos from holding
+ * their data in memory. On Unix the file is removed as soon as it is mapped,
+ * so file backed attachments do not keep file descriptors open. Elsewhere
+ * each of them keeps its file open.
+ * The default of 0 keeps all data in memory.
+ *
+ * @see Attachment::isFileBacked()
+ * @since 6.3
+ */
+AKONADI_NOTES_EXPORT void setAttachmentSpillThreshold(qsizetype bytes);
+
+/**
+ * Returns the size above which attachment data is moved to a file
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT qsizetype attachmentSpillThreshold();
+
+/**
+ * Sets the directory for the files of file backed attachments
+ *
+ * An empty @p path, the default, selects QDir::tempPath().
+ * @since 6.3
+ */
+AKONADI_NOTES_EXPORT void setAttachmentSpillDirectory(const QString &path);
+
+/**
+ * Returns the directory for the files of file backed attachments
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT QString attachmentSpillDirectory();
+
+/**
+ * Enables sharing the data of equal attachments across all parsed notes
+ *
+ * While enabled, the decoded data of each parsed inline attachment is looked
+ * up by a hash of its content and its mimetype, and attachments with the same
+ * content share a single buffer, even in different notes. The data is decoded
+ * while parsing, and a payload is dropped once no attachment uses it any more.
+ * Attachments above the spill threshold are not shared. Disabled by default.
+ *
+ * @see attachmentDeduplicationStatistics()
+ * @since 6.3
+ */
+AKONADI_NOTES_EXPORT void setAttachmentDeduplicationEnabled(bool enabled);
+
+/**
+ * Returns true if the data of equal parsed attachments is shared
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT bool attachmentDeduplicationEnabled();
+
+/**
+ * Counters for the sharing of attachment data
+ * @since 6.3
+ */
+struct AttachmentDeduplicationStatistics {
+    /// Attachments parsed while deduplication was enabled
+    qint64 lookups = 0;
+    /// Attachments that reused the data of an earlier one
+    qint64 hits = 0;
+    /// Total size of the data that was reused instead of being kept again
+    qint64 savedBytes = 0;
+    /// Distinct payloads in use now
+    qint64 entries = 0;
+    /// Total size of the distinct payloads in use now
+    qint64 storedBytes = 0;
+};
+
+/**
+ * Returns the counters of attachment deduplication
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT AttachmentDeduplicationStatistics attachmentDeduplicationStatistics();
+
+/**
+ * Resets the lookups, hits and savedBytes counters
+ * @since 6.3
+ */
+AKONADI_NOTES_EXPORT void resetAttachmentDeduplicationStatistics();
+
 class AttachmentPrivate;
 
 /**
  * An attachment for a note
+ *
+ * Attachments are implicitly shared, copying one does not copy its data.
  * @since 4.9
  */
 class AKONADI_NOTES_EXPORT Attachment
@@ -58,22 +149,74 @@ public:
      * Create an attachment with the content stored inline
      */
     Attachment(const QByteArray &data, const QString &mimetype);
+    /**
+     * Create an attachment with the content stored inline, taking over @p data
+     * @since 6.3
+     */
+    Attachment(QByteArray &&data, const QString &mimetype);
     Attachment(const Attachment &other);
+    /**
+     * Moves @p other into this attachment, @p other can only be assigned to or destroyed afterwards
+     * @since 6.3
+     */
+    Attachment(Attachment &&other) noexcept;
     ~Attachment();
 
     bool operator==(const Attachment &a) const;
-    void operator=(const Attachment &a);
+    Attachment &operator=(const Attachment &a);
+    /**
+     * @since 6.3
+     */
+    Attachment &operator=(Attachment &&a) noexcept;
+
+    /**
+     * Swaps this attachment with @p other
+     * @since 6.3
+     */
+    void swap(Attachment &other) noexcept
+    {
+        d.swap(other.d);
+    }
 
     /**
      * Returns the url for url-only attachments
+     *
+     * An attachment is url-only if its url is valid, otherwise it is an inline
+     * attachment.
      */
     [[nodiscard]] QUrl url() const;
 
     /**
      * Returns the date for inline attachments
+     *
+     * The data of a file backed attachment is copied from the file, and the
+     * data of a parsed attachment is decoded the first time it is needed.
+     * open() gives access to it without copying or decoding all of it at once.
      */
     [[nodiscard]] QByteArray data() const;
 
+    /**
+     * Returns true if the data is kept in a memory mapped file instead of in memory
+     *
+     * @see setAttachmentSpillThreshold()
+     * @since 6.3
+     */
+    [[nodiscard]] bool isFileBacked() const;
+
+    /**
+     * Returns a read-only device positioned at the start of the inline data
+     *
+     * The device always yields the decoded data. Base64 encoded data, of a
+     * parsed attachment or set with setDataBase64Encoded(), is decoded a few
+     * kilobytes at a time while it is read. For a file backed attachment the
+     * device reads from the mapped file. The size() of the device is the size
+     * of the decoded data in all cases, it is known without reading it. The
+     * device stays valid after the attachment is destroyed. Returns null for
+     * url-only attachments.
+     * @since 6.3
+     */
+    [[nodiscard]] std::unique_ptr<QIODevice> open() const;
+
     /**
      * Sets the unique identifier of the attachment
      *
@@ -120,15 +263,65 @@ public:
      */
     [[nodiscard]] QString label() const;
 
+    /**
+     * Returns the BLAKE2b-256 digest of the decoded inline data, or an empty array for url-only attachments
+     *
+     * The digest is computed once and shared by the copies of the attachment.
+     * Parsed attachments that are deduplicated already know it.
+     * @see setAttachmentDeduplicationEnabled()
+     * @since 6.3
+     */
+    [[nodiscard]] QByteArray digest() const;
+
+    /**
+     * Returns an estimate of the heap memory held by the attachment in bytes
+     *
+     * The data is counted in full, even if it is shared with copies of the attachment.
+     * @since 6.3
+     */
+    [[nodiscard]] qsizetype estimatedMemoryUsage() const;
+
 private:
     //@cond PRIVATE
-    std::unique_ptr<AttachmentPrivate> const d_ptr;
-    Q_DECLARE_PRIVATE(Attachment)
+    friend class NoteMessageWrapperPrivate;
+    QSharedDataPointer<AttachmentPrivate> d;
     //@endcond
 };
 
 class NoteMessageWrapperPrivate;
 
+/**
+ * Heap memory held by a note in bytes, see NoteMessageWrapper::estimatedMemoryUsage()
+ * @since 6.3
+ */
+struct NoteMemoryUsage {
+    /**
+     * The uid, title, text and sender
+     */
+    qsizetype text = 0;
+    /**
+     * The custom values
+     */
+    qsizetype custom = 0;
+    /**
+     * The attachments, including their inline data
+     */
+    qsizetype attachments = 0;
+    /**
+     * The message of a lazily parsed note and the encoded parts kept for message()
+     */
+    qsizetype message = 0;
+    /**
+     * The note itself
+     */
+    qsizetype other = 0;
+
+    [[nodiscard]] qsizetype total() const
+    {
+        return text + custom + attachments + message + other;
+    }
+};
+
 /**
  * A convenience wrapper around KMime::MessagePtr for notes
  *
@@ -170,15 +363,52 @@ class NoteMessageWrapperPrivate;
 class AKONADI_NOTES_EXPORT NoteMessageWrapper
 {
 public:
+    /**
+     * How a message passed to the constructor is decoded
+     * @since 6.3
+     */
+    enum ParseMode {
+        EagerParsing, ///< decode all fields, the body, the custom values and the attachments up front
+        LazyParsing ///< keep the message and decode each of them the first time it is accessed
+    };
+
     NoteMessageWrapper();
     explicit NoteMessageWrapper(const KMime::MessagePtr &msg);
+
+    /**
+     * Wrap @p msg using the given parse mode
+     *
+     * With LazyParsing the wrapper keeps a reference to @p msg, so reading only
+     * uid(), title() and lastModifiedDate() does not decode the body or the
+     * attachment payloads. @p msg must not be modified while fields are pending,
+     * and a lazily parsed wrapper must not be read from several threads at once.
+     *
+     * @since 6.3
+     */
+    NoteMessageWrapper(const KMime::MessagePtr &msg, ParseMode mode);
+
+    /**
+     * Moves @p other into this note, @p other can only be assigned to or destroyed afterwards
+     * @since 6.3
+     */
+    NoteMessageWrapper(NoteMessageWrapper &&other) noexcept;
     ~NoteMessageWrapper();
 
+    /**
+     * Moves @p other into this note, @p other can only be assigned to or destroyed afterwards
+     * @since 6.3
+     */
+    NoteMessageWrapper &operator=(NoteMessageWrapper &&other) noexcept;
+
     /**
      * Set the uid of the note
      * @param uid should be globally unique
      */
     void setUid(const QString &uid);
+    /**
+     * @since 6.3
+     */
+    void setUid(QString &&uid);
 
     /**
      * Returns the uid of the note
@@ -205,6 +435,10 @@ public:
      * Set the title of the note
      */
     void setTitle(const QString &title);
+    /**
+     * @since 6.3
+     */
+    void setTitle(QString &&title);
 
     /**
      * Returns the title of the note
@@ -217,12 +451,24 @@ public:
      * @param format only Qt::PlainText and Qt::RichText is supported
      */
     void setText(const QString &text, Qt::TextFormat format = Qt::PlainText);
+    /**
+     * @since 6.3
+     */
+    void setText(QString &&text, Qt::TextFormat format = Qt::PlainText);
 
     /**
      * Returns the text of the note
      */
     [[nodiscard]] QString text() const;
 
+    /**
+     * Returns the text of the note and leaves the note with an empty text
+     *
+     * Unlike text() this does not need to copy the text if it is not shared.
+     * @since 6.3
+     */
+    [[nodiscard]] QString takeText();
+
     /**
      * @return Qt::PlainText or Qt::RichText
      */
@@ -230,9 +476,29 @@ public:
 
     /**
      * @return plaintext version of the text (if richtext)
+     *
+     * For rich text the content of the body is returned without tags, with
+     * character references decoded and surrounding whitespace removed. The
+     * named references of HTML 4 and &amp;apos; are known, others are kept
+     * as they are.
+     *
+     * @note Since 6.3 character references like &amp;amp; are decoded to the
+     * characters they stand for. Before, the result was HTML escaped again,
+     * so callers that still unescape it have to stop doing so.
      */
     [[nodiscard]] QString toPlainText() const;
 
+    /**
+     * Returns the beginning of toPlainText(), at most @p maxChars characters long
+     *
+     * Only as much of the text is decoded and converted as is needed for the
+     * preview, so the cost depends on @p maxChars and not on the size of the
+     * note. Whitespace at both ends of the preview is removed.
+     *
+     * @since 6.3
+     */
+    [[nodiscard]] QString preview(int maxChars = 200) const;
+
     /**
      * Set the creation date of the note (stored in the mime header)
      */
@@ -259,38 +525,276 @@ public:
      * @param from must be an address in the style of foo@kde.org.
      */
     void setFrom(const QString &from);
+    /**
+     * @since 6.3
+     */
+    void setFrom(QString &&from);
 
     /**
      * Returns the origin (creator) of the note
      */
     [[nodiscard]] QString from() const;
 
+    /**
+     * Returns a description of the problems found while decoding the message
+     * this note was created from, or an empty string if there were none
+     *
+     * For a lazily parsed note only the fields decoded so far are covered.
+     * @since 6.3
+     */
+    [[nodiscard]] QString errorString() const;
+
     /**
      * Returns a reference to the list of attachments of the note
      */
     [[nodiscard]] QList<Attachment> &attachments();
 
+    /**
+     * Returns the list of attachments of a note that is only read, e.g. one from NoteCache
+     * @since 6.3
+     */
+    [[nodiscard]] const QList<Attachment> &attachments() const;
+
     /**
      * Returns a reference to the custom-value map
      * @return key-value map containing all custom values
      */
     [[nodiscard]] QMap<QString, QString> &custom();
 
+    /**
+     * Returns the custom-value map of a note that is only read, e.g. one from NoteCache
+     * @since 6.3
+     */
+    [[nodiscard]] const QMap<QString, QString> &custom() const;
+
+    /**
+     * Returns an estimate of the heap memory held by the note, e.g. to size caches
+     *
+     * Implicitly shared buffers are counted once per note: an attachment whose
+     * data is shared with another attachment or with the encoded parts kept for
+     * message() does not count twice. Buffers shared with other notes or with the
+     * caller, like the message of a lazily parsed note, are counted in full.
+     * Pending fields of a lazily parsed note are not decoded.
+     * @since 6.3
+     */
+    [[nodiscard]] NoteMemoryUsage estimatedMemoryUsage() const;
+
     /**
      * Assemble a KMime message with the given values
      *
      * The message can then i.e. be stored inside an akonadi item
+     *
+     * Attachments of a parsed message keep their encoded form and are not
+     * encoded again, and neither are the custom values of a parsed message
+     * while they are unchanged. The base64 bodies of other inline attachments
+     * are kept for the next call, see setReuseEncodedParts().
      */
     KMime::MessagePtr message() const;
 
+    /**
+     * Keeps the encoded parts of each message() for the next one
+     *
+     * While enabled, the base64 bodies of the inline attachments and the
+     * custom values part assembled by message() are kept and reused as long
+     * as the attachment data and custom values are unchanged, so assembling
+     * the message again after changing e.g. only the title does not encode
+     * the attachments again. This suits editors that save a note repeatedly.
+     *
+     * The kept bodies hold about 4/3 of the size of the attachment data, on
+     * top of the data itself, for as long as the note lives. At most 4 MiB of
+     * them are kept per note, further attachments are encoded on every call.
+     * They are counted by estimatedMemoryUsage() and dropped when this is
+     * disabled. Enabled by default.
+     *
+     * @since 6.3
+     */
+    void setReuseEncodedParts(bool reuse);
+
+    /**
+     * Returns true if message() keeps its encoded parts for the next call
+     * @since 6.3
+     */
+    [[nodiscard]] bool reuseEncodedParts() const;
+
+    /**
+     * How writeTo() serializes the note
+     * @since 6.3
+     */
+    enum SerializationMode {
+        DefaultSerialization, ///< empty fields are filled in like by message(), the MIME boundary is random
+        CanonicalSerialization ///< notes with the same fingerprint() are written as the same bytes
+    };
+
+    /**
+     * Writes the note as an RFC822 message to @p device
+     *
+     * The message is written piece by piece, without building a KMime::Message
+     * first, and attachments are base64-encoded in chunks. The result can be
+     * parsed back with NoteMessageWrapper(const KMime::MessagePtr &).
+     *
+     * With DefaultSerialization empty fields are filled in the same way as by
+     * message(). With CanonicalSerialization empty fields are left out, dates
+     * are written in UTC, attachments are encoded from their decoded data and
+     * the boundary is derived from fingerprint(), so the output only depends
+     * on what fingerprint() covers.
+     *
+     * @return false if writing to @p device failed
+     * @since 6.3
+     */
+    bool writeTo(QIODevice *device, SerializationMode mode = DefaultSerialization) const;
+
+    /**
+     * Returns a 16 byte hash of the content of the note
+     *
+     * The hash covers the uid, title, text and its format, sender,
+     * classification, the dates to the second, the custom values and the
+     * url, mimetype, label, content id and decoded data of each attachment.
+     * Trailing whitespace of the text is ignored, as it is not kept by the
+     * message format. Notes with equal content have equal fingerprints, no
+     * matter how they were created or encoded, and a note parsed from the
+     * output of writeTo() with CanonicalSerialization has the fingerprint of
+     * the note that was written. Comparing fingerprints is enough to tell if
+     * a note changed.
+     *
+     * All fields are decoded and the attachment data is hashed, so this is
+     * about as expensive as parsing the note.
+     * @since 6.3
+     */
+    [[nodiscard]] QByteArray fingerprint() const;
+
+    /**
+     * Parses @p msg on a thread of @p pool, or of QThreadPool::globalInstance() if @p pool is null
+     *
+     * The attachment data is decoded on that thread as well. Cancelling the
+     * returned future stops parsing before the next message part, the future
+     * has no result then. @p msg must not be used by other threads until the
+     * future is finished.
+     *
+     * @since 6.3
+     */
+    [[nodiscard]] static QFuture<QSharedPointer<NoteMessageWrapper>> parseAsync(const KMime::MessagePtr &msg, QThreadPool *pool = nullptr);
+
+    /**
+     * Assembles the same message as message(), but on a thread of @p pool, or
+     * of QThreadPool::globalInstance() if @p pool is null
+     *
+     * The values of the note are captured when this is called, later changes
+     * do not affect the result. Cancelling the returned future stops the
+     * assembly before the next attachment, the future has no result then.
+     *
+     * @since 6.3
+     */
+    [[nodiscard]] QFuture<KMime::MessagePtr> serializeAsync(QThreadPool *pool = nullptr) const;
+
 private:
     //@cond PRIVATE
+    friend class NoteCache;
+    // Decodes the pending fields of a lazily parsed note and the payloads of its attachments
+    void loadAll() const;
+
     Q_DISABLE_COPY(NoteMessageWrapper)
-    std::unique_ptr<NoteMessageWrapperPrivate> const d_ptr;
+    std::unique_ptr<NoteMessageWrapperPrivate> d_ptr;
     Q_DECLARE_PRIVATE(NoteMessageWrapper)
     //@endcond
 };
 
+/**
+ * Metadata of a note as read from the header block of its raw message
+ *
+ * The fields have the same values NoteMessageWrapper reports for the parsed message.
+ * @since 6.3
+ */
+struct NoteHeaderSummary {
+    QString uid;
+    QString title;
+    QDateTime creationDate;
+    QDateTime lastModifiedDate;
+    NoteMessageWrapper::Classification classification = NoteMessageWrapper::Public;
+};
+
+/**
+ * Reads uid, title, dates and classification from the raw RFC822 bytes of a note
+ *
+ * Only the top-level header block is scanned, the body and the attachment
+ * parts are never looked at and no KMime::Message is built. Folded lines and
+ * RFC2047 encoded words are only decoded for the returned fields.
+ *
+ * @param message the raw message, as returned by KMime::Content::encodedContent()
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT NoteHeaderSummary scanNoteHeaders(QByteArrayView message);
+
+/**
+ * Header values to change with patchNoteHeaders(), unset fields are left alone
+ * @since 6.3
+ */
+struct NoteHeaderChanges {
+    std::optional<QString> title;
+    std::optional<QDateTime> lastModifiedDate;
+    std::optional<NoteMessageWrapper::Classification> classification;
+};
+
+/**
+ * Rewrites the title, last modified date or classification headers in the raw RFC822 bytes of a note
+ *
+ * Only the changed header fields are formatted again, in the same way as by
+ * NoteMessageWrapper::message(), including the default title for an empty one
+ * and the current time for an invalid date. All other headers, the body and
+ * the attachment parts are copied byte by byte without being parsed. Missing
+ * headers are added at the end of the header block, using the line breaks
+ * of @p message.
+ *
+ * @param message the raw message, as returned by KMime::Content::encodedContent()
+ * @return the patched message, or an empty array if @p message is empty
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT QByteArray patchNoteHeaders(QByteArrayView message, const NoteHeaderChanges &changes);
+
+/**
+ * Outcome of parsing one message with parseNotes()
+ * @since 6.3
+ */
+struct NoteParseResult {
+    /**
+     * The parsed note, or null if the message could not be parsed at all
+     */
+    QSharedPointer<NoteMessageWrapper> note;
+    /**
+     * Why the note is null, or the problems NoteMessageWrapper::errorString()
+     * reported for it, translated for the user. Empty if there were none.
+     */
+    QString errorString;
+};
+
+/**
+ * Parses many notes in parallel
+ *
+ * Each message is wrapped in a NoteMessageWrapper on a thread of @p pool, or
+ * of QThreadPool::globalInstance() if @p pool is null, and the call blocks
+ * until all of them are done. The results are in the order of @p messages.
+ *
+ * Parsing is reentrant: a note only reads the message it wraps, the custom
+ * values are read with a QXmlStreamReader local to the call and problems are
+ * logged through the thread-safe QLoggingCategory machinery. As KMime creates
+ * missing headers on access, the same message must not appear twice in
+ * @p messages or be used by another thread meanwhile.
+ *
+ * @param mode with NoteMessageWrapper::LazyParsing only the work needed to
+ *        set up the notes is done in parallel
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT QList<NoteParseResult>
+parseNotes(const QList<KMime::MessagePtr> &messages, QThreadPool *pool = nullptr, NoteMessageWrapper::ParseMode mode = NoteMessageWrapper::EagerParsing);
+
+/**
+ * Parses many raw RFC822 notes in parallel
+ *
+ * Like the overload above, but the KMime parse of each message is done on
+ * the pool as well.
+ * @since 6.3
+ */
+[[nodiscard]] AKONADI_NOTES_EXPORT QList<NoteParseResult> parseNotes(const QList<QByteArray> &rawMessages, QThreadPool *pool = nullptr);
+
 }
 }
 
@@ -0,0 +1,293 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "rfc2822date_p.h"
+
+#include <QTimeZone>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+namespace Rfc2822Date
+{
+static const char dayNames[7][4] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+static const char monthNames[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static bool isLetter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static char toLower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+// Returns the index of the name that word starts with, or -1. Full names like "March" match as well.
+template<int Count>
+static int indexOfName(QByteArrayView word, const char (&names)[Count][4])
+{
+    if (word.size() < 3) {
+        return -1;
+    }
+    for (int i = 0; i < Count; ++i) {
+        if (toLower(word[0]) == toLower(names[i][0]) && toLower(word[1]) == toLower(names[i][1]) && toLower(word[2]) == toLower(names[i][2])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+namespace
+{
+// Reads a date from left to right
+class Reader
+{
+public:
+    explicit Reader(QByteArrayView data)
+        : mData(data)
+    {
+    }
+
+    bool atEnd() const
+    {
+        return mPos >= mData.size();
+    }
+
+    // Skips whitespace, including the line breaks of folded headers
+    void skipSpace()
+    {
+        while (!atEnd() && (mData[mPos] == ' ' || mData[mPos] == '\t' || mData[mPos] == '\r' || mData[mPos] == '\n')) {
+            ++mPos;
+        }
+    }
+
+    bool skip(char c)
+    {
+        if (!atEnd() && mData[mPos] == c) {
+            ++mPos;
+            return true;
+        }
+        return false;
+    }
+
+    QByteArrayView word()
+    {
+        const qsizetype begin = mPos;
+        while (!atEnd() && isLetter(mData[mPos])) {
+            ++mPos;
+        }
+        return mData.sliced(begin, mPos - begin);
+    }
+
+    // Reads a number of minDigits to maxDigits digits
+    bool number(int minDigits, int maxDigits, int &value, int *digits = nullptr)
+    {
+        int count = 0;
+        value = 0;
+        while (count < maxDigits && !atEnd() && isDigit(mData[mPos])) {
+            value = value * 10 + (mData[mPos] - '0');
+            ++mPos;
+            ++count;
+        }
+        if (digits) {
+            *digits = count;
+        }
+        // A longer number is not cut off
+        return count >= minDigits && (atEnd() || !isDigit(mData[mPos]));
+    }
+
+    // Reads the zone, if any, as offset from UTC in seconds
+    bool zone(int &offset)
+    {
+        offset = 0;
+        if (atEnd() || mData[mPos] == '(') {
+            return true;
+        }
+        const char sign = mData[mPos];
+        if (sign == '+' || sign == '-') {
+            ++mPos;
+            int value;
+            if (!number(4, 4, value) || value % 100 >= 60) {
+                return false;
+            }
+            offset = (value / 100 * 60 + value % 100) * 60;
+            if (sign == '-') {
+                offset = -offset;
+            }
+            return true;
+        }
+
+        struct Zone {
+            const char *name;
+            int hours;
+        };
+        static const Zone zones[] = {{"ut", 0},
+                                     {"utc", 0},
+                                     {"gmt", 0},
+                                     {"z", 0},
+                                     {"est", -5},
+                                     {"edt", -4},
+                                     {"cst", -6},
+                                     {"cdt", -5},
+                                     {"mst", -7},
+                                     {"mdt", -6},
+                                     {"pst", -8},
+                                     {"pdt", -7}};
+        const QByteArrayView name = word();
+        for (const Zone &z : zones) {
+            if (name.compare(QByteArrayView(z.name), Qt::CaseInsensitive) == 0) {
+                offset = z.hours * 3600;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool skipComment()
+    {
+        if (!skip('(')) {
+            return true;
+        }
+        const qsizetype end = mData.indexOf(')', mPos);
+        if (end < 0) {
+            return false;
+        }
+        mPos = end + 1;
+        return true;
+    }
+
+private:
+    QByteArrayView mData;
+    qsizetype mPos = 0;
+};
+}
+
+QDateTime parse(QByteArrayView date)
+{
+    Reader reader(date);
+    reader.skipSpace();
+    const QByteArrayView dayName = reader.word();
+    if (!dayName.isEmpty()) {
+        if (indexOfName(dayName, dayNames) < 0) {
+            return {};
+        }
+        reader.skipSpace();
+        reader.skip(',');
+        reader.skipSpace();
+    }
+
+    int day;
+    if (!reader.number(1, 2, day)) {
+        return {};
+    }
+    reader.skipSpace();
+    const int month = indexOfName(reader.word(), monthNames) + 1;
+    if (month == 0) {
+        return {};
+    }
+    reader.skipSpace();
+    int year;
+    int yearDigits;
+    if (!reader.number(2, 4, year, &yearDigits)) {
+        return {};
+    }
+    if (yearDigits == 2) {
+        year += year < 50 ? 2000 : 1900;
+    } else if (yearDigits == 3) {
+        year += 1900;
+    }
+
+    reader.skipSpace();
+    int hour;
+    int minute;
+    int second = 0;
+    if (!reader.number(1, 2, hour) || !reader.skip(':') || !reader.number(2, 2, minute)) {
+        return {};
+    }
+    if (reader.skip(':') && !reader.number(2, 2, second)) {
+        return {};
+    }
+
+    reader.skipSpace();
+    int offset;
+    if (!reader.zone(offset)) {
+        return {};
+    }
+    reader.skipSpace();
+    if (!reader.skipComment()) {
+        return {};
+    }
+    reader.skipSpace();
+    if (!reader.atEnd()) {
+        return {};
+    }
+
+    const QDate d(year, month, day);
+    const QTime t(hour, minute, second);
+    if (!d.isValid() || !t.isValid()) {
+        return {};
+    }
+    return QDateTime(d, t, QTimeZone::fromSecondsAheadOfUtc(offset));
+}
+
+static char *writeNumber(char *out, int value, int digits)
+{
+    for (int i = digits - 1; i >= 0; --i) {
+        out[i] = char('0' + value % 10);
+        value /= 10;
+    }
+    return out + digits;
+}
+
+qsizetype format(const QDateTime &dateTime, char *buffer)
+{
+    if (!dateTime.isValid()) {
+        return 0;
+    }
+    const QDate date = dateTime.date();
+    const QTime time = dateTime.time();
+    if (date.year() < 0 || date.year() > 9999) {
+        return 0;
+    }
+    const int offset = dateTime.offsetFromUtc();
+
+    char *out = buffer;
+    std::memcpy(out, dayNames[date.dayOfWeek() - 1], 3);
+    out += 3;
+    *out++ = ',';
+    *out++ = ' ';
+    out = writeNumber(out, date.day(), 2);
+    *out++ = ' ';
+    std::memcpy(out, monthNames[date.month() - 1], 3);
+    out += 3;
+    *out++ = ' ';
+    out = writeNumber(out, date.year(), 4);
+    *out++ = ' ';
+    out = writeNumber(out, time.hour(), 2);
+    *out++ = ':';
+    out = writeNumber(out, time.minute(), 2);
+    *out++ = ':';
+    out = writeNumber(out, time.second(), 2);
+    *out++ = ' ';
+    *out++ = offset < 0 ? '-' : '+';
+    const int minutes = std::abs(offset) / 60;
+    out = writeNumber(out, minutes / 60, 2);
+    out = writeNumber(out, minutes % 60, 2);
+    return out - buffer;
+}
+}
+}
+}
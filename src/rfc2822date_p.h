@@ -0,0 +1,51 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QByteArrayView>
+#include <QDateTime>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+/**
+ * Codec for the RFC2822 dates of the X-Akonotes-LastModified header
+ *
+ * Both directions work on bytes and need no temporary strings.
+ */
+namespace Rfc2822Date
+{
+/**
+ * Parses a date like "Sat, 03 Mar 2012 04:04:04 +0000"
+ *
+ * The day name, the comma after it and the seconds are optional, the day may
+ * have one digit and the year two or three (RFC2822 obsolete years). The zone
+ * is a numeric offset, UT, UTC, GMT, Z or one of the obsolete US zone names,
+ * and a missing zone means UTC. A trailing comment in parentheses is ignored.
+ *
+ * @return an invalid QDateTime for anything else
+ */
+[[nodiscard]] QDateTime parse(QByteArrayView date);
+
+// Length of "Sat, 03 Mar 2012 04:04:04 +0000"
+constexpr qsizetype MaxFormattedLength = 31;
+
+/**
+ * Writes @p dateTime as "ddd, dd MMM yyyy hh:mm:ss +hhmm" to @p buffer, which
+ * must have room for MaxFormattedLength characters
+ *
+ * The result is the same as QLocale::c().toString(dateTime, "ddd, ") followed
+ * by dateTime.toString(Qt::RFC2822Date).
+ *
+ * @return the number of characters written, or 0 if @p dateTime is invalid or
+ *         its year does not fit in four digits
+ */
+[[nodiscard]] qsizetype format(const QDateTime &dateTime, char *buffer);
+}
+}
+}
@@ -0,0 +1,112 @@
+/*  This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 the Akonadi Notes authors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+namespace Akonadi
+{
+namespace NoteUtils
+{
+/**
+ * LEB128 varints and length prefixed byte strings, used by the compact
+ * binary formats of the library
+ */
+namespace Varint
+{
+inline void write(QByteArray &data, quint64 value)
+{
+    while (value >= 0x80) {
+        data += char(value | 0x80);
+        value >>= 7;
+    }
+    data += char(value);
+}
+
+inline void writeBytes(QByteArray &data, QByteArrayView bytes)
+{
+    write(data, bytes.size());
+    data.append(bytes);
+}
+
+// Small negative numbers as small varints
+inline quint64 zigzag(qint64 value)
+{
+    return (quint64(value) << 1) ^ quint64(value >> 63);
+}
+
+inline qint64 unzigzag(quint64 value)
+{
+    return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+// Reads the values written by write() and writeBytes(), any read past the end fails
+class Reader
+{
+public:
+    explicit Reader(QByteArrayView data)
+        : mData(data)
+    {
+    }
+
+    quint64 varint()
+    {
+        quint64 value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (mPos == mData.size()) {
+                break;
+            }
+            const auto byte = quint8(mData[mPos++]);
+            value |= quint64(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        mFailed = true;
+        return 0;
+    }
+
+    QByteArrayView bytes(quint64 size)
+    {
+        if (size > quint64(mData.size() - mPos)) {
+            mFailed = true;
+            return {};
+        }
+        const QByteArrayView bytes = mData.sliced(mPos, qsizetype(size));
+        mPos += qsizetype(size);
+        return bytes;
+    }
+
+    QByteArrayView bytes()
+    {
+        return bytes(varint());
+    }
+
+    void fail()
+    {
+        mFailed = true;
+    }
+
+    bool failed() const
+    {
+        return mFailed;
+    }
+
+    bool atEnd() const
+    {
+        return mPos == mData.size();
+    }
+
+private:
+    const QByteArrayView mData;
+    qsizetype mPos = 0;
+    bool mFailed = false;
+};
+}
+}
+}